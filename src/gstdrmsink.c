@@ -84,6 +84,11 @@
  * gst-launch playbin uri=[uri] video-sink="drmsink native-resolution=true"
  * ]|
  * Use playbin while passing options to drmsink.
+ * |[
+ * gst-launch -v videotestsrc ! drmsink screen-format=RGB16
+ * ]|
+ * Scan out a 16bpp RGB565 screen, halving the memory bandwidth used for
+ * uploads and scanout. Upstream is asked to produce RGB16 directly.
  * </refsect2>
  * <refsect2>
  * <title>Caveats</title>
@@ -107,6 +112,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <time.h>
@@ -116,6 +123,7 @@
 #include <glib/gprintf.h>
 #include <xf86drmMode.h>
 #include <xf86drm.h>
+#include <drm_fourcc.h>
 #include <libkms.h>
 
 #include <gst/gst.h>
@@ -123,6 +131,7 @@
 #include <gst/video/video.h>
 #include <gst/video/video-info.h>
 #include "gstdrmsink.h"
+#include "gstframebuffersinktrace.h"
 
 /* When LAZY_ALLOCATION is defined, memory buffers are only allocated
    when they are actually mapped for the first time. This solves the
@@ -147,11 +156,16 @@ const gchar *message)
 
 #define DEFAULT_DRM_DEVICE "/dev/dri/card0"
 
+/* Default limit in MB on the dumb buffers kept for reuse after being freed;
+   enough for a few 1080p 32bpp screen buffers. */
+#define DEFAULT_BUFFER_CACHE_SIZE 32
+
 /* Class function prototypes. */
 static void gst_drmsink_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_drmsink_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_drmsink_finalize (GObject * object);
 
 static gboolean gst_drmsink_open_hardware (GstFramebufferSink *framebuffersink,
     GstVideoInfo *info, gsize *video_memory_size,
@@ -163,6 +177,8 @@ static GstAllocator *gst_drmsink_video_memory_allocator_new (
 static void gst_drmsink_pan_display (GstFramebufferSink *framebuffersink,
     GstMemory *memory);
 static void gst_drmsink_wait_for_vsync (GstFramebufferSink *framebuffersink);
+static gboolean gst_drmsink_set_color_balance (
+    GstFramebufferSink *framebuffersink, const gint *value);
 
 /* Local functions. */
 static void gst_drmsink_reset (GstDrmsink *drmsink);
@@ -172,20 +188,54 @@ static void gst_drmsink_page_flip_handler (int fd,  unsigned int sequence,
     unsigned int tv_sec, unsigned int tv_usec, void *user_data);
 static void gst_drmsink_flush_drm_events (GstDrmsink *drmsink);
 static void gst_drmsink_wait_pending_drm_events (GstDrmsink *drmsink);
+static void gst_drmsink_flush_buffer_cache (GstDrmsink *drmsink);
+static void gst_drmsink_set_scanout (GstDrmsink *drmsink, uint32_t scanout_fb,
+    uint32_t page_flip_fb);
+static gboolean gst_drmsink_wait_out_fence (GstDrmsink *drmsink,
+    GstClockTime timeout);
 
 enum
 {
   PROP_0,
   PROP_CONNECTOR,
+  PROP_SCREEN_FORMAT,
+  PROP_ATOMIC,
+  PROP_BUFFER_CACHE,
 };
 
+/* Screen (scanout) formats that can be selected with the screen-format
+   property, with the corresponding DRM format codes. */
+static const struct {
+  GstVideoFormat format;
+  uint32_t drm_format;
+} gst_drmsink_screen_formats[] = {
+  { GST_VIDEO_FORMAT_BGRx, DRM_FORMAT_XRGB8888 },
+  { GST_VIDEO_FORMAT_RGB16, DRM_FORMAT_RGB565 },
+#if GST_CHECK_VERSION(1, 10, 0)
+  { GST_VIDEO_FORMAT_BGR10A2_LE, DRM_FORMAT_XRGB2101010 },
+#endif
+  { GST_VIDEO_FORMAT_UNKNOWN, 0 }
+};
+
+#define DEFAULT_SCREEN_FORMAT "BGRx"
+
+/* BGR10A2_LE is only known to GStreamer 1.10 and later. */
+#if GST_CHECK_VERSION(1, 10, 0)
+#define GST_DRMSINK_TEMPLATE_CAPS_BGR10A2_LE \
+        "; " GST_VIDEO_CAPS_MAKE ("BGR10A2_LE")
+#else
+#define GST_DRMSINK_TEMPLATE_CAPS_BGR10A2_LE
+#endif
+
 #define GST_DRMSINK_TEMPLATE_CAPS \
         GST_VIDEO_CAPS_MAKE ("RGB") \
         "; " GST_VIDEO_CAPS_MAKE ("BGR") \
         "; " GST_VIDEO_CAPS_MAKE ("RGBx") \
         "; " GST_VIDEO_CAPS_MAKE ("BGRx") \
         "; " GST_VIDEO_CAPS_MAKE ("xRGB") \
-        "; " GST_VIDEO_CAPS_MAKE ("xBGR") ", " \
+        "; " GST_VIDEO_CAPS_MAKE ("xBGR") \
+        "; " GST_VIDEO_CAPS_MAKE ("RGB16") \
+        GST_DRMSINK_TEMPLATE_CAPS_BGR10A2_LE ", " \
         "framerate = (fraction) [ 0, MAX ], " \
         "width = (int) [ 1, MAX ], " "height = (int) [ 1, MAX ]"
 
@@ -213,6 +263,7 @@ gst_drmsink_class_init (GstDrmsinkClass* klass)
 
   gobject_class->set_property = gst_drmsink_set_property;
   gobject_class->get_property = gst_drmsink_get_property;
+  gobject_class->finalize = gst_drmsink_finalize;
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
@@ -228,6 +279,24 @@ gst_drmsink_class_init (GstDrmsinkClass* klass)
   g_object_class_install_property (gobject_class, PROP_CONNECTOR,
       g_param_spec_int ("connector", "Connector", "DRM connector id",
       0, G_MAXINT32, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SCREEN_FORMAT,
+      g_param_spec_string ("screen-format", "Screen format",
+      "Pixel format of the scanout buffers: BGRx (XRGB8888), RGB16 (RGB565) "
+      "or BGR10A2_LE (XRGB2101010). The format must be supported by the "
+      "primary plane; otherwise BGRx is used",
+      DEFAULT_SCREEN_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ATOMIC,
+      g_param_spec_boolean ("atomic", "Atomic modesetting",
+      "Use the atomic KMS API with nonblocking commits and out-fences when "
+      "the driver supports it",
+      TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BUFFER_CACHE,
+      g_param_spec_int ("buffer-cache", "Buffer cache size in MB",
+      "Maximum amount of freed video memory in MB that is kept mapped with "
+      "its framebuffer object for reuse when buffer pools are recreated; "
+      "0 disables the cache",
+      0, G_MAXINT, DEFAULT_BUFFER_CACHE_SIZE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   framebuffer_sink_class->open_hardware =
       GST_DEBUG_FUNCPTR (gst_drmsink_open_hardware);
@@ -239,6 +308,8 @@ gst_drmsink_class_init (GstDrmsinkClass* klass)
       GST_DEBUG_FUNCPTR (gst_drmsink_pan_display);
   framebuffer_sink_class->video_memory_allocator_new =
       GST_DEBUG_FUNCPTR (gst_drmsink_video_memory_allocator_new);
+  framebuffer_sink_class->set_color_balance =
+      GST_DEBUG_FUNCPTR (gst_drmsink_set_color_balance);
 }
 
 /* Class member functions. */
@@ -248,6 +319,7 @@ gst_drmsink_init (GstDrmsink *drmsink) {
   GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (drmsink);
 
   drmsink->fd = -1;
+  drmsink->out_fence_fd = -1;
 
   /* Override the default value of the device property from
      GstFramebufferSink. */
@@ -265,6 +337,9 @@ gst_drmsink_init (GstDrmsink *drmsink) {
 
   /* Set the initial values of the properties.*/
   drmsink->preferred_connector_id = - 1;
+  drmsink->screen_format_str = g_strdup (DEFAULT_SCREEN_FORMAT);
+  drmsink->atomic_property = TRUE;
+  drmsink->buffer_cache_max_property = DEFAULT_BUFFER_CACHE_SIZE;
 
   gst_drmsink_reset (drmsink);
 }
@@ -282,6 +357,17 @@ gst_drmsink_set_property (GObject * object, guint prop_id,
     case PROP_CONNECTOR:
       drmsink->preferred_connector_id = g_value_get_int (value);
       break;
+    case PROP_SCREEN_FORMAT:
+      if (drmsink->screen_format_str != NULL)
+        g_free (drmsink->screen_format_str);
+      drmsink->screen_format_str = g_value_dup_string (value);
+      break;
+    case PROP_ATOMIC:
+      drmsink->atomic_property = g_value_get_boolean (value);
+      break;
+    case PROP_BUFFER_CACHE:
+      drmsink->buffer_cache_max_property = g_value_get_int (value);
+      break;
     default:
       break;
     }
@@ -300,11 +386,31 @@ gst_drmsink_get_property (GObject * object, guint prop_id,
     case PROP_CONNECTOR:
       g_value_set_int (value, drmsink->preferred_connector_id);
       break;
+    case PROP_SCREEN_FORMAT:
+      g_value_set_string (value, drmsink->screen_format_str);
+      break;
+    case PROP_ATOMIC:
+      g_value_set_boolean (value, drmsink->atomic_property);
+      break;
+    case PROP_BUFFER_CACHE:
+      g_value_set_int (value, drmsink->buffer_cache_max_property);
+      break;
     default:
       break;
     }
 }
 
+static void
+gst_drmsink_finalize (GObject * object)
+{
+  GstDrmsink *drmsink = GST_DRMSINK (object);
+
+  g_free (drmsink->screen_format_str);
+  drmsink->screen_format_str = NULL;
+
+  G_OBJECT_CLASS (framebuffersink_parent_class)->finalize (object);
+}
+
 static gboolean
 gst_drmsink_find_mode_and_plane (GstDrmsink *drmsink, GstVideoRectangle *dim)
 {
@@ -412,6 +518,315 @@ error_no_plane:
   goto fail;
 }
 
+/* Look up the DRM format code for a screen format; returns 0 if the format
+   cannot be used for scanout. */
+static uint32_t
+gst_drmsink_get_drm_format (GstVideoFormat format)
+{
+  int i;
+  for (i = 0; gst_drmsink_screen_formats[i].format != GST_VIDEO_FORMAT_UNKNOWN;
+      i++)
+    if (gst_drmsink_screen_formats[i].format == format)
+      return gst_drmsink_screen_formats[i].drm_format;
+  return 0;
+}
+
+/* Return the index of the selected CRTC in the resources, or -1. */
+static int
+gst_drmsink_get_crtc_index (GstDrmsink *drmsink)
+{
+  int i;
+  for (i = 0; i < drmsink->resources->count_crtcs; i++)
+    if (drmsink->crtc_id == drmsink->resources->crtcs[i])
+      return i;
+  return -1;
+}
+
+/* Check whether a plane that can be used with the selected CRTC (normally the
+   primary plane) supports the given DRM format. When the kernel does not
+   expose planes the format can't be validated here and TRUE is returned;
+   framebuffer creation will fail later if it is not supported. */
+static gboolean
+gst_drmsink_plane_supports_format (GstDrmsink *drmsink, uint32_t drm_format)
+{
+  drmModePlaneRes *plane_resources;
+  drmModePlane *plane;
+  gboolean found_plane;
+  gboolean supported;
+  int i, j, pipe;
+
+  pipe = gst_drmsink_get_crtc_index (drmsink);
+  if (pipe == -1)
+    return TRUE;
+
+  /* Make the primary plane visible in the plane list. */
+  drmSetClientCap (drmsink->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+  plane_resources = drmModeGetPlaneResources (drmsink->fd);
+  if (plane_resources == NULL)
+    return TRUE;
+
+  found_plane = FALSE;
+  supported = FALSE;
+  for (i = 0; i < plane_resources->count_planes && !supported; i++) {
+    plane = drmModeGetPlane (drmsink->fd, plane_resources->planes[i]);
+    if (plane == NULL)
+      continue;
+    if (plane->possible_crtcs & (1 << pipe)) {
+      found_plane = TRUE;
+      for (j = 0; j < plane->count_formats; j++)
+        if (plane->formats[j] == drm_format) {
+          supported = TRUE;
+          break;
+        }
+    }
+    drmModeFreePlane (plane);
+  }
+  drmModeFreePlaneResources (plane_resources);
+  /* The atomic client capability implies universal planes. */
+  if (!drmsink->atomic)
+    drmSetClientCap (drmsink->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
+
+  return supported || !found_plane;
+}
+
+/* Atomic modesetting. The primary plane, the CRTC and the connector are
+   updated together with one commit per frame. Frames are shown with
+   nonblocking commits that return an out-fence, which signals when the new
+   buffer is being scanned out and the previous one has been released; the
+   next commit waits for it instead of polling for page flip events. */
+
+static const char *gst_drmsink_plane_prop_names[GST_DRMSINK_PLANE_PROP_COUNT] =
+{
+  "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+  "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H"
+};
+
+/* Look up a property of a DRM object by name. Returns the property id, or 0
+   when the object doesn't have the property; the current value is returned
+   in value when it is not NULL. */
+static uint32_t
+gst_drmsink_get_object_property (GstDrmsink *drmsink, uint32_t object_id,
+    uint32_t object_type, const char *name, uint64_t *value)
+{
+  drmModeObjectPropertiesPtr props;
+  drmModePropertyPtr prop;
+  uint32_t prop_id = 0;
+  unsigned int i;
+
+  props = drmModeObjectGetProperties (drmsink->fd, object_id, object_type);
+  if (props == NULL)
+    return 0;
+  for (i = 0; i < props->count_props && prop_id == 0; i++) {
+    prop = drmModeGetProperty (drmsink->fd, props->props[i]);
+    if (prop == NULL)
+      continue;
+    if (strcmp (prop->name, name) == 0) {
+      prop_id = prop->prop_id;
+      if (value != NULL)
+        *value = props->prop_values[i];
+    }
+    drmModeFreeProperty (prop);
+  }
+  drmModeFreeObjectProperties (props);
+  return prop_id;
+}
+
+/* Enable the atomic API and look up the primary plane of the CRTC and the
+   property ids used in commits. Returns FALSE, with the atomic API disabled
+   again, when the driver lacks any of it. */
+static gboolean
+gst_drmsink_init_atomic (GstDrmsink *drmsink)
+{
+  drmModePlaneRes *plane_resources;
+  drmModePlane *plane;
+  uint64_t type;
+  int i, pipe;
+
+  if (drmSetClientCap (drmsink->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)
+    return FALSE;
+
+  pipe = gst_drmsink_get_crtc_index (drmsink);
+  if (pipe == -1)
+    goto fail;
+  plane_resources = drmModeGetPlaneResources (drmsink->fd);
+  if (plane_resources == NULL)
+    goto fail;
+  drmsink->primary_plane_id = 0;
+  for (i = 0; i < plane_resources->count_planes &&
+      drmsink->primary_plane_id == 0; i++) {
+    plane = drmModeGetPlane (drmsink->fd, plane_resources->planes[i]);
+    if (plane == NULL)
+      continue;
+    if ((plane->possible_crtcs & (1 << pipe)) &&
+        gst_drmsink_get_object_property (drmsink, plane->plane_id,
+        DRM_MODE_OBJECT_PLANE, "type", &type) != 0 &&
+        type == DRM_PLANE_TYPE_PRIMARY)
+      drmsink->primary_plane_id = plane->plane_id;
+    drmModeFreePlane (plane);
+  }
+  drmModeFreePlaneResources (plane_resources);
+  if (drmsink->primary_plane_id == 0)
+    goto fail;
+
+  for (i = 0; i < GST_DRMSINK_PLANE_PROP_COUNT; i++) {
+    drmsink->plane_prop_id[i] = gst_drmsink_get_object_property (drmsink,
+        drmsink->primary_plane_id, DRM_MODE_OBJECT_PLANE,
+        gst_drmsink_plane_prop_names[i], NULL);
+    if (drmsink->plane_prop_id[i] == 0)
+      goto fail;
+  }
+  drmsink->connector_crtc_id_prop_id = gst_drmsink_get_object_property (
+      drmsink, drmsink->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+      NULL);
+  drmsink->crtc_mode_id_prop_id = gst_drmsink_get_object_property (drmsink,
+      drmsink->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+  drmsink->crtc_active_prop_id = gst_drmsink_get_object_property (drmsink,
+      drmsink->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+  drmsink->crtc_out_fence_ptr_prop_id = gst_drmsink_get_object_property (
+      drmsink, drmsink->crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR", NULL);
+  if (drmsink->connector_crtc_id_prop_id == 0 ||
+      drmsink->crtc_mode_id_prop_id == 0 || drmsink->crtc_active_prop_id == 0 ||
+      drmsink->crtc_out_fence_ptr_prop_id == 0)
+    goto fail;
+
+  if (drmModeCreatePropertyBlob (drmsink->fd, &drmsink->mode,
+      sizeof (drmsink->mode), &drmsink->mode_blob_id) != 0)
+    goto fail;
+
+  drmsink->out_fence_fd = -1;
+  drmsink->n_pending_crtc_props = 0;
+  drmsink->atomic = TRUE;
+  GST_INFO_OBJECT (drmsink, "Using atomic modesetting, primary plane %u",
+      drmsink->primary_plane_id);
+  return TRUE;
+
+fail:
+  GST_INFO_OBJECT (drmsink, "Atomic modesetting not usable");
+  drmSetClientCap (drmsink->fd, DRM_CLIENT_CAP_ATOMIC, 0);
+  return FALSE;
+}
+
+/* Release the CRTC blob properties queued for the next commit. */
+static void
+gst_drmsink_release_pending_crtc_props (GstDrmsink *drmsink)
+{
+  int i;
+  for (i = 0; i < drmsink->n_pending_crtc_props; i++)
+    if (drmsink->pending_crtc_blob_id[i] != 0)
+      drmModeDestroyPropertyBlob (drmsink->fd,
+          drmsink->pending_crtc_blob_id[i]);
+  drmsink->n_pending_crtc_props = 0;
+}
+
+static void
+gst_drmsink_fini_atomic (GstDrmsink *drmsink)
+{
+  if (!drmsink->atomic)
+    return;
+  if (drmsink->out_fence_fd >= 0) {
+    close (drmsink->out_fence_fd);
+    drmsink->out_fence_fd = -1;
+  }
+  gst_drmsink_release_pending_crtc_props (drmsink);
+  if (drmsink->mode_blob_id != 0) {
+    drmModeDestroyPropertyBlob (drmsink->fd, drmsink->mode_blob_id);
+    drmsink->mode_blob_id = 0;
+  }
+  drmSetClientCap (drmsink->fd, DRM_CLIENT_CAP_ATOMIC, 0);
+  drmsink->atomic = FALSE;
+}
+
+/* Add the state that shows framebuffer fb full-screen on the primary plane
+   to an atomic request; with modeset, the mode and the connector routing are
+   added as well. */
+static void
+gst_drmsink_atomic_add_state (GstDrmsink *drmsink, drmModeAtomicReqPtr req,
+    uint32_t fb, gboolean modeset)
+{
+  uint32_t plane_id = drmsink->primary_plane_id;
+  const uint32_t *prop_id = drmsink->plane_prop_id;
+  uint64_t w = drmsink->screen_rect.w;
+  uint64_t h = drmsink->screen_rect.h;
+
+  if (modeset) {
+    drmModeAtomicAddProperty (req, drmsink->connector_id,
+        drmsink->connector_crtc_id_prop_id, drmsink->crtc_id);
+    drmModeAtomicAddProperty (req, drmsink->crtc_id,
+        drmsink->crtc_mode_id_prop_id, drmsink->mode_blob_id);
+    drmModeAtomicAddProperty (req, drmsink->crtc_id,
+        drmsink->crtc_active_prop_id, 1);
+  }
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_FB_ID], fb);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_CRTC_ID], drmsink->crtc_id);
+  /* Source coordinates are 16.16 fixed point. */
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_SRC_X], 0);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_SRC_Y], 0);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_SRC_W], w << 16);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_SRC_H], h << 16);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_CRTC_X], 0);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_CRTC_Y], 0);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_CRTC_W], w);
+  drmModeAtomicAddProperty (req, plane_id,
+      prop_id[GST_DRMSINK_PLANE_PROP_CRTC_H], h);
+}
+
+/* Check with a TEST_ONLY commit that the primary plane can scan out a
+   framebuffer with the given format in the selected mode. A temporary dumb
+   buffer is used, nothing is changed on the screen. */
+static gboolean
+gst_drmsink_atomic_test_format (GstDrmsink *drmsink, GstVideoFormat format,
+    uint32_t drm_format)
+{
+  struct drm_mode_create_dumb creq;
+  struct drm_mode_destroy_dumb dreq;
+  uint32_t handles[4], pitches[4], offsets[4];
+  uint32_t fb;
+  drmModeAtomicReqPtr req;
+  int res;
+
+  memset (&creq, 0, sizeof (creq));
+  creq.width = drmsink->screen_rect.w;
+  creq.height = drmsink->screen_rect.h;
+  creq.bpp = GST_VIDEO_FORMAT_INFO_PSTRIDE (gst_video_format_get_info (format),
+      0) * 8;
+  if (drmIoctl (drmsink->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+    return FALSE;
+
+  memset (handles, 0, sizeof (handles));
+  memset (pitches, 0, sizeof (pitches));
+  memset (offsets, 0, sizeof (offsets));
+  handles[0] = creq.handle;
+  pitches[0] = creq.pitch;
+  res = drmModeAddFB2 (drmsink->fd, creq.width, creq.height, drm_format,
+      handles, pitches, offsets, &fb, 0);
+  if (res == 0) {
+    req = drmModeAtomicAlloc ();
+    res = -1;
+    if (req != NULL) {
+      gst_drmsink_atomic_add_state (drmsink, req, fb, TRUE);
+      res = drmModeAtomicCommit (drmsink->fd, req,
+          DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+      drmModeAtomicFree (req);
+    }
+    drmModeRmFB (drmsink->fd, fb);
+  }
+
+  dreq.handle = creq.handle;
+  drmIoctl (drmsink->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+  GST_DEBUG_OBJECT (drmsink, "Test commit with format %s: %s",
+      gst_video_format_to_string (format), res == 0 ? "ok" : "failed");
+  return res == 0;
+}
+
 static void
 gst_drmsink_reset (GstDrmsink *drmsink)
 {
@@ -442,6 +857,11 @@ gst_drmsink_reset (GstDrmsink *drmsink)
 //  drmsink->par_n = drmsink->par_d = 1;
 
   memset (&drmsink->screen_rect, 0, sizeof (GstVideoRectangle));
+  drmsink->color_properties_probed = FALSE;
+  drmsink->ctm_prop_id = 0;
+  drmsink->gamma_lut_prop_id = 0;
+  drmsink->gamma_lut_size = 0;
+  drmsink->color_management_active = FALSE;
 //  memset (&drmsink->info, 0, sizeof (GstVideoInfo));
 
   drmsink->connector_id = -1;
@@ -562,6 +982,8 @@ gst_drmsink_open_hardware (GstFramebufferSink *framebuffersink,
 #endif
 
   gst_drmsink_find_mode_and_plane (drmsink, &drmsink->screen_rect);
+  if (drmsink->mode.vrefresh > 0)
+    framebuffersink->refresh_period = GST_SECOND / drmsink->mode.vrefresh;
 
   drmsink->crtc_mode_initialized = FALSE;
   drmsink->saved_crtc = drmModeGetCrtc (drmsink->fd, drmsink->crtc_id);
@@ -573,6 +995,13 @@ gst_drmsink_open_hardware (GstFramebufferSink *framebuffersink,
   drmsink->page_flip_occurred = FALSE;
   drmsink->page_flip_pending = FALSE;
 
+  drmsink->stats_buffers_allocated = 0;
+  drmsink->stats_buffers_reused = 0;
+
+  drmsink->atomic = FALSE;
+  if (drmsink->atomic_property)
+    gst_drmsink_init_atomic (drmsink);
+
 #if 0
   drmModeFreeResources(resources);
 
@@ -585,7 +1014,55 @@ gst_drmsink_open_hardware (GstFramebufferSink *framebuffersink,
   }
 #endif
 
-  gst_video_info_set_format (info, GST_VIDEO_FORMAT_BGRx,
+  /* Select the screen format. */
+  drmsink->screen_format = GST_VIDEO_FORMAT_UNKNOWN;
+  if (drmsink->screen_format_str != NULL)
+    drmsink->screen_format = gst_video_format_from_string (
+        drmsink->screen_format_str);
+  drmsink->screen_drm_format = gst_drmsink_get_drm_format (
+      drmsink->screen_format);
+  if (drmsink->screen_drm_format == 0) {
+    s = g_strdup_printf ("Unsupported screen format %s, using "
+        DEFAULT_SCREEN_FORMAT, drmsink->screen_format_str);
+    GST_DRMSINK_MESSAGE_OBJECT (drmsink, s);
+    g_free (s);
+  }
+  else if (!gst_drmsink_plane_supports_format (drmsink,
+      drmsink->screen_drm_format)) {
+    s = g_strdup_printf ("Screen format %s not supported by the display "
+        "plane, using " DEFAULT_SCREEN_FORMAT, drmsink->screen_format_str);
+    GST_DRMSINK_MESSAGE_OBJECT (drmsink, s);
+    g_free (s);
+    drmsink->screen_drm_format = 0;
+  }
+  if (drmsink->screen_drm_format == 0) {
+    drmsink->screen_format = GST_VIDEO_FORMAT_BGRx;
+    drmsink->screen_drm_format = DRM_FORMAT_XRGB8888;
+  }
+
+  /* Let the driver validate the plane configuration before it is used. */
+  if (drmsink->atomic && !gst_drmsink_atomic_test_format (drmsink,
+      drmsink->screen_format, drmsink->screen_drm_format)) {
+    gboolean ok = FALSE;
+    if (drmsink->screen_format != GST_VIDEO_FORMAT_BGRx) {
+      s = g_strdup_printf ("Screen format %s rejected by the test commit, "
+          "using " DEFAULT_SCREEN_FORMAT,
+          gst_video_format_to_string (drmsink->screen_format));
+      GST_DRMSINK_MESSAGE_OBJECT (drmsink, s);
+      g_free (s);
+      drmsink->screen_format = GST_VIDEO_FORMAT_BGRx;
+      drmsink->screen_drm_format = DRM_FORMAT_XRGB8888;
+      ok = gst_drmsink_atomic_test_format (drmsink, drmsink->screen_format,
+          drmsink->screen_drm_format);
+    }
+    if (!ok) {
+      GST_DRMSINK_MESSAGE_OBJECT (drmsink,
+          "Atomic test commit failed, using legacy modesetting");
+      gst_drmsink_fini_atomic (drmsink);
+    }
+  }
+
+  gst_video_info_set_format (info, drmsink->screen_format,
       drmsink->screen_rect.w, drmsink->screen_rect.h);
   size = GST_VIDEO_INFO_COMP_STRIDE (info, 0) * GST_VIDEO_INFO_HEIGHT (info);
 
@@ -600,8 +1077,10 @@ gst_drmsink_open_hardware (GstFramebufferSink *framebuffersink,
   *pannable_video_memory_size = *video_memory_size;
 
   s = g_strdup_printf("Successfully initialized DRM, connector = %d, "
-      "mode = %dx%d",
-      drmsink->connector_id, drmsink->screen_rect.w, drmsink->screen_rect.h);
+      "mode = %dx%d, format = %s, %s modesetting",
+      drmsink->connector_id, drmsink->screen_rect.w, drmsink->screen_rect.h,
+      gst_video_format_to_string (drmsink->screen_format),
+      drmsink->atomic ? "atomic" : "legacy");
   GST_DRMSINK_MESSAGE_OBJECT (drmsink, s);
   g_free (s);
 
@@ -623,18 +1102,199 @@ plane_resources_failed:
   goto fail;
 }
 
+/* Color balance through the CRTC color management properties: saturation
+   and hue as the CTM color matrix, brightness and contrast as the
+   GAMMA_LUT. Either is only used when needed, and both are reset when the
+   device is closed. */
+
+static void
+gst_drmsink_probe_color_properties (GstDrmsink *drmsink)
+{
+  drmModeObjectPropertiesPtr props;
+  drmModePropertyPtr prop;
+  unsigned int i;
+
+  drmsink->color_properties_probed = TRUE;
+  props = drmModeObjectGetProperties (drmsink->fd, drmsink->crtc_id,
+      DRM_MODE_OBJECT_CRTC);
+  if (props == NULL)
+    return;
+  for (i = 0; i < props->count_props; i++) {
+    prop = drmModeGetProperty (drmsink->fd, props->props[i]);
+    if (prop == NULL)
+      continue;
+    if (strcmp (prop->name, "CTM") == 0)
+      drmsink->ctm_prop_id = prop->prop_id;
+    else if (strcmp (prop->name, "GAMMA_LUT") == 0)
+      drmsink->gamma_lut_prop_id = prop->prop_id;
+    else if (strcmp (prop->name, "GAMMA_LUT_SIZE") == 0)
+      drmsink->gamma_lut_size = props->prop_values[i];
+    drmModeFreeProperty (prop);
+  }
+  drmModeFreeObjectProperties (props);
+  if (drmsink->gamma_lut_size < 2)
+    drmsink->gamma_lut_prop_id = 0;
+  GST_INFO_OBJECT (drmsink, "CRTC color management: CTM %s, GAMMA_LUT %s "
+      "(%d entries)", drmsink->ctm_prop_id != 0 ? "yes" : "no",
+      drmsink->gamma_lut_prop_id != 0 ? "yes" : "no",
+      drmsink->gamma_lut_size);
+}
+
+/* Set a CRTC blob property; a NULL data pointer resets it. With deferred
+   set (atomic modesetting only), the property is added to the next commit so
+   that it changes in the same vblank as the frame that follows. */
+
+static gboolean
+gst_drmsink_set_crtc_blob (GstDrmsink *drmsink, uint32_t prop_id,
+    const void *data, size_t size, gboolean deferred)
+{
+  uint32_t blob_id = 0;
+  int i, res;
+
+  if (data != NULL &&
+      drmModeCreatePropertyBlob (drmsink->fd, data, size, &blob_id) != 0)
+    return FALSE;
+  if (deferred && drmsink->atomic) {
+    for (i = 0; i < drmsink->n_pending_crtc_props; i++)
+      if (drmsink->pending_crtc_prop_id[i] == prop_id)
+        break;
+    if (i == G_N_ELEMENTS (drmsink->pending_crtc_prop_id)) {
+      if (blob_id != 0)
+        drmModeDestroyPropertyBlob (drmsink->fd, blob_id);
+      return FALSE;
+    }
+    if (i < drmsink->n_pending_crtc_props) {
+      if (drmsink->pending_crtc_blob_id[i] != 0)
+        drmModeDestroyPropertyBlob (drmsink->fd,
+            drmsink->pending_crtc_blob_id[i]);
+    }
+    else
+      drmsink->n_pending_crtc_props++;
+    drmsink->pending_crtc_prop_id[i] = prop_id;
+    drmsink->pending_crtc_blob_id[i] = blob_id;
+    return TRUE;
+  }
+  res = drmModeObjectSetProperty (drmsink->fd, drmsink->crtc_id,
+      DRM_MODE_OBJECT_CRTC, prop_id, blob_id);
+  /* The CRTC state holds its own reference to the blob. */
+  if (blob_id != 0)
+    drmModeDestroyPropertyBlob (drmsink->fd, blob_id);
+  return res == 0;
+}
+
+static gboolean
+gst_drmsink_set_color_balance (GstFramebufferSink *framebuffersink,
+    const gint *value)
+{
+  GstDrmsink *drmsink = GST_DRMSINK (framebuffersink);
+  struct drm_color_ctm ctm;
+  struct drm_color_lut *lut;
+  double matrix[3][3];
+  gboolean need_ctm, need_gamma_lut;
+  gboolean res;
+  int i;
+
+  if (!drmsink->color_properties_probed)
+    gst_drmsink_probe_color_properties (drmsink);
+
+  need_ctm = value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_SATURATION] != 0 ||
+      value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_HUE] != 0;
+  need_gamma_lut = value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_BRIGHTNESS] != 0 ||
+      value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_CONTRAST] != 0;
+  if ((need_ctm && drmsink->ctm_prop_id == 0) ||
+      (need_gamma_lut && drmsink->gamma_lut_prop_id == 0))
+    return FALSE;
+  /* Nothing to undo when the properties were never set. */
+  if (!need_ctm && !need_gamma_lut && !drmsink->color_management_active)
+    return TRUE;
+
+  if (drmsink->ctm_prop_id != 0) {
+    if (need_ctm) {
+      gst_framebuffersink_get_color_balance_matrix (value, matrix);
+      /* S31.32 sign-magnitude fixed point. */
+      for (i = 0; i < 9; i++) {
+        double x = matrix[i / 3][i % 3];
+        ctm.matrix[i] = (uint64_t) llrint (fabs (x) * 4294967296.0) |
+            (x < 0 ? (1ULL << 63) : 0);
+      }
+    }
+    if (!gst_drmsink_set_crtc_blob (drmsink, drmsink->ctm_prop_id,
+        need_ctm ? &ctm : NULL, sizeof (ctm), TRUE))
+      return FALSE;
+  }
+
+  if (drmsink->gamma_lut_prop_id != 0) {
+    lut = NULL;
+    if (need_gamma_lut) {
+      lut = g_new0 (struct drm_color_lut, drmsink->gamma_lut_size);
+      for (i = 0; i < drmsink->gamma_lut_size; i++) {
+        lut[i].red = (uint16_t) lrint (
+            gst_framebuffersink_get_color_balance_level (value,
+            (double) i / (drmsink->gamma_lut_size - 1)) * 65535.0);
+        lut[i].green = lut[i].red;
+        lut[i].blue = lut[i].red;
+      }
+    }
+    res = gst_drmsink_set_crtc_blob (drmsink, drmsink->gamma_lut_prop_id, lut,
+        sizeof (struct drm_color_lut) * drmsink->gamma_lut_size, TRUE);
+    g_free (lut);
+    if (!res) {
+      /* Software applies all channels when this fails, so take the hue
+         and saturation back out of the CTM. */
+      if (need_ctm)
+        gst_drmsink_set_crtc_blob (drmsink, drmsink->ctm_prop_id, NULL, 0,
+            TRUE);
+      drmsink->color_management_active = TRUE;
+      return FALSE;
+    }
+  }
+
+  drmsink->color_management_active = need_ctm || need_gamma_lut;
+  return TRUE;
+}
+
+static void
+gst_drmsink_reset_color_balance (GstDrmsink *drmsink)
+{
+  if (!drmsink->color_management_active)
+    return;
+  if (drmsink->ctm_prop_id != 0)
+    gst_drmsink_set_crtc_blob (drmsink, drmsink->ctm_prop_id, NULL, 0, FALSE);
+  if (drmsink->gamma_lut_prop_id != 0)
+    gst_drmsink_set_crtc_blob (drmsink, drmsink->gamma_lut_prop_id, NULL, 0,
+        FALSE);
+  drmsink->color_management_active = FALSE;
+}
+
 static void
 gst_drmsink_close_hardware (GstFramebufferSink *framebuffersink) {
   GstDrmsink *drmsink = GST_DRMSINK (framebuffersink);
 
-  gst_drmsink_flush_drm_events (drmsink);
-  gst_drmsink_wait_pending_drm_events (drmsink);
+  if (drmsink->atomic)
+    gst_drmsink_wait_out_fence (drmsink,
+        gst_framebuffersink_get_presentation_timeout (framebuffersink));
+  else {
+    gst_drmsink_flush_drm_events (drmsink);
+    gst_drmsink_wait_pending_drm_events (drmsink);
+  }
 
+  gst_drmsink_reset_color_balance (drmsink);
   drmModeSetCrtc (drmsink->fd, drmsink->saved_crtc->crtc_id,
       drmsink->saved_crtc->buffer_id, drmsink->saved_crtc->x,
       drmsink->saved_crtc->y, &drmsink->connector_id, 1,
       &drmsink->saved_crtc->mode);
   drmModeFreeCrtc (drmsink->saved_crtc);
+  gst_drmsink_fini_atomic (drmsink);
+
+  gst_drmsink_set_scanout (drmsink, 0, 0);
+  gst_drmsink_flush_buffer_cache (drmsink);
+  if (drmsink->stats_buffers_reused > 0) {
+    gchar *s = g_strdup_printf ("%d of %d video memory buffers reused from "
+        "the buffer cache", drmsink->stats_buffers_reused,
+        drmsink->stats_buffers_allocated);
+    GST_DRMSINK_MESSAGE_OBJECT (drmsink, s);
+    g_free (s);
+  }
 
   gst_drmsink_reset (drmsink);
 
@@ -685,6 +1345,8 @@ typedef struct
   int w;
   int h;
   GstVideoFormatInfo format_info;
+  /* DRM format code used when creating framebuffers. */
+  uint32_t drm_format;
   /* The amount of video memory allocated. */
   gsize total_allocated;
 } GstDrmSinkVideoMemoryAllocator;
@@ -708,6 +1370,163 @@ typedef struct
   gboolean allocated;
 } GstDrmSinkVideoMemory;
 
+/* Buffer cache entry; the dumb buffer, its framebuffer object and its
+   mapping are kept as they were when the memory was freed. */
+typedef struct
+{
+  int w;
+  int h;
+  uint32_t drm_format;
+  struct drm_mode_create_dumb creq;
+  struct drm_mode_map_dumb mreq;
+  uint32_t fb;
+  gpointer map_address;
+} GstDrmSinkCachedBuffer;
+
+static void
+gst_drmsink_destroy_buffer (GstDrmsink *drmsink,
+    struct drm_mode_create_dumb *creq, uint32_t fb, gpointer map_address)
+{
+  struct drm_mode_destroy_dumb dreq;
+
+  munmap (map_address, creq->size);
+  drmModeRmFB (drmsink->fd, fb);
+  dreq.handle = creq->handle;
+  drmIoctl (drmsink->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+}
+
+/* Take a cached buffer matching the allocator's size and format and fill in
+   mem with it. Returns FALSE on a cache miss. */
+static gboolean
+gst_drmsink_buffer_cache_take (GstDrmsink *drmsink, int w, int h,
+    uint32_t drm_format, GstDrmSinkVideoMemory *mem)
+{
+  GstDrmSinkCachedBuffer *buffer = NULL;
+  GList *l;
+
+  GST_OBJECT_LOCK (drmsink);
+  drmsink->stats_buffers_allocated++;
+  for (l = drmsink->buffer_cache; l != NULL; l = l->next) {
+    buffer = l->data;
+    if (buffer->w == w && buffer->h == h && buffer->drm_format == drm_format)
+      break;
+  }
+  if (l != NULL) {
+    drmsink->buffer_cache = g_list_delete_link (drmsink->buffer_cache, l);
+    drmsink->buffer_cache_size -= buffer->creq.size;
+    drmsink->stats_buffers_reused++;
+  }
+  GST_OBJECT_UNLOCK (drmsink);
+  if (l == NULL)
+    return FALSE;
+
+  mem->creq = buffer->creq;
+  mem->mreq = buffer->mreq;
+  mem->fb = buffer->fb;
+  mem->map_address = buffer->map_address;
+  g_slice_free (GstDrmSinkCachedBuffer, buffer);
+  return TRUE;
+}
+
+/* Put the buffer of freed memory in the cache, evicting the least recently
+   freed buffers when the size limit is exceeded. Returns FALSE when the
+   buffer can't be cached and must be destroyed. */
+static gboolean
+gst_drmsink_buffer_cache_put (GstDrmsink *drmsink,
+    GstDrmSinkCachedBuffer *buffer)
+{
+  GList *evicted = NULL;
+  GList *l;
+  gsize max_size;
+
+  max_size = (gsize) drmsink->buffer_cache_max_property * 1024 * 1024;
+  if (drmsink->fd < 0 || buffer->creq.size > max_size)
+    return FALSE;
+
+  GST_OBJECT_LOCK (drmsink);
+  drmsink->buffer_cache = g_list_prepend (drmsink->buffer_cache, buffer);
+  drmsink->buffer_cache_size += buffer->creq.size;
+  while (drmsink->buffer_cache_size > max_size) {
+    l = g_list_last (drmsink->buffer_cache);
+    drmsink->buffer_cache = g_list_remove_link (drmsink->buffer_cache, l);
+    drmsink->buffer_cache_size -=
+        ((GstDrmSinkCachedBuffer *) l->data)->creq.size;
+    evicted = g_list_concat (evicted, l);
+  }
+  GST_OBJECT_UNLOCK (drmsink);
+
+  for (l = evicted; l != NULL; l = l->next) {
+    buffer = l->data;
+    gst_drmsink_destroy_buffer (drmsink, &buffer->creq, buffer->fb,
+        buffer->map_address);
+    g_slice_free (GstDrmSinkCachedBuffer, buffer);
+  }
+  g_list_free (evicted);
+  return TRUE;
+}
+
+/* Cache the buffer of freed memory, or destroy it. */
+static void
+gst_drmsink_release_buffer (GstDrmsink *drmsink,
+    GstDrmSinkCachedBuffer *buffer)
+{
+  if (gst_drmsink_buffer_cache_put (drmsink, buffer))
+    return;
+  gst_drmsink_destroy_buffer (drmsink, &buffer->creq, buffer->fb,
+      buffer->map_address);
+  g_slice_free (GstDrmSinkCachedBuffer, buffer);
+}
+
+/* Record the framebuffer objects being scanned out and being flipped to,
+   and release the retired buffers that are neither any more. */
+static void
+gst_drmsink_set_scanout (GstDrmsink *drmsink, uint32_t scanout_fb,
+    uint32_t page_flip_fb)
+{
+  GstDrmSinkCachedBuffer *buffer;
+  GList *released = NULL;
+  GList *l, *next;
+
+  GST_OBJECT_LOCK (drmsink);
+  drmsink->scanout_fb = scanout_fb;
+  drmsink->page_flip_fb = page_flip_fb;
+  for (l = drmsink->retired_buffers; l != NULL; l = next) {
+    buffer = l->data;
+    next = l->next;
+    if (buffer->fb == scanout_fb || buffer->fb == page_flip_fb)
+      continue;
+    drmsink->retired_buffers = g_list_remove_link (drmsink->retired_buffers,
+        l);
+    released = g_list_concat (released, l);
+  }
+  GST_OBJECT_UNLOCK (drmsink);
+
+  for (l = released; l != NULL; l = l->next)
+    gst_drmsink_release_buffer (drmsink, l->data);
+  g_list_free (released);
+}
+
+static void
+gst_drmsink_flush_buffer_cache (GstDrmsink *drmsink)
+{
+  GstDrmSinkCachedBuffer *buffer;
+  GList *cache, *l;
+
+  GST_OBJECT_LOCK (drmsink);
+  cache = drmsink->buffer_cache;
+  drmsink->buffer_cache = NULL;
+  drmsink->buffer_cache_size = 0;
+  GST_OBJECT_UNLOCK (drmsink);
+
+  for (l = cache; l != NULL; l = l->next) {
+    buffer = l->data;
+    gst_drmsink_destroy_buffer (drmsink, &buffer->creq, buffer->fb,
+        buffer->map_address);
+    g_slice_free (GstDrmSinkCachedBuffer, buffer);
+  }
+  g_list_free (cache);
+}
+
 #ifdef LAZY_ALLOCATION
 /* With lazy allocation, don't allocate video memory immediately, but wait
    until the first memory_map call. */
@@ -742,11 +1561,10 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
   GstDrmSinkVideoMemoryAllocator *drmsink_video_memory_allocator =
       (GstDrmSinkVideoMemoryAllocator *)allocator;
   struct drm_mode_destroy_dumb dreq;
+  uint32_t handles[4], pitches[4], offsets[4];
   int ret;
   /* Ignore params (which should be NULL) and use word alignment. */
   int align = 3;
-  int i;
-  int depth;
 
   GST_OBJECT_LOCK (allocator);
 
@@ -754,6 +1572,14 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
   mem = g_slice_new (GstDrmSinkVideoMemory);
 #endif
 
+  if (gst_drmsink_buffer_cache_take (drmsink_video_memory_allocator->drmsink,
+      drmsink_video_memory_allocator->w, drmsink_video_memory_allocator->h,
+      drmsink_video_memory_allocator->drm_format, mem)) {
+    GST_DEBUG_OBJECT (drmsink_video_memory_allocator->drmsink,
+        "Reusing cached video memory buffer at %p", mem->map_address);
+    goto mapped;
+  }
+
   mem->creq.height = drmsink_video_memory_allocator->h;
   mem->creq.width = drmsink_video_memory_allocator->w;
   mem->creq.bpp = GST_VIDEO_FORMAT_INFO_PSTRIDE (
@@ -773,18 +1599,16 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
     return NULL;
   }
 
-  depth = 0;
-  for (i = 0; i < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (
-      &drmsink_video_memory_allocator->format_info); i++)
-    depth += GST_VIDEO_FORMAT_INFO_DEPTH (
-        &drmsink_video_memory_allocator->format_info, i);
-
   /* create framebuffer object for the dumb-buffer */
-  ret = drmModeAddFB (drmsink_video_memory_allocator->drmsink->fd,
+  memset (handles, 0, sizeof (handles));
+  memset (pitches, 0, sizeof (pitches));
+  memset (offsets, 0, sizeof (offsets));
+  handles[0] = mem->creq.handle;
+  pitches[0] = mem->creq.pitch;
+  ret = drmModeAddFB2 (drmsink_video_memory_allocator->drmsink->fd,
       drmsink_video_memory_allocator->w, drmsink_video_memory_allocator->h,
-      depth, GST_VIDEO_FORMAT_INFO_PSTRIDE (
-      &drmsink_video_memory_allocator->format_info, 0) * 8,
-      mem->creq.pitch, mem->creq.handle, &mem->fb);
+      drmsink_video_memory_allocator->drm_format, handles, pitches, offsets,
+      &mem->fb, 0);
   if (ret) {
     /* frame buffer creation failed; see "errno" */
     GST_DRMSINK_MESSAGE_OBJECT (drmsink_video_memory_allocator->drmsink,
@@ -802,7 +1626,7 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
   if (ret) {
     GST_DRMSINK_MESSAGE_OBJECT (drmsink_video_memory_allocator->drmsink,
         "DRM buffer preparation failed.\n");
-    drmModeRmFB (drmsink_video_memory_allocator->drmsink->fd, mem->creq.handle);
+    drmModeRmFB (drmsink_video_memory_allocator->drmsink->fd, mem->fb);
     goto fail_destroy;
   }
 
@@ -816,10 +1640,11 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
     /* memory-mapping failed; see "errno" */
     GST_DRMSINK_MESSAGE_OBJECT (drmsink_video_memory_allocator->drmsink,
         "Memory mapping of DRM buffer failed.\n");
-    drmModeRmFB (drmsink_video_memory_allocator->drmsink->fd, mem->creq.handle);
+    drmModeRmFB (drmsink_video_memory_allocator->drmsink->fd, mem->fb);
     goto fail_destroy;
   }
 
+mapped:
 #ifndef LAZY_ALLOCATION
   gst_memory_init (GST_MEMORY_CAST (mem), GST_MEMORY_FLAG_NO_SHARE |
       GST_MEMORY_FLAG_VIDEO_MEMORY,
@@ -832,6 +1657,8 @@ gst_drmsink_video_memory_allocator_alloc (GstAllocator *allocator, gsize size,
   GST_INFO_OBJECT (drmsink_video_memory_allocator->drmsink,
       "Allocated video memory buffer of size %zd at %p, align %d, mem = %p\n",
       size, mem->map_address, align, mem);
+  GST_FRAMEBUFFERSINK_TRACE (drmsink_video_memory_allocator->drmsink,
+      VIDEO_MEMORY_ALLOC, video_memory_alloc, mem, size);
 
   GST_OBJECT_UNLOCK (allocator);
   return (GstMemory *) mem;
@@ -854,10 +1681,12 @@ gst_drmsink_video_memory_allocator_free (GstAllocator * allocator,
 {
   GstDrmSinkVideoMemoryAllocator *drmsink_video_memory_allocator =
       (GstDrmSinkVideoMemoryAllocator *)allocator;
+  GstDrmsink *drmsink = drmsink_video_memory_allocator->drmsink;
   GstDrmSinkVideoMemory *vmem = (GstDrmSinkVideoMemory *) mem;
-  struct drm_mode_destroy_dumb dreq;
+  GstDrmSinkCachedBuffer *buffer;
+  gboolean retired;
 
-  GST_INFO_OBJECT (drmsink_video_memory_allocator->drmsink,
+  GST_INFO_OBJECT (drmsink,
       "video_memory_allocator_free called, address = %p\n", vmem->map_address);
 
 #ifdef LAZY_ALLOCATION
@@ -868,11 +1697,32 @@ gst_drmsink_video_memory_allocator_free (GstAllocator * allocator,
 #endif
 
   drmsink_video_memory_allocator->total_allocated -= mem->size;
-
-  munmap (vmem->map_address, vmem->creq.size);
-  dreq.handle = vmem->creq.handle;
-  drmIoctl (drmsink_video_memory_allocator->drmsink->fd,
-      DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+  GST_FRAMEBUFFERSINK_TRACE (drmsink, VIDEO_MEMORY_FREE, video_memory_free,
+      mem, mem->size);
+
+  buffer = g_slice_new (GstDrmSinkCachedBuffer);
+  buffer->w = drmsink_video_memory_allocator->w;
+  buffer->h = drmsink_video_memory_allocator->h;
+  buffer->drm_format = drmsink_video_memory_allocator->drm_format;
+  buffer->creq = vmem->creq;
+  buffer->mreq = vmem->mreq;
+  buffer->fb = vmem->fb;
+  buffer->map_address = vmem->map_address;
+
+  /* Neither reuse nor remove the framebuffer object on display or being
+     flipped to, which would blank the CRTC, until the next flip has
+     completed. */
+  GST_OBJECT_LOCK (drmsink);
+  if (drmsink->page_flip_memory == mem)
+    drmsink->page_flip_memory = NULL;
+  retired = vmem->fb == drmsink->scanout_fb ||
+      vmem->fb == drmsink->page_flip_fb;
+  if (retired)
+    drmsink->retired_buffers = g_list_prepend (drmsink->retired_buffers,
+        buffer);
+  GST_OBJECT_UNLOCK (drmsink);
+  if (!retired)
+    gst_drmsink_release_buffer (drmsink, buffer);
 
   g_slice_free (GstDrmSinkVideoMemory, vmem);
 
@@ -944,6 +1794,7 @@ gst_drmsink_video_memory_allocator_new (GstFramebufferSink *framebuffersink,
   drmsink_video_memory_allocator->h = GST_VIDEO_INFO_HEIGHT (info);
   drmsink_video_memory_allocator->format_info =
       *(GstVideoFormatInfo *)info->finfo;
+  drmsink_video_memory_allocator->drm_format = drmsink->screen_drm_format;
   drmsink_video_memory_allocator->total_allocated = 0;
   g_sprintf (s, "drmsink_video_memory_%p", drmsink_video_memory_allocator);
   gst_allocator_register (s, gst_object_ref (drmsink_video_memory_allocator));
@@ -961,6 +1812,8 @@ static void
 gst_drmsink_vblank_handler (int fd, unsigned int sequence, unsigned int tv_sec,
     unsigned int tv_usec, void *user_data)
 {
+    GstDrmsink *drmsink = (GstDrmsink *)user_data;
+    drmsink->vblank_occurred = TRUE;
 }
 
 static void
@@ -971,6 +1824,10 @@ gst_drmsink_page_flip_handler (int fd,  unsigned int sequence,
     drmsink->page_flip_occurred = TRUE;
     if (drmsink->page_flip_pending)
      drmsink->page_flip_pending = FALSE;
+    if (drmsink->page_flip_fb != 0)
+      gst_drmsink_set_scanout (drmsink, drmsink->page_flip_fb, 0);
+    GST_FRAMEBUFFERSINK_TRACE (drmsink, FLIP_COMPLETE, flip_complete,
+        drmsink->page_flip_memory, 0);
 }
 
 /* Flush queued drm events. */
@@ -991,25 +1848,141 @@ static void gst_drmsink_flush_drm_events (GstDrmsink *drmsink) {
   }
 }
 
-/* Wait until all pending page flips have finished. */
+/* Wait until all pending page flips have finished, but no longer than the
+   presentation timeout. Returns early when the sink is unlocked. */
 
 static void gst_drmsink_wait_pending_drm_events (GstDrmsink *drmsink) {
-  fd_set fds;
-  struct timeval tv;
-  /* Set the timeout to zero. */
-  memset (&tv, 0, sizeof (tv));
-  FD_ZERO (&fds);
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (drmsink);
+  GstClockTime timeout;
+  int res;
+
+  timeout = gst_framebuffersink_get_presentation_timeout (framebuffersink);
   while (drmsink->page_flip_pending) {
-    FD_SET (drmsink->fd, &fds);
-    tv.tv_sec = 5;
-    select (drmsink->fd + 1, &fds, NULL, NULL, &tv);
-    if (FD_ISSET (drmsink->fd, &fds))
+    res = gst_framebuffersink_poll (framebuffersink, drmsink->fd, timeout);
+    if (res > 0)
       drmHandleEvent(drmsink->fd, drmsink->event_context);
-    else
+    else {
+      if (res == 0) {
+        GST_WARNING_OBJECT (drmsink, "Timed out waiting for page flip event");
+        drmsink->page_flip_pending = FALSE;
+      }
       break;
+    }
   }
 }
 
+/* Show a buffer without page flipping, used when page flip events are not
+   being delivered. The change is not synchronized to vblank. */
+
+static void
+gst_drmsink_set_crtc_buffer (GstDrmsink *drmsink, uint32_t fb)
+{
+  uint32_t connectors[1];
+
+  connectors[0] = drmsink->connector_id;
+  if (drmModeSetCrtc (drmsink->fd, drmsink->crtc_id, fb,
+      0, 0, connectors, 1, &drmsink->mode))
+    GST_ERROR_OBJECT (drmsink, "drmModeSetCrtc failed");
+  else
+    gst_drmsink_set_scanout (drmsink, fb, 0);
+}
+
+/* Wait until the out-fence of the last commit signals, but no longer than
+   timeout. Returns FALSE when the wait timed out or the sink was unlocked;
+   the fence is kept in the latter case. */
+
+static gboolean
+gst_drmsink_wait_out_fence (GstDrmsink *drmsink, GstClockTime timeout)
+{
+  int res;
+
+  if (drmsink->out_fence_fd < 0)
+    return TRUE;
+  res = gst_framebuffersink_poll (GST_FRAMEBUFFERSINK (drmsink),
+      drmsink->out_fence_fd, timeout);
+  if (res <= 0)
+    return FALSE;
+  close (drmsink->out_fence_fd);
+  drmsink->out_fence_fd = -1;
+  drmsink->page_flip_pending = FALSE;
+  if (drmsink->page_flip_fb != 0)
+    gst_drmsink_set_scanout (drmsink, drmsink->page_flip_fb, 0);
+  GST_FRAMEBUFFERSINK_TRACE (drmsink, FLIP_COMPLETE, flip_complete,
+      drmsink->page_flip_memory, 0);
+  return TRUE;
+}
+
+static void
+gst_drmsink_pan_display_atomic (GstDrmsink *drmsink, GstMemory *memory)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (drmsink);
+  GstDrmSinkVideoMemory *vmem = (GstDrmSinkVideoMemory *)memory;
+  drmModeAtomicReqPtr req;
+  uint32_t flags;
+  gboolean bypassed;
+  int i, res;
+
+  bypassed = gst_framebuffersink_hardware_sync_bypassed (framebuffersink);
+
+  /* Only one nonblocking commit can be outstanding. Waiting for the previous
+     one to complete also paces the frames to the refresh rate, like a
+     legacy page flip with pan-does-vsync. */
+  if (!gst_drmsink_wait_out_fence (drmsink, bypassed ? 0 :
+      gst_framebuffersink_get_presentation_timeout (framebuffersink))) {
+    /* Interrupted by a flush or state change; drop the frame and leave the
+       previous commit outstanding. */
+    if (gst_framebuffersink_is_unlocked (framebuffersink))
+      return;
+    if (!bypassed) {
+      GST_INFO_OBJECT (drmsink, "pan_display: out-fence timed out");
+      gst_framebuffersink_report_presentation_stall (framebuffersink);
+    }
+    close (drmsink->out_fence_fd);
+    drmsink->out_fence_fd = -1;
+    drmsink->page_flip_pending = FALSE;
+    /* The late commit still takes effect. */
+    if (drmsink->page_flip_fb != 0)
+      gst_drmsink_set_scanout (drmsink, drmsink->page_flip_fb, 0);
+  }
+
+  req = drmModeAtomicAlloc ();
+  if (req == NULL)
+    return;
+  gst_drmsink_atomic_add_state (drmsink, req, vmem->fb,
+      !drmsink->crtc_mode_initialized);
+  for (i = 0; i < drmsink->n_pending_crtc_props; i++)
+    drmModeAtomicAddProperty (req, drmsink->crtc_id,
+        drmsink->pending_crtc_prop_id[i], drmsink->pending_crtc_blob_id[i]);
+  flags = drmsink->crtc_mode_initialized ? 0 : DRM_MODE_ATOMIC_ALLOW_MODESET;
+  /* While the watchdog has given up on the fences, commit synchronously. */
+  if (!bypassed) {
+    drmModeAtomicAddProperty (req, drmsink->crtc_id,
+        drmsink->crtc_out_fence_ptr_prop_id,
+        (uint64_t) (uintptr_t) &drmsink->out_fence_fd);
+    flags |= DRM_MODE_ATOMIC_NONBLOCK;
+  }
+
+  drmsink->page_flip_time = g_get_monotonic_time ();
+  drmsink->page_flip_memory = memory;
+  res = drmModeAtomicCommit (drmsink->fd, req, flags, drmsink);
+  drmModeAtomicFree (req);
+  /* The CRTC state holds its own references to the blobs. */
+  gst_drmsink_release_pending_crtc_props (drmsink);
+  if (res != 0) {
+    GST_ERROR_OBJECT (drmsink, "drmModeAtomicCommit failed: %s",
+        strerror (errno));
+    drmsink->out_fence_fd = -1;
+    gst_framebuffersink_report_presentation_stall (framebuffersink);
+    return;
+  }
+  drmsink->crtc_mode_initialized = TRUE;
+  drmsink->page_flip_pending = drmsink->out_fence_fd >= 0;
+  if (drmsink->page_flip_pending)
+    gst_drmsink_set_scanout (drmsink, drmsink->scanout_fb, vmem->fb);
+  else
+    gst_drmsink_set_scanout (drmsink, vmem->fb, 0);
+}
+
 static void
 gst_drmsink_pan_display (GstFramebufferSink *framebuffersink,
     GstMemory *memory)
@@ -1023,6 +1996,11 @@ gst_drmsink_pan_display (GstFramebufferSink *framebuffersink,
       "pan_display called, mem = %p, map_address = %p",
       vmem, vmem->map_address);
 
+  if (drmsink->atomic) {
+    gst_drmsink_pan_display_atomic (drmsink, memory);
+    return;
+  }
+
   if (!drmsink->crtc_mode_initialized) {
     connectors[0] = drmsink->connector_id;
     if (drmModeSetCrtc (drmsink->fd, drmsink->crtc_id, vmem->fb,
@@ -1031,23 +2009,48 @@ gst_drmsink_pan_display (GstFramebufferSink *framebuffersink,
       return;
     }
     drmsink->crtc_mode_initialized = TRUE;
+    gst_drmsink_set_scanout (drmsink, vmem->fb, 0);
   }
 
   gst_drmsink_flush_drm_events (drmsink);
 
+  /* While the watchdog has given up on page flip events, set the buffer
+     directly. */
+  if (gst_framebuffersink_hardware_sync_bypassed (framebuffersink)) {
+    drmsink->page_flip_pending = FALSE;
+    gst_drmsink_set_crtc_buffer (drmsink, vmem->fb);
+    return;
+  }
+
   if (drmsink->page_flip_pending) {
-    GST_INFO_OBJECT (drmsink,
-        "pan_display: previous page flip still pending, skipping");
+    if ((g_get_monotonic_time () - drmsink->page_flip_time) * GST_USECOND <=
+        gst_framebuffersink_get_presentation_timeout (framebuffersink)) {
+      GST_INFO_OBJECT (drmsink,
+          "pan_display: previous page flip still pending, skipping");
+      return;
+    }
+    /* The flip event never arrived; assume it was lost. */
+    GST_INFO_OBJECT (drmsink, "pan_display: page flip event timed out");
+    gst_framebuffersink_report_presentation_stall (framebuffersink);
+    drmsink->page_flip_pending = FALSE;
+    gst_drmsink_set_crtc_buffer (drmsink, vmem->fb);
     return;
   }
 
   drmsink->page_flip_occurred = FALSE;
   drmsink->page_flip_pending = TRUE;
+  drmsink->page_flip_time = g_get_monotonic_time ();
+  drmsink->page_flip_memory = memory;
   if (drmModePageFlip (drmsink->fd, drmsink->crtc_id, vmem->fb,
       DRM_MODE_PAGE_FLIP_EVENT, drmsink)) {
     GST_ERROR_OBJECT (drmsink, "drmModePageFlip failed");
+    /* A flip may still be queued in the kernel. */
+    drmsink->page_flip_pending = FALSE;
+    gst_framebuffersink_report_presentation_stall (framebuffersink);
+    gst_drmsink_set_crtc_buffer (drmsink, vmem->fb);
     return;
   }
+  gst_drmsink_set_scanout (drmsink, drmsink->scanout_fb, vmem->fb);
 }
 
 static void
@@ -1055,13 +2058,30 @@ gst_drmsink_wait_for_vsync (GstFramebufferSink *framebuffersink)
 {
   GstDrmsink *drmsink = GST_DRMSINK (framebuffersink);
   drmVBlank vbl;
-  fd_set fds;
-  struct timeval tv;
+  GstClockTime timeout;
+  int res;
 
   GST_INFO_OBJECT (drmsink, "wait_for_vsync called");
 
   drmsink->vblank_occurred = FALSE;
+  memset (&vbl, 0, sizeof (vbl));
   vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
   vbl.request.sequence = 1;
-  drmWaitVBlank(drmsink->fd, &vbl);
+  vbl.request.signal = (unsigned long) drmsink;
+  if (drmWaitVBlank(drmsink->fd, &vbl)) {
+    GST_WARNING_OBJECT (drmsink, "drmWaitVBlank failed");
+    return;
+  }
+
+  /* Wait for the vblank event instead of blocking in the ioctl so that the
+     wait can be interrupted. An event that arrives after an interrupted or
+     timed out wait is flushed with the next page flip. A timeout is counted
+     as a stall by the base class, which times the wait. */
+  timeout = gst_framebuffersink_get_presentation_timeout (framebuffersink);
+  while (!drmsink->vblank_occurred) {
+    res = gst_framebuffersink_poll (framebuffersink, drmsink->fd, timeout);
+    if (res <= 0)
+      return;
+    drmHandleEvent(drmsink->fd, drmsink->event_context);
+  }
 }
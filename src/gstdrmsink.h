@@ -38,6 +38,21 @@ G_BEGIN_DECLS
 #define GST_IS_DRMSINK_CLASS(obj) (G_TYPE_CHECK_CLASS_TYPE ((klass), \
     GST_TYPE_DRMSINK))
 
+/* Primary plane properties used in atomic commits. */
+enum {
+  GST_DRMSINK_PLANE_PROP_FB_ID,
+  GST_DRMSINK_PLANE_PROP_CRTC_ID,
+  GST_DRMSINK_PLANE_PROP_SRC_X,
+  GST_DRMSINK_PLANE_PROP_SRC_Y,
+  GST_DRMSINK_PLANE_PROP_SRC_W,
+  GST_DRMSINK_PLANE_PROP_SRC_H,
+  GST_DRMSINK_PLANE_PROP_CRTC_X,
+  GST_DRMSINK_PLANE_PROP_CRTC_Y,
+  GST_DRMSINK_PLANE_PROP_CRTC_W,
+  GST_DRMSINK_PLANE_PROP_CRTC_H,
+  GST_DRMSINK_PLANE_PROP_COUNT
+};
+
 typedef struct _GstDrmsink GstDrmsink;
 typedef struct _GstDrmsinkClass GstDrmsinkClass;
 
@@ -59,12 +74,57 @@ struct _GstDrmsink
   gboolean vblank_occurred;
   gboolean page_flip_pending;
   gboolean page_flip_occurred;
+  /* Monotonic time at which the pending page flip was queued. */
+  gint64 page_flip_time;
+  /* Memory shown by the pending page flip. */
+  GstMemory *page_flip_memory;
+  /* Framebuffer objects being scanned out and being flipped to (0 if none),
+     and the buffers of memory freed while they were one of them, released
+     once the flip away from them has completed. Protected by the object
+     lock. */
+  uint32_t scanout_fb;
+  uint32_t page_flip_fb;
+  GList *retired_buffers;
+  /* CRTC color management properties used for the color balance. */
+  gboolean color_properties_probed;
+  uint32_t ctm_prop_id;
+  uint32_t gamma_lut_prop_id;
+  int gamma_lut_size;
+  gboolean color_management_active;
+  /* Atomic modesetting, used when the driver supports it. */
+  gboolean atomic;
+  uint32_t primary_plane_id;
+  uint32_t mode_blob_id;
+  uint32_t connector_crtc_id_prop_id;
+  uint32_t crtc_mode_id_prop_id;
+  uint32_t crtc_active_prop_id;
+  uint32_t crtc_out_fence_ptr_prop_id;
+  uint32_t plane_prop_id[GST_DRMSINK_PLANE_PROP_COUNT];
+  /* Out-fence of the last nonblocking commit, -1 when none is pending. */
+  int32_t out_fence_fd;
+  /* CRTC blob properties to be set with the next atomic commit. */
+  int n_pending_crtc_props;
+  uint32_t pending_crtc_prop_id[2];
+  uint32_t pending_crtc_blob_id[2];
+  /* Dumb buffers with framebuffer objects and mappings kept after their
+     memory was freed, most recently freed first, for reuse by later
+     allocations. Protected by the object lock. */
+  GList *buffer_cache;
+  gsize buffer_cache_size;
+  gint stats_buffers_allocated;
+  gint stats_buffers_reused;
+  /* Screen format and the corresponding DRM format code. */
+  GstVideoFormat screen_format;
+  uint32_t screen_drm_format;
 
   /* GST */
   GstVideoRectangle screen_rect;
 
   /* Properties */
   gint preferred_connector_id;
+  gchar *screen_format_str;
+  gboolean atomic_property;
+  gint buffer_cache_max_property;
 };
 
 struct _GstDrmsinkClass
@@ -108,12 +108,16 @@ const gchar *message) {
 }
 
 #define GST_FBDEV2SINK_TEMPLATE_CAPS \
-        GST_VIDEO_CAPS_MAKE ("RGB") \
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF, \
+            "{ RGB, BGR, RGBx, BGRx, xRGB, xBGR, RGB16, RGB15 }") \
+        "; " GST_VIDEO_CAPS_MAKE ("RGB") \
         "; " GST_VIDEO_CAPS_MAKE ("BGR") \
         "; " GST_VIDEO_CAPS_MAKE ("RGBx") \
         "; " GST_VIDEO_CAPS_MAKE ("BGRx") \
         "; " GST_VIDEO_CAPS_MAKE ("xRGB") \
-        "; " GST_VIDEO_CAPS_MAKE ("xBGR") ", " \
+        "; " GST_VIDEO_CAPS_MAKE ("xBGR") \
+        "; " GST_VIDEO_CAPS_MAKE ("RGB16") \
+        "; " GST_VIDEO_CAPS_MAKE ("RGB15") ", " \
         "framerate = (fraction) [ 0, MAX ], " \
         "width = (int) [ 1, MAX ], " "height = (int) [ 1, MAX ]"
 
@@ -0,0 +1,86 @@
+/* GStreamer deferred I/O framebuffer helpers
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Device detection and the tile writer used by GstFbdevFramebufferSink in
+   deferred I/O mode. They only depend on GLib, so that they can be tested
+   without a panel. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "gstfbdevdeferredio.h"
+
+/* fbtft drivers identify themselves as "fb_<controller>" and provide a
+   single screen buffer that is pushed to the panel using deferred I/O. */
+
+gboolean
+gst_fbdev_deferred_io_is_device (const struct fb_fix_screeninfo *fixinfo,
+    const struct fb_var_screeninfo *varinfo)
+{
+  if (strncmp (fixinfo->id, "fb_", 3) != 0)
+    return FALSE;
+  if (fixinfo->smem_len >= fixinfo->line_length * varinfo->yres * 2)
+    return FALSE;
+  return TRUE;
+}
+
+/* Reading back from the mapping would touch the pages as well, so tiles are
+   compared with the shadow copy in system memory. */
+
+guint
+gst_fbdev_deferred_io_write_tiles (uint8_t *dest, uint8_t *shadow,
+    int dest_stride, const uint8_t *src, int src_stride, int width_in_bytes,
+    int height, int tile_width_in_bytes, int tile_height, gboolean force,
+    guint64 *tiles_total)
+{
+  guint tiles_written = 0;
+  int y;
+
+  for (y = 0; y < height; y += tile_height) {
+    int h = MIN (tile_height, height - y);
+    int x;
+    int i;
+
+    for (x = 0; x < width_in_bytes; x += tile_width_in_bytes) {
+      int w = MIN (tile_width_in_bytes, width_in_bytes - x);
+      gboolean dirty = force || shadow == NULL;
+
+      for (i = 0; i < h && !dirty; i++)
+        dirty = memcmp (shadow + i * dest_stride + x,
+            src + i * src_stride + x, w) != 0;
+      if (dirty) {
+        for (i = 0; i < h; i++) {
+          memcpy (dest + i * dest_stride + x, src + i * src_stride + x, w);
+          if (shadow != NULL)
+            memcpy (shadow + i * dest_stride + x, src + i * src_stride + x,
+                w);
+        }
+        tiles_written++;
+      }
+      (*tiles_total)++;
+    }
+    src += src_stride * h;
+    dest += dest_stride * h;
+    if (shadow != NULL)
+      shadow += dest_stride * h;
+  }
+  return tiles_written;
+}
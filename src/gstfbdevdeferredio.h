@@ -0,0 +1,48 @@
+/* GStreamer deferred I/O framebuffer helpers
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_FBDEVDEFERREDIO_H_
+#define _GST_FBDEVDEFERREDIO_H_
+
+#include <stdint.h>
+#include <linux/fb.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Whether the device is a deferred I/O panel (fbtft-style driver) that
+   only provides a single screen buffer. */
+gboolean gst_fbdev_deferred_io_is_device (
+    const struct fb_fix_screeninfo *fixinfo,
+    const struct fb_var_screeninfo *varinfo);
+
+/* Write the height rows of width_in_bytes bytes at src into dest, in tiles
+   of tile_width_in_bytes by tile_height rows. Each tile is compared with
+   the shadow copy of dest, which uses the same stride as dest, and only
+   tiles that differ are written to dest and to the shadow. With force set,
+   or without a shadow, every tile is written. Returns the number of tiles
+   written; the number of tiles is added to *tiles_total. */
+guint gst_fbdev_deferred_io_write_tiles (uint8_t *dest, uint8_t *shadow,
+    int dest_stride, const uint8_t *src, int src_stride, int width_in_bytes,
+    int height, int tile_width_in_bytes, int tile_height, gboolean force,
+    guint64 *tiles_total);
+
+G_END_DECLS
+
+#endif
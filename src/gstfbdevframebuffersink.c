@@ -36,6 +36,20 @@
  * hardware due to, for example, extra hidden vsyncs being performed in the
  * pan function. The "pan-does-vsync" option may help in that case.
  * </para>
+ * <para>
+ * Small SPI/I2C panels driven by fbtft-style drivers use deferred I/O:
+ * every page written in the mapping is pushed to the panel over a slow bus.
+ * On such devices (detected automatically, or forced with the "deferred-io"
+ * property) the sink never pans, and only writes the tiles that changed
+ * since the previous frame, converting 24/32bpp RGB sources to the panel
+ * format in the same pass.
+ * </para>
+ * <para>
+ * The "bits-per-pixel" and "fit-video-mode" properties switch the display
+ * pixel depth and resolution with FBIOPUT_VSCREENINFO to match the stream.
+ * The mode that was active when the device was opened is restored when it
+ * is closed. Not all drivers support mode switching.
+ * </para>
  * </refsect2>
  */
 
@@ -44,6 +58,7 @@
 #endif
 
 #include <stdlib.h>
+#include <errno.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/time.h>
@@ -52,6 +67,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <math.h>
@@ -65,6 +81,8 @@
 #include <gst/video/video-info.h>
 #include <gst/video/gstvideometa.h>
 #include "gstfbdevframebuffersink.h"
+#include "gstfbdevdeferredio.h"
+#include "gstframebuffersinktrace.h"
 
 /* When LAZY_ALLOCATION is defined, memory buffers are only allocated
    when they are actually mapped for the first time. This solves the
@@ -72,9 +90,16 @@
    previous one soon enough (resulting in running out of video memory) */
 #define LAZY_ALLOCATION
 
+/* Size in pixels of the tiles that are compared with the previous frame and
+   written when changed in deferred I/O mode. */
+#define DEFERRED_IO_TILE_WIDTH 32
+#define DEFERRED_IO_TILE_HEIGHT 8
+
 GST_DEBUG_CATEGORY_STATIC (gst_fbdevframebuffersink_debug_category);
 #define GST_CAT_DEFAULT gst_fbdevframebuffersink_debug_category
 
+static GstFramebufferSinkClass *parent_class = NULL;
+
 /* Function to produce informational message if silent property is not set;
    if the silent property is enabled only debugging info is produced. */
 static void GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (
@@ -101,12 +126,27 @@ static GstAllocator *gst_fbdevframebuffersink_video_memory_allocator_new (
     gboolean is_overlay);
 static void gst_fbdevframebuffersink_pan_display (
     GstFramebufferSink *framebuffersink, GstMemory *memory);
+static gboolean gst_fbdevframebuffersink_video_memory_is_pannable (
+    GstFramebufferSink *framebuffersink, GstMemory *vmem);
 static void gst_fbdevframebuffersink_wait_for_vsync (
     GstFramebufferSink *framebuffersink);
+static gboolean gst_fbdevframebuffersink_set_caps (GstBaseSink *sink,
+    GstCaps *caps);
+static void gst_fbdevframebuffersink_put_image (
+    GstFramebufferSink *framebuffersink, GstMemory *vmem, const guint8 *src,
+    int src_stride);
+static GstFlowReturn gst_fbdevframebuffersink_put_converted_image (
+    GstFramebufferSink *framebuffersink, GstBuffer *buffer, GstMemory *vmem);
 
 /* Local functions. */
 static void gst_fbdevframebuffersink_pan_display_fbdev (
     GstFbdevFramebufferSink *fbdevframebuffersink, int x, int y);
+static gboolean gst_fbdevframebuffersink_update_screen_info (
+    GstFbdevFramebufferSink *fbdevframebuffersink);
+static GstClockTime gst_fbdevframebuffersink_get_refresh_period (
+    struct fb_var_screeninfo *varinfo);
+static void gst_fbdevframebuffersink_vsync_waiter_stop (
+    GstFbdevFramebufferSink *fbdevframebuffersink);
 
 /* Standard video memory implementation. */
 static void gst_fbdevframebuffersink_video_memory_init (gpointer framebuffer,
@@ -117,6 +157,21 @@ enum
 {
   PROP_0,
   PROP_GRAPHICS_MODE,
+  PROP_DEFERRED_IO,
+  PROP_BITS_PER_PIXEL,
+  PROP_FIT_VIDEO_MODE,
+};
+
+/* Source formats that are converted to a 15/16bpp panel format while writing
+   in deferred I/O mode. */
+static GstVideoFormat deferred_io_converted_formats_table[] = {
+  GST_VIDEO_FORMAT_BGRx,
+  GST_VIDEO_FORMAT_RGBx,
+  GST_VIDEO_FORMAT_xRGB,
+  GST_VIDEO_FORMAT_xBGR,
+  GST_VIDEO_FORMAT_RGB,
+  GST_VIDEO_FORMAT_BGR,
+  GST_VIDEO_FORMAT_UNKNOWN
 };
 
 /* Class initialization. */
@@ -125,9 +180,12 @@ static void
 gst_fbdevframebuffersink_class_init (GstFbdevFramebufferSinkClass* klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseSinkClass *base_sink_class = GST_BASE_SINK_CLASS (klass);
   GstFramebufferSinkClass *framebuffer_sink_class =
       GST_FRAMEBUFFERSINK_CLASS (klass);
 
+  parent_class = g_type_class_peek_parent (klass);
+
   gobject_class->set_property = gst_fbdevframebuffersink_set_property;
   gobject_class->get_property = gst_fbdevframebuffersink_get_property;
 
@@ -137,15 +195,41 @@ gst_fbdevframebuffersink_class_init (GstFbdevFramebufferSinkClass* klass)
       "text output and the cursor but can result in textmode not being "
       "restored in case of a crash. Use with care.",
       FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DEFERRED_IO,
+      g_param_spec_int ("deferred-io", "Deferred I/O small-panel mode",
+      "Write only changed scanlines and never pan, for deferred I/O devices "
+      "such as fbtft SPI/I2C panels. 0 (the default) detects such devices "
+      "automatically, 1 forces the mode on and -1 disables it.",
+      -1, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BITS_PER_PIXEL,
+      g_param_spec_int ("bits-per-pixel", "Bits per pixel",
+      "Switch the display to the given pixel depth (16, 24 or 32) when the "
+      "device is opened; 0 keeps the current depth. The original mode is "
+      "restored when the device is closed.",
+      0, 32, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FIT_VIDEO_MODE,
+      g_param_spec_boolean ("fit-video-mode", "Fit video mode to stream",
+      "Switch the display resolution to the negotiated video size, so that "
+      "a smaller video fills the screen and less video memory is written per "
+      "frame. The original mode is restored when the device is closed.",
+      FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  base_sink_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_set_caps);
   framebuffer_sink_class->open_hardware =
       GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_open_hardware);
   framebuffer_sink_class->close_hardware =
       GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_close_hardware);
+  framebuffer_sink_class->put_image =
+      GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_put_image);
+  framebuffer_sink_class->put_converted_image =
+      GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_put_converted_image);
   framebuffer_sink_class->video_memory_allocator_new =
       GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_video_memory_allocator_new);
   framebuffer_sink_class->pan_display =
       GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_pan_display);
+  framebuffer_sink_class->video_memory_is_pannable =
+      GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_video_memory_is_pannable);
   framebuffer_sink_class->wait_for_vsync =
       GST_DEBUG_FUNCPTR (gst_fbdevframebuffersink_wait_for_vsync);
 }
@@ -165,9 +249,18 @@ gst_fbdevframebuffersink_init (GstFbdevFramebufferSink *fbdevframebuffersink) {
       GST_FRAMEBUFFERSINK (fbdevframebuffersink);
 
   fbdevframebuffersink->framebuffer = NULL;
+  fbdevframebuffersink->vsync_waiter = NULL;
+  fbdevframebuffersink->pan_pending = NULL;
+  fbdevframebuffersink->deferred_io = FALSE;
+  fbdevframebuffersink->deferred_io_shadow = NULL;
+  fbdevframebuffersink->deferred_io_band = NULL;
 
   /* Set the initial values of the properties.*/
   fbdevframebuffersink->use_graphics_mode = FALSE;
+  fbdevframebuffersink->deferred_io_property = 0;
+  fbdevframebuffersink->bits_per_pixel_property = 0;
+  fbdevframebuffersink->fit_video_mode = FALSE;
+  fbdevframebuffersink->video_mode_changed = FALSE;
 
   /* Override the default value of the device property from
      GstFramebufferSink. */
@@ -188,6 +281,22 @@ gst_fbdevframebuffersink_set_property (GObject * object, guint property_id,
     case PROP_GRAPHICS_MODE:
       fbdevframebuffersink->use_graphics_mode = g_value_get_boolean (value);
       break;
+    case PROP_DEFERRED_IO:
+      fbdevframebuffersink->deferred_io_property = g_value_get_int (value);
+      break;
+    case PROP_BITS_PER_PIXEL: {
+      gint bpp = g_value_get_int (value);
+      if (bpp != 0 && bpp != 16 && bpp != 24 && bpp != 32) {
+        GST_WARNING_OBJECT (fbdevframebuffersink,
+            "Unsupported bits-per-pixel value %d, ignoring", bpp);
+        break;
+      }
+      fbdevframebuffersink->bits_per_pixel_property = bpp;
+      break;
+      }
+    case PROP_FIT_VIDEO_MODE:
+      fbdevframebuffersink->fit_video_mode = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -208,6 +317,15 @@ gst_fbdevframebuffersink_get_property (GObject * object, guint property_id,
     case PROP_GRAPHICS_MODE:
       g_value_set_boolean (value, fbdevframebuffersink->use_graphics_mode);
       break;
+    case PROP_DEFERRED_IO:
+      g_value_set_int (value, fbdevframebuffersink->deferred_io_property);
+      break;
+    case PROP_BITS_PER_PIXEL:
+      g_value_set_int (value, fbdevframebuffersink->bits_per_pixel_property);
+      break;
+    case PROP_FIT_VIDEO_MODE:
+      g_value_set_boolean (value, fbdevframebuffersink->fit_video_mode);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -241,6 +359,137 @@ swapendian (uint32_t val)
       | (val & 0xff0000) >> 8 | (val & 0xff000000) >> 24;
 }
 
+/* Helper function. Derive the video info of the screen from the variable
+   screen info; returns FALSE if the pixel depth is not supported. */
+static gboolean
+gst_fbdevframebuffersink_get_screen_video_info (struct fb_var_screeninfo *
+    varinfo, GstVideoInfo *info)
+{
+  uint32_t rmask;
+  uint32_t gmask;
+  uint32_t bmask;
+  int endianness;
+  int depth;
+  GstVideoFormat framebuffer_format;
+  GstVideoAlignment align;
+
+  /* Check the pixel depth and determine the color masks. */
+  rmask = ((1 << varinfo->red.length) - 1)
+      << varinfo->red.offset;
+  gmask = ((1 << varinfo->green.length) - 1)
+      << varinfo->green.offset;
+  bmask = ((1 << varinfo->blue.length) - 1)
+      << varinfo->blue.offset;
+  endianness = 0;
+
+  switch (varinfo->bits_per_pixel) {
+    case 32:
+      /* swap endian of masks */
+      rmask = swapendian (rmask);
+      gmask = swapendian (gmask);
+      bmask = swapendian (bmask);
+      endianness = 4321;
+      break;
+    case 24: {
+      /* swap red and blue masks */
+      uint32_t t = rmask;
+      rmask = bmask;
+      bmask = t;
+      endianness = 4321;
+      break;
+      }
+    case 15:
+    case 16:
+      endianness = 1234;
+      break;
+    default:
+      /* other bit depths are not supported */
+      GST_ERROR ("unsupported bit depth: %d\n",
+      varinfo->bits_per_pixel);
+      return FALSE;
+  }
+
+  /* Set the framebuffer video format. */
+  depth = varinfo->red.length + varinfo->green.length
+      + varinfo->blue.length;
+
+  framebuffer_format = gst_video_format_from_masks (depth,
+      varinfo->bits_per_pixel, endianness, rmask, gmask, bmask, 0);
+
+  gst_video_info_init (info);
+  gst_video_info_set_format (info, framebuffer_format, varinfo->xres,
+      varinfo->yres);
+  gst_video_alignment_reset (&align);
+  /* Set alignment to word boundaries. */
+  align.stride_align[0] = 3;
+  gst_video_info_align (info, &align);
+  return TRUE;
+}
+
+/* Helper function. Switch the display to a mode of (at least) the given
+   resolution and pixel depth, with a virtual height that allows for as many
+   pannable screens as fit in video memory. On success the fixed and variable
+   screen info are updated. */
+static gboolean
+gst_fbdevframebuffersink_set_device_video_mode (GstFbdevFramebufferSink *
+    fbdevframebuffersink, int xres, int yres, int bits_per_pixel)
+{
+  struct fb_var_screeninfo varinfo = fbdevframebuffersink->varinfo;
+  int n;
+
+  varinfo.xres = xres;
+  varinfo.yres = yres;
+  varinfo.xres_virtual = xres;
+  varinfo.xoffset = 0;
+  varinfo.yoffset = 0;
+  varinfo.bits_per_pixel = bits_per_pixel;
+  varinfo.activate = FB_ACTIVATE_NOW;
+  n = fbdevframebuffersink->fixinfo.smem_len / (xres * ((bits_per_pixel + 7)
+      / 8) * yres);
+  if (n < 1)
+    return FALSE;
+  varinfo.yres_virtual = yres * n;
+  if (ioctl (fbdevframebuffersink->fd, FBIOPUT_VSCREENINFO, &varinfo)) {
+    /* Retry without extra pannable buffers. */
+    varinfo.yres_virtual = yres;
+    if (ioctl (fbdevframebuffersink->fd, FBIOPUT_VSCREENINFO, &varinfo))
+      return FALSE;
+  }
+  /* The driver may have picked a nearby mode; read it back. */
+  ioctl (fbdevframebuffersink->fd, FBIOGET_VSCREENINFO, &varinfo);
+  ioctl (fbdevframebuffersink->fd, FBIOGET_FSCREENINFO,
+      &fbdevframebuffersink->fixinfo);
+  fbdevframebuffersink->varinfo = varinfo;
+  fbdevframebuffersink->video_mode_changed = TRUE;
+  if (varinfo.xres < xres || varinfo.yres < yres ||
+      varinfo.bits_per_pixel != bits_per_pixel)
+    return FALSE;
+  return TRUE;
+}
+
+/* Helper function. Restore the video mode that was active when the device
+   was opened. */
+static void
+gst_fbdevframebuffersink_restore_device_video_mode (GstFbdevFramebufferSink *
+    fbdevframebuffersink)
+{
+  struct fb_var_screeninfo varinfo = fbdevframebuffersink->saved_varinfo;
+
+  if (!fbdevframebuffersink->video_mode_changed)
+    return;
+  varinfo.activate = FB_ACTIVATE_NOW;
+  if (ioctl (fbdevframebuffersink->fd, FBIOPUT_VSCREENINFO, &varinfo))
+    GST_ERROR_OBJECT (fbdevframebuffersink,
+        "Could not restore the original video mode");
+  else {
+    ioctl (fbdevframebuffersink->fd, FBIOGET_VSCREENINFO,
+        &fbdevframebuffersink->varinfo);
+    ioctl (fbdevframebuffersink->fd, FBIOGET_FSCREENINFO,
+        &fbdevframebuffersink->fixinfo);
+  }
+  fbdevframebuffersink->video_mode_changed = FALSE;
+}
+
 /* The following member function is exported for use by derived subclasses. */
 gboolean
 gst_fbdevframebuffersink_open_hardware (GstFramebufferSink *framebuffersink,
@@ -251,13 +500,6 @@ gst_fbdevframebuffersink_open_hardware (GstFramebufferSink *framebuffersink,
       GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
   struct fb_fix_screeninfo fixinfo;
   struct fb_var_screeninfo varinfo;
-  uint32_t rmask;
-  uint32_t gmask;
-  uint32_t bmask;
-  int endianness;
-  int depth;
-  GstVideoFormat framebuffer_format;
-  GstVideoAlignment align;
   int max_framebuffers;
 
   fbdevframebuffersink->fd = open (framebuffersink->device, O_RDWR);
@@ -277,8 +519,47 @@ gst_fbdevframebuffersink_open_hardware (GstFramebufferSink *framebuffersink,
     goto err;
   }
 
+  /* Remember the original mode so that it can be restored on close. */
+  fbdevframebuffersink->saved_varinfo = varinfo;
+  fbdevframebuffersink->video_mode_changed = FALSE;
+  fbdevframebuffersink->fixinfo = fixinfo;
+  fbdevframebuffersink->varinfo = varinfo;
+
+  /* Switch the pixel depth if requested. */
+  if (fbdevframebuffersink->bits_per_pixel_property != 0 &&
+      fbdevframebuffersink->bits_per_pixel_property !=
+      varinfo.bits_per_pixel) {
+    if (gst_fbdevframebuffersink_set_device_video_mode (fbdevframebuffersink,
+        varinfo.xres, varinfo.yres,
+        fbdevframebuffersink->bits_per_pixel_property)) {
+      gchar *s = g_strdup_printf ("Switched display to %d bpp",
+          fbdevframebuffersink->bits_per_pixel_property);
+      GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink, s);
+      g_free (s);
+    }
+    else {
+      GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink,
+          "Could not switch the display pixel depth");
+      gst_fbdevframebuffersink_restore_device_video_mode (
+          fbdevframebuffersink);
+    }
+    fixinfo = fbdevframebuffersink->fixinfo;
+    varinfo = fbdevframebuffersink->varinfo;
+  }
+
+  if (fbdevframebuffersink->deferred_io_property == 0)
+    fbdevframebuffersink->deferred_io =
+        gst_fbdev_deferred_io_is_device (&fixinfo, &varinfo);
+  else
+    fbdevframebuffersink->deferred_io =
+        fbdevframebuffersink->deferred_io_property > 0;
+
   /* Map the framebuffer. */
-  if (framebuffersink->max_video_memory_property == 0)
+  if (fbdevframebuffersink->deferred_io)
+    /* Only a single screen is ever used in deferred I/O mode. */
+    fbdevframebuffersink->framebuffer_map_size =
+        fixinfo.line_length * varinfo.yres;
+  else if (framebuffersink->max_video_memory_property == 0)
     /* Only allocate up to reported virtual size when the video-memory property
        is 0. */
     fbdevframebuffersink->framebuffer_map_size =
@@ -308,76 +589,42 @@ gst_fbdevframebuffersink_open_hardware (GstFramebufferSink *framebuffersink,
       fbdevframebuffersink->framebuffer_map_size,
       PROT_WRITE, MAP_SHARED, fbdevframebuffersink->fd, 0);
   if (fbdevframebuffersink->framebuffer == MAP_FAILED) {
+    gst_fbdevframebuffersink_restore_device_video_mode (fbdevframebuffersink);
     close (fbdevframebuffersink->fd);
     goto err;
   }
 
   *video_memory_size = fbdevframebuffersink->framebuffer_map_size;
 
-  framebuffersink->nu_screens_used = 1;
+  /* Frames in DMABuf memory are mapped and copied with the CPU. */
+  framebuffersink->dmabuf_supported = TRUE;
 
-  /* Check the pixel depth and determine the color masks. */
-  rmask = ((1 << varinfo.red.length) - 1)
-      << varinfo.red.offset;
-  gmask = ((1 << varinfo.green.length) - 1)
-      << varinfo.green.offset;
-  bmask = ((1 << varinfo.blue.length) - 1)
-      << varinfo.blue.offset;
-  endianness = 0;
+  framebuffersink->nu_screens_used = 1;
 
-  switch (varinfo.bits_per_pixel) {
-    case 32:
-      /* swap endian of masks */
-      rmask = swapendian (rmask);
-      gmask = swapendian (gmask);
-      bmask = swapendian (bmask);
-      endianness = 4321;
-      break;
-    case 24: {
-      /* swap red and blue masks */
-      uint32_t t = rmask;
-      rmask = bmask;
-      bmask = t;
-      endianness = 4321;
-      break;
-      }
-    case 15:
-    case 16:
-      endianness = 1234;
-      break;
-    default:
-      /* other bit depths are not supported */
-      GST_ERROR ("unsupported bit depth: %d\n",
-      varinfo.bits_per_pixel);
-      goto err;
+  if (!gst_fbdevframebuffersink_get_screen_video_info (&varinfo, info)) {
+    munmap (fbdevframebuffersink->framebuffer,
+        fbdevframebuffersink->framebuffer_map_size);
+    gst_fbdevframebuffersink_restore_device_video_mode (fbdevframebuffersink);
+    close (fbdevframebuffersink->fd);
+    goto err;
   }
 
-  /* Set the framebuffer video format. */
-  depth = varinfo.red.length + varinfo.green.length
-      + varinfo.blue.length;
-
-  framebuffer_format = gst_video_format_from_masks (depth,
-      varinfo.bits_per_pixel, endianness, rmask, gmask, bmask, 0);
-
-  gst_video_info_init (info);
-  gst_video_info_set_format (info, framebuffer_format, varinfo.xres,
-      varinfo.yres);
-  gst_video_alignment_reset (&align);
-  /* Set alignment to word boundaries. */
-  align.stride_align[0] = 3;
-  gst_video_info_align (info, &align);
-
   fbdevframebuffersink->fixinfo = fixinfo;
   fbdevframebuffersink->varinfo = varinfo;
+  framebuffersink->refresh_period =
+      gst_fbdevframebuffersink_get_refresh_period (&varinfo);
 
   /* Make sure all framebuffers can be panned to. */
   max_framebuffers = fbdevframebuffersink->framebuffer_map_size /
       GST_VIDEO_INFO_SIZE (info);
-  if (fbdevframebuffersink->varinfo.yres_virtual < max_framebuffers *
+  if (fbdevframebuffersink->deferred_io)
+    /* Never pan in deferred I/O mode. */
+    *pannable_video_memory_size = GST_VIDEO_INFO_SIZE (info);
+  else if (fbdevframebuffersink->varinfo.yres_virtual < max_framebuffers *
       GST_VIDEO_INFO_HEIGHT (info)
       && !gst_fbdevframebuffersink_set_device_virtual_size(fbdevframebuffersink,
       fbdevframebuffersink->varinfo.xres_virtual,
-      framebuffersink->max_framebuffers * GST_VIDEO_INFO_HEIGHT (info))) {
+      max_framebuffers * GST_VIDEO_INFO_HEIGHT (info))) {
     GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink,
         "Could not set the device virtual screen size large enough to support "
         "all buffers");
@@ -402,6 +649,35 @@ gst_fbdevframebuffersink_open_hardware (GstFramebufferSink *framebuffersink,
     g_free (s);
   }
 
+  if (fbdevframebuffersink->deferred_io) {
+    gchar *s;
+    /* Keep a shadow copy of the screen in system memory to compare
+       against. */
+    fbdevframebuffersink->deferred_io_shadow = g_malloc (
+        fbdevframebuffersink->framebuffer_map_size);
+    fbdevframebuffersink->deferred_io_band = g_malloc (fixinfo.line_length *
+        DEFERRED_IO_TILE_HEIGHT);
+    fbdevframebuffersink->deferred_io_shadow_valid = FALSE;
+    fbdevframebuffersink->stats_deferred_io_tiles_written = 0;
+    fbdevframebuffersink->stats_deferred_io_tiles_total = 0;
+    /* These devices have no vsync and no page flipping; buffer pools in
+       video memory would defeat the purpose. */
+    framebuffersink->vsync = FALSE;
+    framebuffersink->use_buffer_pool = FALSE;
+    framebuffersink->use_hardware_overlay = FALSE;
+    framebuffersink->live_properties_fixed = TRUE;
+    /* Frames are written by put_image and put_converted_image, which only
+       write the tiles that changed. */
+    framebuffersink->use_put_image = TRUE;
+    if (varinfo.bits_per_pixel == 15 || varinfo.bits_per_pixel == 16)
+      framebuffersink->converted_formats_supported =
+          deferred_io_converted_formats_table;
+    s = g_strdup_printf ("Using deferred I/O small-panel mode for device %s "
+        "(%s)", framebuffersink->device, fixinfo.id);
+    GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink, s);
+    g_free (s);
+  }
+
   if (fbdevframebuffersink->use_graphics_mode) {
     int kd_fd;
     kd_fd = open ("/dev/tty0", O_RDWR);
@@ -443,12 +719,34 @@ gst_fbdevframebuffersink_close_hardware (GstFramebufferSink *framebuffersink)
   /* Video memory buffers should already be freed. */
   gst_fbdevframebuffersink_video_memory_finalize ();
 
-  gst_fbdevframebuffersink_pan_display_fbdev(fbdevframebuffersink, 0, 0);
+  gst_fbdevframebuffersink_vsync_waiter_stop (fbdevframebuffersink);
+  fbdevframebuffersink->pan_pending = NULL;
+
+  if (fbdevframebuffersink->deferred_io) {
+    if (fbdevframebuffersink->stats_deferred_io_tiles_total > 0) {
+      gchar *s = g_strdup_printf ("Deferred I/O: %" G_GUINT64_FORMAT " of %"
+          G_GUINT64_FORMAT " tiles written (%.1lf%%)",
+          fbdevframebuffersink->stats_deferred_io_tiles_written,
+          fbdevframebuffersink->stats_deferred_io_tiles_total,
+          (double) fbdevframebuffersink->stats_deferred_io_tiles_written * 100.0
+          / fbdevframebuffersink->stats_deferred_io_tiles_total);
+      GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink, s);
+      g_free (s);
+    }
+    g_free (fbdevframebuffersink->deferred_io_shadow);
+    g_free (fbdevframebuffersink->deferred_io_band);
+    fbdevframebuffersink->deferred_io_shadow = NULL;
+    fbdevframebuffersink->deferred_io_band = NULL;
+  }
+  else
+    gst_fbdevframebuffersink_pan_display_fbdev(fbdevframebuffersink, 0, 0);
 
   if (munmap (fbdevframebuffersink->framebuffer,
       fbdevframebuffersink->framebuffer_map_size))
     GST_ERROR_OBJECT (fbdevframebuffersink, "Could not unmap video memory");
 
+  gst_fbdevframebuffersink_restore_device_video_mode (fbdevframebuffersink);
+
   close (fbdevframebuffersink->fd);
 
   if (fbdevframebuffersink->use_graphics_mode) {
@@ -482,19 +780,462 @@ gst_fbdevframebuffersink_pan_display (GstFramebufferSink *framebuffersink,
   }
   y = (mapinfo.data - fbdevframebuffersink->framebuffer) /
       fbdevframebuffersink->fixinfo.line_length;
+  if (y + fbdevframebuffersink->varinfo.yres >
+      fbdevframebuffersink->varinfo.yres_virtual) {
+    GST_ERROR_OBJECT (framebuffersink,
+        "Video memory at line %d is beyond the virtual resolution", y);
+    gst_memory_unmap (memory, &mapinfo);
+    return;
+  }
   gst_fbdevframebuffersink_pan_display_fbdev (fbdevframebuffersink, 0, y);
+  /* The flip only completes when the new offset is latched at a vblank.
+     When FBIOPAN_DISPLAY waits for it that is now, otherwise it is at the
+     end of the next vsync wait. Without vsync the completion is unknown. */
+  fbdevframebuffersink->pan_pending = NULL;
+  if (framebuffersink->vsync && framebuffersink->pan_does_vsync)
+    GST_FRAMEBUFFERSINK_TRACE (framebuffersink, FLIP_COMPLETE, flip_complete,
+        memory, 0);
+  else if (framebuffersink->vsync)
+    fbdevframebuffersink->pan_pending = memory;
   gst_memory_unmap (memory, &mapinfo);
 }
 
+/* Screen memory is allocated from the whole mapping, which may extend beyond
+   the virtual resolution that can be panned to. */
+
+static gboolean
+gst_fbdevframebuffersink_video_memory_is_pannable (
+    GstFramebufferSink *framebuffersink, GstMemory *vmem)
+{
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
+  GstMapInfo mapinfo;
+  gsize offset;
+
+  if (!gst_memory_map (vmem, &mapinfo, 0))
+    return FALSE;
+  offset = mapinfo.data - fbdevframebuffersink->framebuffer;
+  gst_memory_unmap (vmem, &mapinfo);
+  return offset + GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info) <=
+      framebuffersink->pannable_video_memory_size;
+}
+
+/* FBIO_WAITFORVSYNC is issued from a helper thread so that a driver that
+   never signals vsync cannot block the streaming thread. The thread signals
+   completion on done_fd, which the streaming thread polls together with the
+   sink's wakeup fd so that the wait can be interrupted when the sink is
+   unlocked. The streaming thread gives up after the presentation timeout; a
+   wait that is still stuck in the driver makes later calls return
+   immediately until it completes, while the completion of an interrupted
+   wait is taken as the next vsync. The waiter is reference counted because
+   a thread stuck in the driver may outlive the element. */
+
+struct _GstFbdevFramebufferSinkVsyncWaiter {
+  gint ref_count;
+  GMutex mutex;
+  GCond cond;
+  int fd;
+  int done_fd;
+  gboolean requested;
+  gboolean busy;
+  gboolean interrupted;
+  gboolean failed;
+  gboolean quit;
+};
+
+static void
+gst_fbdevframebuffersink_vsync_waiter_unref (
+    GstFbdevFramebufferSinkVsyncWaiter *waiter)
+{
+  if (!g_atomic_int_dec_and_test (&waiter->ref_count))
+    return;
+  close (waiter->fd);
+  close (waiter->done_fd);
+  g_mutex_clear (&waiter->mutex);
+  g_cond_clear (&waiter->cond);
+  g_free (waiter);
+}
+
+static gpointer
+gst_fbdevframebuffersink_vsync_waiter_thread (gpointer data)
+{
+  GstFbdevFramebufferSinkVsyncWaiter *waiter = data;
+  uint32_t crtc = 0;
+  guint64 value = 1;
+  int res;
+
+  g_mutex_lock (&waiter->mutex);
+  while (TRUE) {
+    while (!waiter->requested && !waiter->quit)
+      g_cond_wait (&waiter->cond, &waiter->mutex);
+    if (waiter->quit)
+      break;
+    waiter->requested = FALSE;
+    g_mutex_unlock (&waiter->mutex);
+    res = ioctl (waiter->fd, FBIO_WAITFORVSYNC, &crtc);
+    g_mutex_lock (&waiter->mutex);
+    if (res)
+      waiter->failed = TRUE;
+    waiter->busy = FALSE;
+    if (write (waiter->done_fd, &value, sizeof (value)) < 0)
+      waiter->failed = TRUE;
+  }
+  g_mutex_unlock (&waiter->mutex);
+  gst_fbdevframebuffersink_vsync_waiter_unref (waiter);
+  return NULL;
+}
+
+static GstFbdevFramebufferSinkVsyncWaiter *
+gst_fbdevframebuffersink_vsync_waiter_start (
+    GstFbdevFramebufferSink *fbdevframebuffersink)
+{
+  GstFbdevFramebufferSinkVsyncWaiter *waiter;
+  GThread *thread;
+
+  waiter = g_new0 (GstFbdevFramebufferSinkVsyncWaiter, 1);
+  waiter->fd = dup (fbdevframebuffersink->fd);
+  if (waiter->fd < 0) {
+    g_free (waiter);
+    return NULL;
+  }
+  waiter->done_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (waiter->done_fd < 0) {
+    close (waiter->fd);
+    g_free (waiter);
+    return NULL;
+  }
+  g_mutex_init (&waiter->mutex);
+  g_cond_init (&waiter->cond);
+  /* One reference for the element and one for the thread. */
+  waiter->ref_count = 2;
+  thread = g_thread_try_new ("fbdev-vsync",
+      gst_fbdevframebuffersink_vsync_waiter_thread, waiter, NULL);
+  if (thread == NULL) {
+    waiter->ref_count = 1;
+    gst_fbdevframebuffersink_vsync_waiter_unref (waiter);
+    return NULL;
+  }
+  /* The thread is never joined. */
+  g_thread_unref (thread);
+  return waiter;
+}
+
+static void
+gst_fbdevframebuffersink_vsync_waiter_stop (
+    GstFbdevFramebufferSink *fbdevframebuffersink)
+{
+  GstFbdevFramebufferSinkVsyncWaiter *waiter =
+      fbdevframebuffersink->vsync_waiter;
+
+  if (waiter == NULL)
+    return;
+  g_mutex_lock (&waiter->mutex);
+  waiter->quit = TRUE;
+  g_cond_broadcast (&waiter->cond);
+  g_mutex_unlock (&waiter->mutex);
+  gst_fbdevframebuffersink_vsync_waiter_unref (waiter);
+  fbdevframebuffersink->vsync_waiter = NULL;
+}
+
 static void
 gst_fbdevframebuffersink_wait_for_vsync (GstFramebufferSink *framebuffersink) {
   GstFbdevFramebufferSink *fbdevframebuffersink =
       GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
-  if (ioctl (fbdevframebuffersink->fd, FBIO_WAITFORVSYNC, NULL)) {
+  GstFbdevFramebufferSinkVsyncWaiter *waiter;
+  guint64 value;
+  gboolean busy, interrupted, failed;
+  int res;
+
+  if (fbdevframebuffersink->vsync_waiter == NULL) {
+    fbdevframebuffersink->vsync_waiter =
+        gst_fbdevframebuffersink_vsync_waiter_start (fbdevframebuffersink);
+    if (fbdevframebuffersink->vsync_waiter == NULL) {
+      GST_ERROR_OBJECT (fbdevframebuffersink,
+          "Could not start vsync thread. Disabling vsync.");
+      framebuffersink->vsync = FALSE;
+      return;
+    }
+  }
+  waiter = fbdevframebuffersink->vsync_waiter;
+
+  g_mutex_lock (&waiter->mutex);
+  busy = waiter->busy;
+  interrupted = waiter->interrupted;
+  if (!busy) {
+    /* Discard the completion of an interrupted wait. */
+    if (read (waiter->done_fd, &value, sizeof (value)) < 0 && errno != EAGAIN)
+      waiter->failed = TRUE;
+    waiter->busy = TRUE;
+    waiter->requested = TRUE;
+    waiter->interrupted = FALSE;
+    g_cond_broadcast (&waiter->cond);
+  }
+  g_mutex_unlock (&waiter->mutex);
+  if (busy && !interrupted) {
+    /* A previous wait is still stuck in the driver. */
+    gst_framebuffersink_report_presentation_stall (framebuffersink);
+    return;
+  }
+
+  res = gst_framebuffersink_poll (framebuffersink, waiter->done_fd,
+      gst_framebuffersink_get_presentation_timeout (framebuffersink));
+  g_mutex_lock (&waiter->mutex);
+  if (res > 0) {
+    if (read (waiter->done_fd, &value, sizeof (value)) < 0 && errno != EAGAIN)
+      waiter->failed = TRUE;
+  }
+  else
+    /* Keep waiting for the same vsync next time when interrupted. */
+    waiter->interrupted = res < 0;
+  failed = waiter->failed;
+  g_mutex_unlock (&waiter->mutex);
+
+  /* A timeout is counted as a stall by the base class, which times the
+     wait. */
+  if (failed) {
     GST_ERROR_OBJECT(fbdevframebuffersink,
     "FBIO_WAITFORVSYNC call failed. Disabling vsync.");
     framebuffersink->vsync = FALSE;
   }
+  else if (res > 0 && fbdevframebuffersink->pan_pending != NULL) {
+    GST_FRAMEBUFFERSINK_TRACE (framebuffersink, FLIP_COMPLETE, flip_complete,
+        fbdevframebuffersink->pan_pending, 0);
+    fbdevframebuffersink->pan_pending = NULL;
+  }
+}
+
+static gboolean
+gst_fbdevframebuffersink_set_caps (GstBaseSink *sink, GstCaps *caps)
+{
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (sink);
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
+  GstVideoInfo *info;
+
+  /* Switch to a video mode that matches the video size before the parent
+     class lays out the screen buffers. This is only possible while no
+     screen buffers have been handed out and the video is written to the
+     screen rather than to a hardware overlay. */
+  if (fbdevframebuffersink->fit_video_mode &&
+      !fbdevframebuffersink->deferred_io &&
+      !framebuffersink->use_hardware_overlay &&
+      framebuffersink->screens == NULL && framebuffersink->pool == NULL) {
+    GstVideoInfo video_info;
+    if (gst_video_info_from_caps (&video_info, caps) &&
+        (GST_VIDEO_INFO_WIDTH (&video_info) !=
+        fbdevframebuffersink->varinfo.xres ||
+        GST_VIDEO_INFO_HEIGHT (&video_info) !=
+        fbdevframebuffersink->varinfo.yres)) {
+      gchar *s;
+      if (gst_fbdevframebuffersink_set_device_video_mode (fbdevframebuffersink,
+          GST_VIDEO_INFO_WIDTH (&video_info),
+          GST_VIDEO_INFO_HEIGHT (&video_info),
+          fbdevframebuffersink->varinfo.bits_per_pixel)
+          && gst_fbdevframebuffersink_update_screen_info (
+          fbdevframebuffersink)) {
+        s = g_strdup_printf ("Switched display mode to %d x %d to fit the "
+            "video", fbdevframebuffersink->varinfo.xres,
+            fbdevframebuffersink->varinfo.yres);
+      }
+      else {
+        gst_fbdevframebuffersink_restore_device_video_mode (
+            fbdevframebuffersink);
+        gst_fbdevframebuffersink_update_screen_info (fbdevframebuffersink);
+        s = g_strdup_printf ("Could not switch display mode to %d x %d",
+            GST_VIDEO_INFO_WIDTH (&video_info),
+            GST_VIDEO_INFO_HEIGHT (&video_info));
+      }
+      GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink, s);
+      g_free (s);
+    }
+  }
+
+  if (!GST_BASE_SINK_CLASS (parent_class)->set_caps (sink, caps))
+    return FALSE;
+
+  if (!fbdevframebuffersink->deferred_io)
+    return TRUE;
+
+  /* The screen may have been cleared or the video rectangle moved, so the
+     next frame has to be written completely. */
+  fbdevframebuffersink->deferred_io_shadow_valid = FALSE;
+
+  info = &framebuffersink->video_info;
+  if (framebuffersink->convert_frames) {
+    int i;
+    fbdevframebuffersink->deferred_io_src_pstride =
+        GST_VIDEO_INFO_COMP_PSTRIDE (info, 0);
+    for (i = 0; i < 3; i++)
+      fbdevframebuffersink->deferred_io_src_offset[i] =
+          GST_VIDEO_FORMAT_INFO_POFFSET (info->finfo, i);
+    GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink,
+        "Converting to the panel format while writing");
+  }
+  return TRUE;
+}
+
+/* Convert a scanline of packed 24/32bpp RGB to the 15/16bpp panel format
+   described by the fbdev color bitfields. */
+
+static void
+gst_fbdevframebuffersink_convert_line (
+    GstFbdevFramebufferSink *fbdevframebuffersink, const uint8_t *src,
+    uint16_t *dest, int width)
+{
+  struct fb_var_screeninfo *varinfo = &fbdevframebuffersink->varinfo;
+  int pstride = fbdevframebuffersink->deferred_io_src_pstride;
+  int r_offset = fbdevframebuffersink->deferred_io_src_offset[0];
+  int g_offset = fbdevframebuffersink->deferred_io_src_offset[1];
+  int b_offset = fbdevframebuffersink->deferred_io_src_offset[2];
+  int r_shift = 8 - varinfo->red.length;
+  int g_shift = 8 - varinfo->green.length;
+  int b_shift = 8 - varinfo->blue.length;
+  int x;
+
+  for (x = 0; x < width; x++) {
+    dest[x] = ((src[r_offset] >> r_shift) << varinfo->red.offset) |
+        ((src[g_offset] >> g_shift) << varinfo->green.offset) |
+        ((src[b_offset] >> b_shift) << varinfo->blue.offset);
+    src += pstride;
+  }
+}
+
+/* Return the part of the shadow copy of the screen that corresponds to the
+   screen memory mapped at data, or NULL when it is not the screen that is
+   shadowed (for example a frame cache entry). The screen allocation starts
+   at the beginning of the mapping, so the shadow copy uses the same
+   layout. */
+
+static uint8_t *
+gst_fbdevframebuffersink_get_deferred_io_shadow (
+    GstFbdevFramebufferSink *fbdevframebuffersink, uint8_t *data,
+    guintptr offset)
+{
+  if (data != fbdevframebuffersink->framebuffer)
+    return NULL;
+  return fbdevframebuffersink->deferred_io_shadow + offset;
+}
+
+/* Write a frame in the screen format on a deferred I/O device. The video
+   rectangle is divided into tiles of DEFERRED_IO_TILE_WIDTH by
+   DEFERRED_IO_TILE_HEIGHT pixels, and only tiles that differ from the
+   shadow copy of the screen are written to the mapping. */
+
+static void
+gst_fbdevframebuffersink_put_image (GstFramebufferSink *framebuffersink,
+    GstMemory *vmem, const guint8 *src, int src_stride)
+{
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
+  GstMapInfo mapinfo;
+  uint8_t *shadow;
+  guintptr offset;
+  int dest_stride;
+
+  mapinfo.data = NULL;
+  if (!gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE) ||
+      mapinfo.data == NULL) {
+    GST_ERROR_OBJECT (fbdevframebuffersink, "Could not map video memory");
+    return;
+  }
+  dest_stride = GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+  offset = framebuffersink->video_rectangle.y * dest_stride
+      + framebuffersink->video_rectangle.x * GST_VIDEO_INFO_COMP_PSTRIDE (
+      &framebuffersink->screen_info, 0);
+  shadow = gst_fbdevframebuffersink_get_deferred_io_shadow (
+      fbdevframebuffersink, mapinfo.data, offset);
+  fbdevframebuffersink->stats_deferred_io_tiles_written +=
+      gst_fbdev_deferred_io_write_tiles (mapinfo.data + offset, shadow,
+      dest_stride, src, src_stride,
+      framebuffersink->video_rectangle_width_in_bytes,
+      framebuffersink->video_rectangle.h,
+      DEFERRED_IO_TILE_WIDTH * GST_VIDEO_INFO_COMP_PSTRIDE (
+      &framebuffersink->screen_info, 0), DEFERRED_IO_TILE_HEIGHT,
+      !fbdevframebuffersink->deferred_io_shadow_valid,
+      &fbdevframebuffersink->stats_deferred_io_tiles_total);
+  if (shadow != NULL)
+    fbdevframebuffersink->deferred_io_shadow_valid = TRUE;
+  gst_memory_unmap (vmem, &mapinfo);
+}
+
+/* Write a frame in one of the deferred_io_converted_formats_table formats on
+   a deferred I/O device. A row of tiles at a time is converted to the panel
+   format and then written like put_image does. */
+
+static GstFlowReturn
+gst_fbdevframebuffersink_put_converted_image (
+    GstFramebufferSink *framebuffersink, GstBuffer *buffer, GstMemory *vmem)
+{
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
+  GstMapInfo mapinfo;
+  GstMapInfo vmapinfo;
+  uint8_t *src;
+  uint8_t *dest;
+  uint8_t *shadow;
+  uint8_t *band;
+  guintptr offset;
+  int src_stride;
+  int dest_stride;
+  int width_in_bytes;
+  int tile_width_in_bytes;
+  gboolean force;
+  int y;
+
+  if (!gst_buffer_map (buffer, &mapinfo, GST_MAP_READ)) {
+    GST_FBDEVFRAMEBUFFERSINK_MESSAGE_OBJECT (fbdevframebuffersink,
+        "memory_map of system memory buffer for reading failed");
+    return GST_FLOW_ERROR;
+  }
+  vmapinfo.data = NULL;
+  if (!gst_memory_map (vmem, &vmapinfo, GST_MAP_WRITE) ||
+      vmapinfo.data == NULL) {
+    GST_ERROR_OBJECT (fbdevframebuffersink, "Could not map video memory");
+    gst_buffer_unmap (buffer, &mapinfo);
+    return GST_FLOW_ERROR;
+  }
+
+  dest_stride = GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+  offset = framebuffersink->video_rectangle.y * dest_stride
+      + framebuffersink->video_rectangle.x * GST_VIDEO_INFO_COMP_PSTRIDE (
+      &framebuffersink->screen_info, 0);
+  dest = vmapinfo.data + offset;
+  shadow = gst_fbdevframebuffersink_get_deferred_io_shadow (
+      fbdevframebuffersink, vmapinfo.data, offset);
+  force = !fbdevframebuffersink->deferred_io_shadow_valid;
+  src = mapinfo.data;
+  src_stride = GST_VIDEO_INFO_PLANE_STRIDE (&framebuffersink->video_info, 0);
+  band = fbdevframebuffersink->deferred_io_band;
+  width_in_bytes = framebuffersink->video_rectangle_width_in_bytes;
+  tile_width_in_bytes = DEFERRED_IO_TILE_WIDTH * GST_VIDEO_INFO_COMP_PSTRIDE (
+      &framebuffersink->screen_info, 0);
+
+  for (y = 0; y < framebuffersink->video_rectangle.h;
+      y += DEFERRED_IO_TILE_HEIGHT) {
+    int h = MIN (DEFERRED_IO_TILE_HEIGHT,
+        framebuffersink->video_rectangle.h - y);
+    int i;
+
+    for (i = 0; i < h; i++)
+      gst_fbdevframebuffersink_convert_line (fbdevframebuffersink,
+          src + i * src_stride, (uint16_t *) (band + i * width_in_bytes),
+          framebuffersink->video_rectangle.w);
+    fbdevframebuffersink->stats_deferred_io_tiles_written +=
+        gst_fbdev_deferred_io_write_tiles (dest, shadow, dest_stride, band,
+        width_in_bytes, width_in_bytes, h, tile_width_in_bytes,
+        DEFERRED_IO_TILE_HEIGHT, force,
+        &fbdevframebuffersink->stats_deferred_io_tiles_total);
+    src += src_stride * h;
+    dest += dest_stride * h;
+    if (shadow != NULL)
+      shadow += dest_stride * h;
+  }
+  if (shadow != NULL)
+    fbdevframebuffersink->deferred_io_shadow_valid = TRUE;
+
+  gst_memory_unmap (vmem, &vmapinfo);
+  gst_buffer_unmap (buffer, &mapinfo);
+  return GST_FLOW_OK;
 }
 
 /* Initialize allocation params for the fbdev video memory allocator for either */
@@ -808,6 +1549,8 @@ gst_fbdevframebuffersink_video_memory_allocator_alloc (GstAllocator *allocator,
 
   GST_INFO ("Allocated video memory buffer of size %zd at %p, align %zd, "
       "mem = %p\n", size, mem->data, params->align, mem);
+  GST_FRAMEBUFFERSINK_TRACE (allocator, VIDEO_MEMORY_ALLOC,
+      video_memory_alloc, mem, size);
 
   return (GstMemory *) mem;
 }
@@ -855,6 +1598,8 @@ gst_fbdevframebuffersink_video_memory_allocator_free (GstAllocator * allocator,
           GST_LOCK_FLAG_EXCLUSIVE);
       GST_INFO ("Freed video memory buffer of size %zd at %p", mem->size,
           vmem->data);
+      GST_FRAMEBUFFERSINK_TRACE (allocator, VIDEO_MEMORY_FREE,
+          video_memory_free, mem, mem->size);
       g_slice_free (GstFbdevFramebufferSinkVideoMemory, vmem);
       return;
     }
@@ -910,3 +1655,70 @@ gst_fbdevframebuffersink_video_memory_allocator_new (GstFramebufferSink *
   return GST_ALLOCATOR_CAST (fbdevframebuffersink_video_memory_allocator);
 }
 
+/* Recalculate the screen parameters of the parent class after the video mode
+   has been changed while the device is open. Returns FALSE if the new mode
+   cannot be used with the current mapping. */
+static gboolean
+gst_fbdevframebuffersink_update_screen_info (
+    GstFbdevFramebufferSink *fbdevframebuffersink)
+{
+  GstFramebufferSink *framebuffersink =
+      GST_FRAMEBUFFERSINK (fbdevframebuffersink);
+  GstFbdevFramebufferSinkVideoMemoryAllocator *allocator;
+  GstVideoInfo info;
+  int max_framebuffers;
+
+  if (!gst_fbdevframebuffersink_get_screen_video_info (
+      &fbdevframebuffersink->varinfo, &info))
+    return FALSE;
+  /* The mapping is not changed, so the new screens have to fit in it. */
+  max_framebuffers = fbdevframebuffersink->framebuffer_map_size /
+      GST_VIDEO_INFO_SIZE (&info);
+  if (max_framebuffers > fbdevframebuffersink->varinfo.yres_virtual /
+      fbdevframebuffersink->varinfo.yres)
+    max_framebuffers = fbdevframebuffersink->varinfo.yres_virtual /
+        fbdevframebuffersink->varinfo.yres;
+  if (max_framebuffers < 1)
+    return FALSE;
+
+  GST_VIDEO_INFO_PAR_N (&info) = GST_VIDEO_INFO_PAR_N (
+      &framebuffersink->screen_info);
+  GST_VIDEO_INFO_PAR_D (&info) = GST_VIDEO_INFO_PAR_D (
+      &framebuffersink->screen_info);
+  framebuffersink->screen_info = info;
+  framebuffersink->refresh_period =
+      gst_fbdevframebuffersink_get_refresh_period (
+      &fbdevframebuffersink->varinfo);
+  framebuffersink->max_framebuffers = max_framebuffers;
+  framebuffersink->pannable_video_memory_size = max_framebuffers *
+      GST_VIDEO_INFO_SIZE (&info);
+
+  /* The screen alignment depends on the line length. */
+  allocator = (GstFbdevFramebufferSinkVideoMemoryAllocator *)
+      framebuffersink->screen_video_memory_allocator;
+  if (allocator != NULL)
+    gst_fbdevframebuffersink_allocation_params_init (fbdevframebuffersink,
+        &allocator->params, TRUE, FALSE);
+  return TRUE;
+}
+
+/* Calculate the duration of a display refresh from the mode timings, or
+   return 0 if the driver does not report them. */
+static GstClockTime
+gst_fbdevframebuffersink_get_refresh_period (struct fb_var_screeninfo *varinfo)
+{
+  guint64 htotal, vtotal;
+
+  if (varinfo->pixclock == 0)
+    return 0;
+  htotal = varinfo->xres + varinfo->left_margin + varinfo->right_margin +
+      varinfo->hsync_len;
+  vtotal = varinfo->yres + varinfo->upper_margin + varinfo->lower_margin +
+      varinfo->vsync_len;
+  if (varinfo->vmode & FB_VMODE_INTERLACED)
+    vtotal /= 2;
+  if (varinfo->vmode & FB_VMODE_DOUBLE)
+    vtotal *= 2;
+  /* The pixel clock period is in picoseconds. */
+  return htotal * vtotal * varinfo->pixclock / 1000;
+}
@@ -45,6 +45,8 @@ G_BEGIN_DECLS
      GstFbdevFramebufferSinkClass))
 
 typedef struct _GstFbdevFramebufferSink GstFbdevFramebufferSink;
+typedef struct _GstFbdevFramebufferSinkVsyncWaiter
+    GstFbdevFramebufferSinkVsyncWaiter;
 typedef struct _GstFbdevFramebufferSinkClass GstFbdevFramebufferSinkClass;
 
 struct _GstFbdevFramebufferSink
@@ -53,6 +55,9 @@ struct _GstFbdevFramebufferSink
 
   /* Properties. */
   gboolean use_graphics_mode;
+  gint deferred_io_property;
+  gint bits_per_pixel_property;
+  gboolean fit_video_mode;
 
   /* fbdev device parameters. */
   int fd;
@@ -61,6 +66,30 @@ struct _GstFbdevFramebufferSink
   struct fb_fix_screeninfo fixinfo;
   struct fb_var_screeninfo varinfo;
   int saved_kd_mode;
+  /* Video mode at the time the device was opened, restored on close if
+     the sink switched modes. */
+  struct fb_var_screeninfo saved_varinfo;
+  gboolean video_mode_changed;
+  /* Helper thread that performs FBIO_WAITFORVSYNC with a timeout. */
+  GstFbdevFramebufferSinkVsyncWaiter *vsync_waiter;
+  /* Memory panned to that is only latched at the next vblank (only used as
+     an id for tracing). */
+  GstMemory *pan_pending;
+
+  /* Deferred I/O (small SPI/I2C panel) mode. Frames are compared tile by
+     tile against a shadow copy of the screen in system memory and only
+     changed tiles are written, so that the kernel pushes as few pages as
+     possible. */
+  gboolean deferred_io;
+  uint8_t *deferred_io_shadow;
+  gboolean deferred_io_shadow_valid;
+  /* One row of tiles converted to the panel format. */
+  uint8_t *deferred_io_band;
+  /* Source pixel layout when converting to the screen format. */
+  int deferred_io_src_pstride;
+  int deferred_io_src_offset[3];
+  guint64 stats_deferred_io_tiles_written;
+  guint64 stats_deferred_io_tiles_total;
 };
 
 struct _GstFbdevFramebufferSinkClass
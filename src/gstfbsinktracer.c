@@ -0,0 +1,260 @@
+/* GStreamer fbsinkstages tracer
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+/**
+ * SECTION:tracer-fbsinkstages
+ *
+ * The fbsinkstages tracer records the display path stages of the
+ * framebuffer sinks (fbdev2sink, sunxifbsink and drmsink): mapping of the
+ * source buffer, the copy to video memory, vsync waits, page flips and
+ * video memory allocation. Copy, vsync wait and page flip latencies are
+ * collected in log2 histograms (in microseconds) per stage, and byte counts
+ * are accumulated per stage. The results are printed when the tracer is
+ * destroyed, normally at application exit.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * GST_TRACERS=fbsinkstages gst-launch-1.0 videotestsrc num-buffers=600 ! \
+ * fbdev2sink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <glib/gprintf.h>
+
+#include <gst/gst.h>
+#include "gstframebuffersinktrace.h"
+#include "gstfbsinktracer.h"
+
+#if GST_CHECK_VERSION(1, 8, 0)
+
+GST_DEBUG_CATEGORY_STATIC (gst_fbsink_tracer_debug_category);
+#define GST_CAT_DEFAULT gst_fbsink_tracer_debug_category
+
+#define HISTOGRAM_BUCKETS GST_FBSINK_TRACER_HISTOGRAM_BUCKETS
+#define TIMED_COPY GST_FBSINK_TRACER_TIMED_COPY
+#define TIMED_VSYNC_WAIT GST_FBSINK_TRACER_TIMED_VSYNC_WAIT
+#define TIMED_FLIP GST_FBSINK_TRACER_TIMED_FLIP
+#define TIMED_COUNT GST_FBSINK_TRACER_TIMED_COUNT
+
+static const char *timed_stage_name[TIMED_COUNT] = {
+  "copy", "vsync wait", "page flip"
+};
+
+static const char *stage_name[GST_FRAMEBUFFERSINK_STAGE_COUNT] = {
+  "map", "copy start", "copy end", "vsync wait start", "vsync wait end",
+  "flip issue", "flip complete", "video memory alloc", "video memory free"
+};
+
+typedef struct {
+  gint64 start_time[TIMED_COUNT];
+} GstFbsinkTracerPending;
+
+/* The sinks have a single global trace function. It is installed while at
+   least one fbsinkstages tracer exists and passes each event to all of
+   them, each recording into its own state. */
+static GMutex tracer_lock;
+static GList *tracer_list = NULL;
+
+G_DEFINE_TYPE (GstFbsinkTracer, gst_fbsink_tracer, GST_TYPE_TRACER);
+
+static int
+gst_fbsink_tracer_bucket (gint64 usec)
+{
+  int bucket = 0;
+  while (usec > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+    usec >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static void
+gst_fbsink_tracer_trace (gpointer sink, GstFramebufferSinkStage stage,
+    guint64 id, guint64 bytes)
+{
+  GstFbsinkTracer *tracer;
+  GstFbsinkTracerPending *pending;
+  GList *l;
+  gint64 now = g_get_monotonic_time ();
+  int timed = -1;
+  gboolean is_start = FALSE;
+
+  switch (stage) {
+    case GST_FRAMEBUFFERSINK_STAGE_COPY_START:
+      is_start = TRUE;
+      /* Fall through. */
+    case GST_FRAMEBUFFERSINK_STAGE_COPY_END:
+      timed = TIMED_COPY;
+      break;
+    case GST_FRAMEBUFFERSINK_STAGE_VSYNC_WAIT_START:
+      is_start = TRUE;
+      /* Fall through. */
+    case GST_FRAMEBUFFERSINK_STAGE_VSYNC_WAIT_END:
+      timed = TIMED_VSYNC_WAIT;
+      break;
+    case GST_FRAMEBUFFERSINK_STAGE_FLIP_ISSUE:
+      is_start = TRUE;
+      /* Fall through. */
+    case GST_FRAMEBUFFERSINK_STAGE_FLIP_COMPLETE:
+      timed = TIMED_FLIP;
+      break;
+    default:
+      break;
+  }
+
+  g_mutex_lock (&tracer_lock);
+  for (l = tracer_list; l != NULL; l = l->next) {
+    tracer = l->data;
+    tracer->count[stage]++;
+    tracer->bytes[stage] += bytes;
+    if (timed < 0)
+      continue;
+    pending = g_hash_table_lookup (tracer->pending, sink);
+    if (pending == NULL) {
+      pending = g_slice_new0 (GstFbsinkTracerPending);
+      g_hash_table_insert (tracer->pending, sink, pending);
+    }
+    if (is_start)
+      pending->start_time[timed] = now;
+    else if (pending->start_time[timed] != 0) {
+      tracer->histogram[timed][gst_fbsink_tracer_bucket (now -
+          pending->start_time[timed])]++;
+      pending->start_time[timed] = 0;
+    }
+  }
+  g_mutex_unlock (&tracer_lock);
+
+  GST_TRACE ("%p: %s, id = 0x%" G_GINT64_MODIFIER "x, bytes = %"
+      G_GUINT64_FORMAT, sink, stage_name[stage], id, bytes);
+}
+
+static void
+gst_fbsink_tracer_free_pending (gpointer data)
+{
+  g_slice_free (GstFbsinkTracerPending, data);
+}
+
+static void
+gst_fbsink_tracer_print (GstFbsinkTracer * tracer)
+{
+  int i, j;
+
+  g_print ("fbsinkstages: stage counts\n");
+  for (i = 0; i < GST_FRAMEBUFFERSINK_STAGE_COUNT; i++)
+    if (tracer->count[i] > 0)
+      g_print ("  %-20s %12" G_GUINT64_FORMAT " events %16" G_GUINT64_FORMAT
+          " bytes\n", stage_name[i], tracer->count[i], tracer->bytes[i]);
+  for (i = 0; i < TIMED_COUNT; i++) {
+    guint64 total = 0;
+    for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+      total += tracer->histogram[i][j];
+    if (total == 0)
+      continue;
+    g_print ("fbsinkstages: %s latency (usec)\n", timed_stage_name[i]);
+    for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+      if (tracer->histogram[i][j] > 0)
+        g_print ("  %10u - %10u %12" G_GUINT64_FORMAT "\n",
+            j == 0 ? 0 : 1u << j, (2u << j) - 1, tracer->histogram[i][j]);
+  }
+}
+
+static void
+gst_fbsink_tracer_finalize (GObject * object)
+{
+  GstFbsinkTracer *tracer = GST_FBSINK_TRACER (object);
+
+  g_mutex_lock (&tracer_lock);
+  tracer_list = g_list_remove (tracer_list, tracer);
+  if (tracer_list == NULL)
+    gst_framebuffersink_trace_func = NULL;
+  gst_fbsink_tracer_print (tracer);
+  g_hash_table_destroy (tracer->pending);
+  tracer->pending = NULL;
+  g_mutex_unlock (&tracer_lock);
+
+  G_OBJECT_CLASS (gst_fbsink_tracer_parent_class)->finalize (object);
+}
+
+static void
+gst_fbsink_tracer_class_init (GstFbsinkTracerClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_fbsink_tracer_debug_category, "fbsinkstages",
+      0, "framebuffer sink display path tracer");
+
+  gobject_class->finalize = gst_fbsink_tracer_finalize;
+}
+
+static void
+gst_fbsink_tracer_init (GstFbsinkTracer * tracer)
+{
+  memset (tracer->histogram, 0, sizeof (tracer->histogram));
+  memset (tracer->count, 0, sizeof (tracer->count));
+  memset (tracer->bytes, 0, sizeof (tracer->bytes));
+  tracer->pending = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, gst_fbsink_tracer_free_pending);
+
+  g_mutex_lock (&tracer_lock);
+  tracer_list = g_list_prepend (tracer_list, tracer);
+  gst_framebuffersink_trace_func = gst_fbsink_tracer_trace;
+  g_mutex_unlock (&tracer_lock);
+}
+
+#endif
+
+static gboolean
+plugin_init (GstPlugin * plugin)
+{
+#if GST_CHECK_VERSION(1, 8, 0)
+  return gst_tracer_register (plugin, "fbsinkstages", GST_TYPE_FBSINK_TRACER);
+#else
+  return TRUE;
+#endif
+}
+
+/* these are normally defined by the GStreamer build system.
+   If you are creating an element to be included in gst-plugins-*,
+   remove these, as they're always defined.  Otherwise, edit as
+   appropriate for your external plugin package. */
+#ifndef VERSION
+#define VERSION "0.1"
+#endif
+#ifndef PACKAGE
+#define PACKAGE "gstfbsinktracer"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "gstreamer1.0-fbdev2-plugins"
+#endif
+#ifndef GST_PACKAGE_ORIGIN
+#define GST_PACKAGE_ORIGIN "https://github.com/hglm"
+#endif
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    fbsinktracer,
+    "Display path tracer for the framebuffer sinks",
+    plugin_init, VERSION, "LGPL", PACKAGE_NAME, GST_PACKAGE_ORIGIN)
@@ -0,0 +1,77 @@
+/* GStreamer fbsinkstages tracer
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_FBSINK_TRACER_H_
+#define _GST_FBSINK_TRACER_H_
+
+#include <gst/gst.h>
+#include "gstframebuffersinktrace.h"
+
+G_BEGIN_DECLS
+
+#if GST_CHECK_VERSION(1, 8, 0)
+
+#define GST_TYPE_FBSINK_TRACER (gst_fbsink_tracer_get_type ())
+#define GST_FBSINK_TRACER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+    GST_TYPE_FBSINK_TRACER, GstFbsinkTracer))
+#define GST_FBSINK_TRACER_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), \
+    GST_TYPE_FBSINK_TRACER, GstFbsinkTracerClass))
+#define GST_IS_FBSINK_TRACER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+    GST_TYPE_FBSINK_TRACER))
+
+typedef struct _GstFbsinkTracer GstFbsinkTracer;
+typedef struct _GstFbsinkTracerClass GstFbsinkTracerClass;
+
+/* Number of log2 microsecond histogram buckets; the last bucket collects
+   everything from about eight seconds up. */
+#define GST_FBSINK_TRACER_HISTOGRAM_BUCKETS 24
+
+/* Stages with a start and an end that are timed. */
+enum {
+  GST_FBSINK_TRACER_TIMED_COPY,
+  GST_FBSINK_TRACER_TIMED_VSYNC_WAIT,
+  GST_FBSINK_TRACER_TIMED_FLIP,
+  GST_FBSINK_TRACER_TIMED_COUNT
+};
+
+struct _GstFbsinkTracer
+{
+  GstTracer parent;
+
+  /* Per sink start times of the timed stages, protected by the tracer
+     lock. */
+  GHashTable *pending;
+  guint64 histogram[GST_FBSINK_TRACER_TIMED_COUNT]
+      [GST_FBSINK_TRACER_HISTOGRAM_BUCKETS];
+  guint64 count[GST_FRAMEBUFFERSINK_STAGE_COUNT];
+  guint64 bytes[GST_FRAMEBUFFERSINK_STAGE_COUNT];
+};
+
+struct _GstFbsinkTracerClass
+{
+  GstTracerClass parent_class;
+};
+
+GType gst_fbsink_tracer_get_type (void);
+
+#endif
+
+G_END_DECLS
+
+#endif
@@ -54,6 +54,7 @@
 #endif
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <inttypes.h>
 #include <signal.h>
 #include <string.h>
@@ -63,9 +64,21 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <linux/perf_event.h>
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#endif
+#include <sched.h>
+#include <pthread.h>
 #include <glib/gprintf.h>
 
 #include <gst/gst.h>
@@ -74,13 +87,24 @@
 #include <gst/video/video.h>
 #include <gst/video/video-info.h>
 #include <gst/video/gstvideometa.h>
+#include <gst/video/colorbalance.h>
 #include "gstframebuffersink.h"
+#include "gstframebuffersinktrace.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_framebuffersink_debug_category);
 #define GST_CAT_DEFAULT gst_framebuffersink_debug_category
 
 static GstVideoSinkClass *parent_class = NULL;
 
+/* Labels of the color balance channels. */
+static const gchar *gst_framebuffersink_color_balance_label[
+    GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS] = {
+  "BRIGHTNESS", "CONTRAST", "SATURATION", "HUE"
+};
+
+/* Stage trace function, installed by the fbsinkstages tracer. */
+GstFramebufferSinkTraceFunc gst_framebuffersink_trace_func = NULL;
+
 /* Definitions to influence buffer pool allocation.
   Provide another video memory pool for repeated requests. */
 #define MULTIPLE_VIDEO_MEMORY_POOLS
@@ -89,6 +113,46 @@ static GstVideoSinkClass *parent_class = NULL;
 
 #define INCLUDE_PRESERVE_PAR_PROPERTY
 
+/* Parameters for the adaptive number of screen/overlay buffers. The depth is
+   re-evaluated every ADAPTIVE_WINDOW_FRAMES frames; it grows when more than
+   one in ADAPTIVE_PRESSURE_RATIO frames was late or arrived in a burst, and
+   shrinks after ADAPTIVE_STEADY_WINDOWS windows without any. */
+#define ADAPTIVE_WINDOW_FRAMES 60
+#define ADAPTIVE_PRESSURE_RATIO 10
+#define ADAPTIVE_STEADY_WINDOWS 4
+#define ADAPTIVE_MIN_DEPTH 2
+
+/* Parameters for the adaptive source resolution. The resolution is stepped
+   down when more than one in five frames in a window was late or dropped,
+   and stepped up after RESOLUTION_HEADROOM_WINDOWS windows in which nearly
+   all frames were shown well ahead of time. */
+#define RESOLUTION_WINDOW_FRAMES 30
+#define RESOLUTION_SETTLE_WINDOWS 2
+#define RESOLUTION_HEADROOM_WINDOWS 6
+
+/* Parameters for the presentation watchdog. A vsync wait or page flip that
+   takes longer than WATCHDOG_TIMEOUT_PERIODS refresh periods is a stall.
+   After WATCHDOG_STALL_LIMIT consecutive stalls frames are paced in software
+   instead, and the hardware is retried every WATCHDOG_PROBE_INTERVAL
+   frames. */
+#define WATCHDOG_TIMEOUT_PERIODS 4
+#define WATCHDOG_STALL_LIMIT 2
+#define WATCHDOG_PROBE_INTERVAL 60
+#define WATCHDOG_DEFAULT_REFRESH_PERIOD (GST_SECOND / 60)
+#define WATCHDOG_MIN_TIMEOUT (20 * GST_MSECOND)
+
+/* A sink in a presentation group waits at most GROUP_TIMEOUT_PERIODS refresh
+   periods for the other members before presenting on its own. */
+#define GROUP_TIMEOUT_PERIODS 2
+
+/* The frame cache never reuses its FRAME_CACHE_RESERVED most recently shown
+   entries, which may still be on screen or waiting for a flip. */
+#define FRAME_CACHE_RESERVED 2
+
+/* Maximum number of source frames in the video memory pool offered to
+   upstream when converted frames are read from video memory. */
+#define CONVERTED_POOL_BUFFERS 3
+
 /* Function to produce informational output if silent property is not set;
    if the silent property is set only debugging info is produced. */
 static void
@@ -107,6 +171,7 @@ const gchar *message) {
     offset = ALIGNMENT_GET_ALIGNED(offset, align);
 
 /* Class function prototypes. */
+static void gst_framebuffersink_finalize (GObject * object);
 static void gst_framebuffersink_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_framebuffersink_get_property (GObject * object,
@@ -123,6 +188,10 @@ static GstFlowReturn gst_framebuffersink_show_frame (GstVideoSink * vsink,
     GstBuffer * buf);
 static gboolean gst_framebuffersink_propose_allocation (GstBaseSink * sink,
     GstQuery * query);
+static GstFlowReturn gst_framebuffersink_prepare (GstBaseSink * sink,
+    GstBuffer * buf);
+static gboolean gst_framebuffersink_unlock (GstBaseSink * sink);
+static gboolean gst_framebuffersink_unlock_stop (GstBaseSink * sink);
 
 /* Defaults for virtual functions defined in this class. */
 static GstVideoFormat *gst_framebuffersink_get_supported_overlay_formats (
@@ -140,7 +209,43 @@ static void gst_framebuffersink_pan_display (GstFramebufferSink *
 static void gst_framebuffersink_wait_for_vsync (GstFramebufferSink *
     framebuffersink);
 
+/* Presentation watchdog. */
+static void gst_framebuffersink_watched_wait_for_vsync (GstFramebufferSink *
+    framebuffersink);
+static void gst_framebuffersink_watched_pan_display (GstFramebufferSink *
+    framebuffersink, GstMemory *memory);
+
+/* Presentation groups. */
+static void gst_framebuffersink_group_join (GstFramebufferSink *
+    framebuffersink);
+static void gst_framebuffersink_group_leave (GstFramebufferSink *
+    framebuffersink);
+static gboolean gst_framebuffersink_group_sync (GstFramebufferSink *
+    framebuffersink);
+
+/* Color balance. */
+static void gst_framebuffersink_color_balance_init (
+    GstColorBalanceInterface *iface);
+static void gst_framebuffersink_apply_color_balance (
+    GstFramebufferSink *framebuffersink);
+
+/* Streaming thread scheduling. */
+static void gst_framebuffersink_restore_scheduling (
+    GstFramebufferSink *framebuffersink, gboolean forget);
+
+/* Copy performance counters. */
+static GstStructure *gst_framebuffersink_get_perf_stats (
+    GstFramebufferSink *framebuffersink);
+
 /* Video memory. */
+static void gst_framebuffersink_free_buffers (GstFramebufferSink *
+    framebuffersink);
+static gboolean gst_framebuffersink_frame_cache_shrink (
+    GstFramebufferSink *framebuffersink);
+static void gst_framebuffersink_release_retired_memory (
+    GstFramebufferSink *framebuffersink);
+static void gst_framebuffersink_retire_presented_memory (
+    GstFramebufferSink *framebuffersink);
 static gboolean gst_framebuffersink_is_video_memory (GstFramebufferSink *
     framebuffersink, GstMemory *mem);
 
@@ -171,6 +276,21 @@ enum
   PROP_MAX_VIDEO_MEMORY_USED,
   PROP_OVERLAY_FORMAT,
   PROP_BENCHMARK,
+  PROP_ADAPTIVE_BUFFERS,
+  PROP_ADAPTIVE_RESOLUTION,
+  PROP_SCHEDULING_POLICY,
+  PROP_SCHEDULING_PRIORITY,
+  PROP_CPU_AFFINITY,
+  PROP_GROUP_NAME,
+  PROP_CHECKSUM,
+  PROP_CHECKSUM_LOCATION,
+  PROP_THUMBNAIL_SCALE,
+  PROP_LAST_THUMBNAIL,
+  PROP_SHARED_RING,
+  PROP_SHARED_RING_FD,
+  PROP_PERF_COUNTERS,
+  PROP_PERF_STATS,
+  PROP_FRAME_CACHE,
 };
 
 /* pad templates */
@@ -211,6 +331,7 @@ gst_framebuffersink_class_init (GstFramebufferSinkClass* klass)
 
   gobject_class->set_property = gst_framebuffersink_set_property;
   gobject_class->get_property = gst_framebuffersink_get_property;
+  gobject_class->finalize = gst_framebuffersink_finalize;
 
   /* define properties */
   g_object_class_install_property (gobject_class, PROP_SILENT,
@@ -322,6 +443,93 @@ gst_framebuffersink_class_init (GstFramebufferSinkClass* klass)
     g_param_spec_boolean ("benchmark", "Benchmark video memory",
     "Perform video memory benchmarks at start-up",
     FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_BUFFERS,
+    g_param_spec_boolean ("adaptive-buffers", "Adaptive buffer count",
+    "When not using a buffer pool, adapt the number of page-flip screens or "
+    "overlays in video memory to the observed late frames and upstream "
+    "burstiness, within the video memory limits. Unused buffers are returned "
+    "to the allocator.",
+    FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_RESOLUTION,
+    g_param_spec_boolean ("adaptive-resolution", "Adaptive source resolution",
+    "When the hardware overlay scales the video to the requested output size "
+    "(full-screen or video-width/height), ask upstream for a lower source "
+    "resolution while frames are late or dropped, and step back up when "
+    "there is headroom again.",
+    FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SCHEDULING_POLICY,
+    g_param_spec_string ("scheduling-policy", "Scheduling policy",
+    "Scheduling policy for the streaming thread that shows frames: \"fifo\" "
+    "(SCHED_FIFO) or \"rr\" (SCHED_RR) real-time scheduling; by default the "
+    "scheduling is not changed. Requires CAP_SYS_NICE or a suitable "
+    "RLIMIT_RTPRIO; normal scheduling is kept otherwise.",
+    NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SCHEDULING_PRIORITY,
+    g_param_spec_int ("scheduling-priority", "Real-time scheduling priority",
+    "Real-time priority used with the fifo and rr scheduling policies",
+    1, 99, 50, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CPU_AFFINITY,
+    g_param_spec_int ("cpu-affinity", "CPU affinity mask",
+    "Bit mask of the CPUs the streaming thread that shows frames may run on; "
+    "0 (the default) leaves the affinity unchanged",
+    0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_GROUP_NAME,
+    g_param_spec_string ("group-name", "Presentation group name",
+    "Sinks in the same process with the same group name present frames "
+    "together: each waits for the others before flipping, so that frames "
+    "with the same running time appear on the same vblank",
+    NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHECKSUM,
+    g_param_spec_boolean ("checksum", "Frame checksums",
+    "Compute a 64-bit checksum of every frame copied from system memory and "
+    "post it with the PTS and target buffer index as a "
+    "\"framebuffersink-checksum\" element message",
+    FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHECKSUM_LOCATION,
+    g_param_spec_string ("checksum-location", "Checksum file",
+    "When checksum is enabled, write one line per frame with the PTS, target "
+    "buffer index and checksum to this file instead of posting messages",
+    NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THUMBNAIL_SCALE,
+    g_param_spec_int ("thumbnail-scale", "Thumbnail scale",
+    "When non-zero, produce a monitoring thumbnail of 1/thumbnail-scale the "
+    "video size in system memory while frames are copied (not for frames "
+    "rendered directly into video memory or shown as hardware overlay)",
+    0, 64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LAST_THUMBNAIL,
+    g_param_spec_boxed ("last-thumbnail", "Last thumbnail",
+    "Thumbnail of the last frame shown, see thumbnail-scale. Unlike "
+    "last-sample this never refers to video memory",
+    GST_TYPE_SAMPLE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SHARED_RING,
+    g_param_spec_boolean ("shared-ring", "Shared frame ring",
+    "Publish every frame copied from system memory into a shared memory ring "
+    "that other processes can map (see shared-ring-fd)",
+    FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SHARED_RING_FD,
+    g_param_spec_int ("shared-ring-fd", "Shared frame ring file descriptor",
+    "File descriptor of the shared frame ring memfd, which other processes "
+    "can open as /proc/<pid>/fd/<fd>, or -1",
+    - 1, G_MAXINT, - 1, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PERF_COUNTERS,
+    g_param_spec_boolean ("perf-counters", "Copy performance counters",
+    "Sample hardware performance counters (cycles, instructions, cache "
+    "misses, dTLB misses) and the time taken around the copy of each frame "
+    "from system memory; only the time is measured when the counters are "
+    "unavailable",
+    FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PERF_STATS,
+    g_param_spec_boxed ("perf-stats", "Copy performance statistics",
+    "Aggregate and last-frame copy time and performance counter values "
+    "collected with perf-counters",
+    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FRAME_CACHE,
+    g_param_spec_int ("frame-cache", "Frame cache",
+    "Keep up to this many frames copied from system memory in otherwise "
+    "unused video memory, and show a frame that repeats (recognized by a hash "
+    "of the source, or by its memory for a still that is pushed again) by "
+    "flipping to the cached copy; 0 (the default) disables the cache",
+    0, 256, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   element_class->change_state = GST_DEBUG_FUNCPTR (
       gst_framebuffersink_change_state);
@@ -331,6 +539,10 @@ gst_framebuffersink_class_init (GstFramebufferSinkClass* klass)
   base_sink_class->set_caps = GST_DEBUG_FUNCPTR (gst_framebuffersink_set_caps);
   base_sink_class->propose_allocation = GST_DEBUG_FUNCPTR (
       gst_framebuffersink_propose_allocation);
+  base_sink_class->prepare = GST_DEBUG_FUNCPTR (gst_framebuffersink_prepare);
+  base_sink_class->unlock = GST_DEBUG_FUNCPTR (gst_framebuffersink_unlock);
+  base_sink_class->unlock_stop = GST_DEBUG_FUNCPTR (
+      gst_framebuffersink_unlock_stop);
   video_sink_class->show_frame = GST_DEBUG_FUNCPTR (
       gst_framebuffersink_show_frame);
   klass->open_hardware = GST_DEBUG_FUNCPTR (
@@ -357,12 +569,21 @@ gst_framebuffersink_base_init (gpointer g_class)
 
 static void
 gst_framebuffersink_init (GstFramebufferSink *framebuffersink) {
+  int i;
+
   framebuffersink->pool = NULL;
   framebuffersink->caps = NULL;
   /* This will set the format to GST_VIDEO_FORMAT_UNKNOWN. */
   gst_video_info_init (&framebuffersink->screen_info);
   gst_video_info_init (&framebuffersink->video_info);
 
+  framebuffersink->unlocked = FALSE;
+  /* Without it, waits can't be interrupted but still time out. */
+  framebuffersink->wakeup_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (framebuffersink->wakeup_fd < 0)
+    GST_WARNING_OBJECT (framebuffersink, "Could not create eventfd: %s",
+        strerror (errno));
+
   /* Set the pixel aspect ratio of the display device to 1:1. */
   GST_VIDEO_INFO_PAR_N (&framebuffersink->screen_info) = 1;
   GST_VIDEO_INFO_PAR_D (&framebuffersink->screen_info) = 1;
@@ -393,6 +614,54 @@ gst_framebuffersink_init (GstFramebufferSink *framebuffersink) {
   framebuffersink->max_video_memory_property = 0;
   framebuffersink->preferred_overlay_format_str = NULL;
   framebuffersink->benchmark = FALSE;
+  framebuffersink->adaptive_buffers = FALSE;
+  framebuffersink->adaptive_resolution = FALSE;
+  framebuffersink->scheduling_policy_str = NULL;
+  framebuffersink->scheduling_priority = 50;
+  framebuffersink->cpu_affinity = 0;
+  framebuffersink->saved_scheduling = NULL;
+  framebuffersink->group_name = NULL;
+  framebuffersink->group = NULL;
+  framebuffersink->checksum_enabled = FALSE;
+  framebuffersink->checksum_location = NULL;
+  framebuffersink->checksum_file = NULL;
+  framebuffersink->thumbnail_scale = 0;
+  framebuffersink->shared_ring_enabled = FALSE;
+  framebuffersink->shared_ring = NULL;
+  framebuffersink->shared_ring_fd = - 1;
+  framebuffersink->perf_counters = FALSE;
+  framebuffersink->frame_cache_size = 0;
+  g_queue_init (&framebuffersink->frame_cache);
+  framebuffersink->frame_cache_source = NULL;
+  framebuffersink->frame_cache_shown = FALSE;
+  framebuffersink->perf_thread = NULL;
+  framebuffersink->perf_group_size = 0;
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++)
+    framebuffersink->perf_fd[i] = - 1;
+  framebuffersink->color_balance_channels = NULL;
+  for (i = 0; i < GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS; i++) {
+    GstColorBalanceChannel *channel = g_object_new (
+        GST_TYPE_COLOR_BALANCE_CHANNEL, NULL);
+    channel->label = g_strdup (gst_framebuffersink_color_balance_label[i]);
+    channel->min_value = GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN;
+    channel->max_value = GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX;
+    framebuffersink->color_balance_channels = g_list_append (
+        framebuffersink->color_balance_channels, channel);
+    framebuffersink->color_balance[i] = 0;
+  }
+  framebuffersink->color_balance_changed = FALSE;
+  framebuffersink->color_balance_software = FALSE;
+  framebuffersink->color_balance_frame = NULL;
+  framebuffersink->color_balance_frame_size = 0;
+  framebuffersink->thumbnail_sample = NULL;
+  framebuffersink->thumbnail_caps = NULL;
+  framebuffersink->thumbnail_buffer = NULL;
+  framebuffersink->thumbnail_ring_index = 0;
+  memset (framebuffersink->thumbnail_ring, 0,
+      sizeof (framebuffersink->thumbnail_ring));
+  framebuffersink->resolution_step = 0;
+  framebuffersink->resolution_width = 0;
+  framebuffersink->resolution_height = 0;
 }
 
 /* Default implementation of hardware open/close functions. */
@@ -458,6 +727,19 @@ gst_framebuffersink_video_format_supported_by_overlay (GstFramebufferSink *
   return FALSE;
 }
 
+static gboolean
+gst_framebuffersink_video_format_converted (GstFramebufferSink *
+    framebuffersink, GstVideoFormat format)
+{
+  GstVideoFormat *f = framebuffersink->converted_formats_supported;
+  while (*f != GST_VIDEO_FORMAT_UNKNOWN) {
+    if (*f == format)
+      return TRUE;
+    f++;
+  }
+  return FALSE;
+}
+
 static int
 gst_framebuffersink_get_overlay_format_rank (GstFramebufferSink *
     framebuffersink, GstVideoFormat format)
@@ -473,6 +755,20 @@ gst_framebuffersink_get_overlay_format_rank (GstFramebufferSink *
   return G_MAXINT;
 }
 
+static void
+gst_framebuffersink_finalize (GObject * object)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (object);
+
+  g_list_free_full (framebuffersink->color_balance_channels, g_object_unref);
+  framebuffersink->color_balance_channels = NULL;
+
+  if (framebuffersink->wakeup_fd >= 0)
+    close (framebuffersink->wakeup_fd);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 gst_framebuffersink_set_property (GObject * object, guint property_id,
     const GValue * value, GParamSpec * pspec)
@@ -518,14 +814,19 @@ gst_framebuffersink_set_property (GObject * object, guint property_id,
       break;
     case PROP_BUFFER_POOL:
       framebuffersink->use_buffer_pool_property = g_value_get_boolean (value);
+      /* Applied between frames while streaming. */
+      framebuffersink->live_properties_changed = TRUE;
       break;
     case PROP_VSYNC:
       framebuffersink->vsync_property = g_value_get_boolean (value);
+      framebuffersink->live_properties_changed = TRUE;
       break;
     case PROP_FLIP_BUFFERS:
       framebuffersink->flip_buffers = g_value_get_int (value);
+      framebuffersink->live_properties_changed = TRUE;
       break;
     case PROP_PAN_DOES_VSYNC:
+      /* Checked for every frame, so it takes effect immediately. */
       framebuffersink->pan_does_vsync = g_value_get_boolean (value);
       break;
     case PROP_USE_HARDWARE_OVERLAY:
@@ -533,6 +834,7 @@ gst_framebuffersink_set_property (GObject * object, guint property_id,
       break;
     case PROP_MAX_VIDEO_MEMORY_USED:
       framebuffersink->max_video_memory_property = g_value_get_int (value);
+      framebuffersink->live_properties_changed = TRUE;
       break;
     case PROP_OVERLAY_FORMAT:
       if (framebuffersink->preferred_overlay_format_str != NULL)
@@ -543,6 +845,56 @@ gst_framebuffersink_set_property (GObject * object, guint property_id,
     case PROP_BENCHMARK:
       framebuffersink->benchmark = g_value_get_boolean (value);
       break;
+    case PROP_ADAPTIVE_BUFFERS:
+      framebuffersink->adaptive_buffers = g_value_get_boolean (value);
+      break;
+    case PROP_ADAPTIVE_RESOLUTION:
+      framebuffersink->adaptive_resolution = g_value_get_boolean (value);
+      break;
+    case PROP_SCHEDULING_POLICY:
+      if (framebuffersink->scheduling_policy_str != NULL)
+        g_free (framebuffersink->scheduling_policy_str);
+      framebuffersink->scheduling_policy_str = g_value_dup_string (value);
+      /* Reapply on the next frame. */
+      framebuffersink->scheduled_thread = NULL;
+      break;
+    case PROP_SCHEDULING_PRIORITY:
+      framebuffersink->scheduling_priority = g_value_get_int (value);
+      framebuffersink->scheduled_thread = NULL;
+      break;
+    case PROP_CPU_AFFINITY:
+      framebuffersink->cpu_affinity = g_value_get_int (value);
+      framebuffersink->scheduled_thread = NULL;
+      break;
+    case PROP_GROUP_NAME:
+      /* Takes effect the next time the sink is started. */
+      if (framebuffersink->group_name != NULL)
+        g_free (framebuffersink->group_name);
+      framebuffersink->group_name = g_value_dup_string (value);
+      break;
+    case PROP_CHECKSUM:
+      framebuffersink->checksum_enabled = g_value_get_boolean (value);
+      break;
+    case PROP_CHECKSUM_LOCATION:
+      /* Takes effect the next time the sink is started. */
+      if (framebuffersink->checksum_location != NULL)
+        g_free (framebuffersink->checksum_location);
+      framebuffersink->checksum_location = g_value_dup_string (value);
+      break;
+    case PROP_THUMBNAIL_SCALE:
+      framebuffersink->thumbnail_scale = g_value_get_int (value);
+      break;
+    case PROP_SHARED_RING:
+      /* Takes effect the next time the sink is started. */
+      framebuffersink->shared_ring_enabled = g_value_get_boolean (value);
+      break;
+    case PROP_PERF_COUNTERS:
+      framebuffersink->perf_counters = g_value_get_boolean (value);
+      break;
+    case PROP_FRAME_CACHE:
+      /* A smaller size is applied before the next frame. */
+      framebuffersink->frame_cache_size = g_value_get_int (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -629,6 +981,54 @@ gst_framebuffersink_get_property (GObject * object, guint property_id,
     case PROP_BENCHMARK:
       g_value_set_boolean (value, framebuffersink->benchmark);
       break;
+    case PROP_ADAPTIVE_BUFFERS:
+      g_value_set_boolean (value, framebuffersink->adaptive_buffers);
+      break;
+    case PROP_ADAPTIVE_RESOLUTION:
+      g_value_set_boolean (value, framebuffersink->adaptive_resolution);
+      break;
+    case PROP_SCHEDULING_POLICY:
+      g_value_set_string (value, framebuffersink->scheduling_policy_str);
+      break;
+    case PROP_SCHEDULING_PRIORITY:
+      g_value_set_int (value, framebuffersink->scheduling_priority);
+      break;
+    case PROP_CPU_AFFINITY:
+      g_value_set_int (value, framebuffersink->cpu_affinity);
+      break;
+    case PROP_GROUP_NAME:
+      g_value_set_string (value, framebuffersink->group_name);
+      break;
+    case PROP_CHECKSUM:
+      g_value_set_boolean (value, framebuffersink->checksum_enabled);
+      break;
+    case PROP_CHECKSUM_LOCATION:
+      g_value_set_string (value, framebuffersink->checksum_location);
+      break;
+    case PROP_THUMBNAIL_SCALE:
+      g_value_set_int (value, framebuffersink->thumbnail_scale);
+      break;
+    case PROP_SHARED_RING:
+      g_value_set_boolean (value, framebuffersink->shared_ring_enabled);
+      break;
+    case PROP_SHARED_RING_FD:
+      g_value_set_int (value, framebuffersink->shared_ring_fd);
+      break;
+    case PROP_LAST_THUMBNAIL:
+      GST_OBJECT_LOCK (framebuffersink);
+      g_value_set_boxed (value, framebuffersink->thumbnail_sample);
+      GST_OBJECT_UNLOCK (framebuffersink);
+      break;
+    case PROP_PERF_COUNTERS:
+      g_value_set_boolean (value, framebuffersink->perf_counters);
+      break;
+    case PROP_PERF_STATS:
+      g_value_take_boxed (value, gst_framebuffersink_get_perf_stats (
+          framebuffersink));
+      break;
+    case PROP_FRAME_CACHE:
+      g_value_set_int (value, framebuffersink->frame_cache_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -636,208 +1036,1682 @@ gst_framebuffersink_get_property (GObject * object, guint property_id,
 }
 
 static void
-gst_framebuffersink_clear_screen (GstFramebufferSink *framebuffersink,
-    int index)
+gst_framebuffersink_clear_memory (GstFramebufferSink *framebuffersink,
+    GstMemory *vmem)
 {
   GstMapInfo mapinfo;
   gboolean res;
 
   mapinfo.data = NULL;
-  res = gst_memory_map (framebuffersink->screens[index], &mapinfo, GST_MAP_WRITE);
+  res = gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE);
   if (!res || mapinfo.data == NULL) {
     GST_ERROR_OBJECT (framebuffersink, "Could not map video memory");
     if (res)
-      gst_memory_unmap (framebuffersink->screens[index], &mapinfo);
+      gst_memory_unmap (vmem, &mapinfo);
     return;
   }
   memset (mapinfo.data, 0, mapinfo.size);
-  gst_memory_unmap (framebuffersink->screens[index], &mapinfo);
+  gst_memory_unmap (vmem, &mapinfo);
 }
 
 static void
-gst_framebuffersink_put_image_memcpy (GstFramebufferSink *framebuffersink,
-    uint8_t *src)
+gst_framebuffersink_clear_screen (GstFramebufferSink *framebuffersink,
+    int index)
 {
-  guint8 *dest;
-  guintptr dest_stride;
-  int i;
-  GstMapInfo mapinfo;
-  gboolean res;
+  gst_framebuffersink_clear_memory (framebuffersink,
+      framebuffersink->screens[index]);
+}
 
-  mapinfo.data = NULL;
-  res = gst_memory_map (
-      framebuffersink->screens[framebuffersink->current_framebuffer_index],
-      &mapinfo, GST_MAP_WRITE);
-  if (!res || mapinfo.data == NULL) {
-    GST_ERROR_OBJECT (framebuffersink, "Could not map video memory");
-    if (res)
-      gst_memory_unmap (
-          framebuffersink->screens[framebuffersink->current_framebuffer_index],
-          &mapinfo);
-    return;
+/* Frame checksums. The checksum is a 64-bit hash built from the XXH64 round
+   function, computed over the visible bytes of each source row (so that
+   stride padding does not affect it) from system memory while the rows are
+   still in cache from the copy. Video memory is never read. Each row is
+   hashed with the hash of the previous row as seed. Four independent lanes
+   keep the multiplier pipelines busy. */
+
+#define CHECKSUM_PRIME1 G_GUINT64_CONSTANT (0x9E3779B185EBCA87)
+#define CHECKSUM_PRIME2 G_GUINT64_CONSTANT (0xC2B2AE3D27D4EB4F)
+#define CHECKSUM_PRIME3 G_GUINT64_CONSTANT (0x165667B19E3779F9)
+#define CHECKSUM_PRIME4 G_GUINT64_CONSTANT (0x85EBCA77C2B2AE63)
+#define CHECKSUM_PRIME5 G_GUINT64_CONSTANT (0x27D4EB2F165667C5)
+#define CHECKSUM_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Contiguous rows are copied in chunks of about CHECKSUM_CHUNK_SIZE bytes
+   and each chunk is hashed right after it is copied, while it is still in
+   the data cache. */
+#define CHECKSUM_CHUNK_SIZE (16 * 1024)
+
+static inline guint64
+gst_framebuffersink_checksum_round (guint64 acc, guint64 input)
+{
+  acc += input * CHECKSUM_PRIME2;
+  acc = CHECKSUM_ROTL (acc, 31);
+  return acc * CHECKSUM_PRIME1;
+}
+
+static guint64
+gst_framebuffersink_checksum_row (guint64 seed, const guint8 *p, gsize len)
+{
+  const guint8 *end = p + len;
+  guint64 v1, v2, v3, v4, h, w[4];
+
+  v1 = seed + CHECKSUM_PRIME1 + CHECKSUM_PRIME2;
+  v2 = seed + CHECKSUM_PRIME2;
+  v3 = seed;
+  v4 = seed - CHECKSUM_PRIME1;
+  while (end - p >= 32) {
+    memcpy (w, p, 32);
+    v1 = gst_framebuffersink_checksum_round (v1, w[0]);
+    v2 = gst_framebuffersink_checksum_round (v2, w[1]);
+    v3 = gst_framebuffersink_checksum_round (v3, w[2]);
+    v4 = gst_framebuffersink_checksum_round (v4, w[3]);
+    p += 32;
   }
-  dest = mapinfo.data;
-  dest += framebuffersink->video_rectangle.y * GST_VIDEO_INFO_COMP_STRIDE (
-      &framebuffersink->screen_info, 0)
-      + framebuffersink->video_rectangle.x * GST_VIDEO_INFO_COMP_PSTRIDE (
-      &framebuffersink->screen_info, 0);
-  dest_stride = GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
-  if (framebuffersink->video_rectangle_width_in_bytes == dest_stride)
-      memcpy (dest, src, dest_stride * framebuffersink->video_rectangle.h);
-  else
-    for (i = 0; i < framebuffersink->video_rectangle.h; i++) {
-      memcpy (dest, src, framebuffersink->video_rectangle_width_in_bytes);
-      src += framebuffersink->source_video_width_in_bytes[0];
-      dest += dest_stride;
-    }
-  gst_memory_unmap (
-      framebuffersink->screens[framebuffersink->current_framebuffer_index],
-      &mapinfo);
-  return;
+  h = CHECKSUM_ROTL (v1, 1) + CHECKSUM_ROTL (v2, 7) + CHECKSUM_ROTL (v3, 12) +
+      CHECKSUM_ROTL (v4, 18);
+  while (end - p >= 8) {
+    memcpy (w, p, 8);
+    h ^= gst_framebuffersink_checksum_round (0, w[0]);
+    h = CHECKSUM_ROTL (h, 27) * CHECKSUM_PRIME1 + CHECKSUM_PRIME4;
+    p += 8;
+  }
+  while (p < end) {
+    h ^= (*p) * CHECKSUM_PRIME5;
+    h = CHECKSUM_ROTL (h, 11) * CHECKSUM_PRIME1;
+    p++;
+  }
+  h += len;
+  h ^= h >> 33;
+  h *= CHECKSUM_PRIME2;
+  h ^= h >> 29;
+  h *= CHECKSUM_PRIME3;
+  h ^= h >> 32;
+  return h;
 }
 
+/* Add rows of source data to the checksum of the current frame. */
+
 static void
-gst_framebuffersink_put_overlay_image_memcpy(GstFramebufferSink *
-    framebuffersink, GstMemory *vmem, uint8_t *src)
+gst_framebuffersink_checksum_rows (GstFramebufferSink *framebuffersink,
+    const guint8 *src, int width_in_bytes, int stride, int rows, int index)
 {
-  GstFramebufferSinkClass *klass = GST_FRAMEBUFFERSINK_GET_CLASS (
-      framebuffersink);
-  uint8_t *framebuffer_address;
-  GstMapInfo mapinfo;
-  gboolean res;
+  int y;
 
-  mapinfo.data = NULL;
-  res = gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE);
-  if (!res || mapinfo.data == NULL) {
-    GST_ERROR_OBJECT (framebuffersink, "Could not map video memory");
-    if (res)
-      gst_memory_unmap (vmem, &mapinfo);
-    return;
+  for (y = 0; y < rows; y++) {
+    framebuffersink->checksum = gst_framebuffersink_checksum_row (
+        framebuffersink->checksum, src, width_in_bytes);
+    src += stride;
   }
-  framebuffer_address = mapinfo.data;
-  if (framebuffersink->overlay_alignment_is_native)
-    memcpy(framebuffer_address, src, framebuffersink->video_info.size);
-  else {
-    int i;
-    int n = GST_VIDEO_INFO_N_PLANES (&framebuffersink->video_info);
-    guintptr offset;
-    for (i = 0; i < n; i++) {
-      offset = framebuffersink->overlay_plane_offset[i];
-      if (GST_VIDEO_INFO_PLANE_STRIDE (&framebuffersink->video_info, i) ==
-          framebuffersink->overlay_scanline_stride[i])
-        memcpy(framebuffer_address + offset, src,
-            framebuffersink->overlay_scanline_stride[i]
-            * framebuffersink->videosink.height);
-      else {
-        int y;
-        for (y = 0; y < framebuffersink->videosink.height; y++) {
-          memcpy(framebuffer_address + offset +
-              framebuffersink->overlay_scanline_offset[i],
-              src, framebuffersink->source_video_width_in_bytes[i]);
-          offset += framebuffersink->overlay_scanline_stride[i];
-        }
-      }
-    }
-  }
-  gst_memory_unmap (vmem, &mapinfo);
-  klass->show_overlay (framebuffersink, vmem);
+  framebuffersink->checksum_buffer_index = index;
+  framebuffersink->checksum_valid = TRUE;
 }
 
+/* Copy rows that are contiguous in both source and destination (their
+   stride is the same), hashing width_in_bytes of every row after the chunk
+   it is in has been copied. */
+
 static void
-gst_framebuffersink_put_image_pan(GstFramebufferSink * framebuffersink,
-    GstMemory *memory)
+gst_framebuffersink_copy_rows_checksum (GstFramebufferSink *framebuffersink,
+    guint8 *dest, const guint8 *src, int width_in_bytes, int stride, int rows,
+    int index)
 {
-  GstFramebufferSinkClass *klass = GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
-  if (framebuffersink->vsync && !framebuffersink->pan_does_vsync)
-    klass->wait_for_vsync (framebuffersink);
-  klass->pan_display(framebuffersink, memory);
+  int chunk_rows;
+  int n;
+
+  chunk_rows = MAX (CHECKSUM_CHUNK_SIZE / stride, 1);
+  for (; rows > 0; rows -= n) {
+    n = MIN (rows, chunk_rows);
+    memcpy (dest, src, (gsize) stride * n);
+    gst_framebuffersink_checksum_rows (framebuffersink, src, width_in_bytes,
+        stride, n, index);
+    dest += (gsize) stride * n;
+    src += (gsize) stride * n;
+  }
 }
 
-/* Benchmark functionality. */
+/* Report the checksum of the frame that was just shown, to the checksum file
+   if checksum-location is set and as an element message otherwise. */
 
-static void clear_words (uint32_t *dest, gsize size) {
-  while (size >= 32) {
-    *dest = 0;
-    *(dest + 1) = 0;
-    *(dest + 2) = 0;
-    *(dest + 3) = 0;
-    *(dest + 4) = 0;
-    *(dest + 5) = 0;
-    size -= 32;
-    *(dest + 6) = 0;
-    *(dest + 7) = 0;
-    dest += 8;
-  }
-  while (size >= 4) {
-    *dest = 0;
-    size -= 4;
-    dest++;
+static void
+gst_framebuffersink_post_checksum (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buf);
+  GstStructure *structure;
+
+  if (framebuffersink->checksum_file != NULL) {
+    fprintf (framebuffersink->checksum_file, "%" G_GUINT64_FORMAT " %d "
+        "%016" G_GINT64_MODIFIER "x\n", pts,
+        framebuffersink->checksum_buffer_index, framebuffersink->checksum);
+    return;
   }
+  structure = gst_structure_new ("framebuffersink-checksum",
+      "pts", G_TYPE_UINT64, pts,
+      "buffer-index", G_TYPE_INT, framebuffersink->checksum_buffer_index,
+      "checksum", G_TYPE_UINT64, framebuffersink->checksum, NULL);
+  gst_element_post_message (GST_ELEMENT_CAST (framebuffersink),
+      gst_message_new_element (GST_OBJECT_CAST (framebuffersink), structure));
 }
 
-static void gst_framebuffersink_benchmark_clear_first_memset (
-GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
-    GstMemory *source_buffer)
+/* Monitoring thumbnail. While a frame is copied from system memory every
+   thumbnail_scale-th pixel of every thumbnail_scale-th source row is also
+   written into a small system-memory buffer, which is published as the
+   last-thumbnail sample when the frame is done. Buffers are taken from a
+   small ring and only reused when no reader holds on to them. */
+
+static void
+gst_framebuffersink_free_thumbnails (GstFramebufferSink *framebuffersink)
 {
-  GstMapInfo mapinfo;
-  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
-  memset (mapinfo.data, 0, mapinfo.size);
-  gst_memory_unmap (buffers[0], &mapinfo);
+  int i;
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_THUMBNAIL_RING_SIZE; i++)
+    if (framebuffersink->thumbnail_ring[i] != NULL) {
+      gst_buffer_unref (framebuffersink->thumbnail_ring[i]);
+      framebuffersink->thumbnail_ring[i] = NULL;
+    }
+  if (framebuffersink->thumbnail_caps != NULL) {
+    gst_caps_unref (framebuffersink->thumbnail_caps);
+    framebuffersink->thumbnail_caps = NULL;
+  }
+  GST_OBJECT_LOCK (framebuffersink);
+  if (framebuffersink->thumbnail_sample != NULL) {
+    gst_sample_unref (framebuffersink->thumbnail_sample);
+    framebuffersink->thumbnail_sample = NULL;
+  }
+  GST_OBJECT_UNLOCK (framebuffersink);
 }
 
-static void gst_framebuffersink_benchmark_clear_first_words (
-    GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
-    GstMemory *source_buffer)
+/* Shared frame ring. Presented frames are published into a memfd that other
+   processes can map through /proc/<pid>/fd/<shared-ring-fd>. The layout is
+   described in gstframebuffersink.h. Each slot is protected by a sequence
+   count that is odd while the slot is being written; consumers copy a slot
+   and check that the count did not change. The header sequence word is
+   incremented for every published frame and doubles as a futex that
+   consumers can wait on. */
+
+static int
+gst_framebuffersink_memfd_create (const char *name)
 {
-  GstMapInfo mapinfo;
-  uint32_t *dest;
-  int size  = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
-  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
-  dest = (uint32_t *)mapinfo.data;
-  clear_words (dest, size);
-  gst_memory_unmap (buffers[0], &mapinfo);
+#ifdef HAVE_MEMFD_CREATE
+  return memfd_create (name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#elif defined (SYS_memfd_create)
+  return syscall (SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+  errno = ENOSYS;
+  return - 1;
+#endif
 }
 
-/* Test write combining. */
-
-static void gst_framebuffersink_benchmark_clear_first_bytes (
-    GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
-    GstMemory *source_buffer)
+static gboolean
+gst_framebuffersink_shared_ring_open (GstFramebufferSink *framebuffersink)
 {
-  GstMapInfo mapinfo;
-  uint8_t *dest;
-  int size  = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
-  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
-  dest = mapinfo.data;
-  while (size >= 16) {
-    *dest = 0;
-    *(dest + 1) = 0;
-    *(dest + 2) = 0;
-    *(dest + 3) = 0;
-    *(dest + 4) = 0;
-    *(dest + 5) = 0;
-    *(dest + 6) = 0;
-    *(dest + 7) = 0;
-    *(dest + 8) = 0;
-    *(dest + 9) = 0;
-    *(dest + 10) = 0;
-    *(dest + 11) = 0;
-    *(dest + 12) = 0;
-    *(dest + 13) = 0;
-    size -= 16;
-    *(dest + 14) = 0;
-    *(dest + 15) = 0;
-    dest += 16;
+  GstFramebufferSinkSharedRingHeader *header;
+  gsize slot_size, size;
+  int fd;
+  gchar s[128];
+
+  /* A slot can hold a frame of up to the screen size. */
+  slot_size = GST_FRAMEBUFFERSINK_SHARED_RING_SLOT_DATA_OFFSET +
+      GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  slot_size = (slot_size + 4095) & ~ (gsize) 4095;
+  size = GST_FRAMEBUFFERSINK_SHARED_RING_HEADER_SIZE +
+      GST_FRAMEBUFFERSINK_SHARED_RING_SLOTS * slot_size;
+
+  fd = gst_framebuffersink_memfd_create ("framebuffersink-ring");
+  if (fd < 0)
+    goto error;
+  if (ftruncate (fd, size) < 0) {
+    close (fd);
+    goto error;
   }
-  while (size > 0) {
-    *dest = 0;
-    size--;
-    dest++;
+#ifdef F_ADD_SEALS
+  /* Consumers can rely on the size not changing. */
+  fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+  header = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    close (fd);
+    goto error;
   }
-  gst_memory_unmap (buffers[0], &mapinfo);
+
+  header->magic = GST_FRAMEBUFFERSINK_SHARED_RING_MAGIC;
+  header->version = GST_FRAMEBUFFERSINK_SHARED_RING_VERSION;
+  header->n_slots = GST_FRAMEBUFFERSINK_SHARED_RING_SLOTS;
+  header->slot_size = slot_size;
+  header->header_size = GST_FRAMEBUFFERSINK_SHARED_RING_HEADER_SIZE;
+  header->latest_slot = 0;
+  header->sequence = 0;
+
+  framebuffersink->shared_ring_fd = fd;
+  framebuffersink->shared_ring = header;
+  framebuffersink->shared_ring_size = size;
+  framebuffersink->shared_ring_slot = NULL;
+  framebuffersink->shared_ring_frames = 0;
+
+  sprintf (s, "Publishing frames in shared memory at /proc/%d/fd/%d",
+      (int) getpid (), fd);
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  return TRUE;
+
+error:
+  sprintf (s, "Could not create shared frame ring (%s)", strerror (errno));
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  return FALSE;
 }
 
-/* Test read access. */
+static void
+gst_framebuffersink_shared_ring_close (GstFramebufferSink *framebuffersink)
+{
+  if (framebuffersink->shared_ring == NULL)
+    return;
+  munmap (framebuffersink->shared_ring, framebuffersink->shared_ring_size);
+  close (framebuffersink->shared_ring_fd);
+  framebuffersink->shared_ring = NULL;
+  framebuffersink->shared_ring_fd = - 1;
+}
+
+/* Start writing the next slot. Returns a pointer to the slot data. */
+
+static guint8 *
+gst_framebuffersink_shared_ring_begin (GstFramebufferSink *framebuffersink,
+    GstBuffer *buffer)
+{
+  GstFramebufferSinkSharedRingHeader *header = framebuffersink->shared_ring;
+  GstFramebufferSinkSharedRingSlot *slot;
+  guint index;
+
+  index = (header->latest_slot + 1) % header->n_slots;
+  slot = (GstFramebufferSinkSharedRingSlot *) ((guint8 *) header +
+      header->header_size + index * header->slot_size);
+  /* Odd while being written. */
+  g_atomic_int_inc ((gint *) &slot->sequence);
+  slot->format = GST_VIDEO_INFO_FORMAT (&framebuffersink->screen_info);
+  slot->width = framebuffersink->video_rectangle.w;
+  slot->height = framebuffersink->video_rectangle.h;
+  slot->stride = framebuffersink->video_rectangle_width_in_bytes;
+  slot->pts = GST_BUFFER_PTS (buffer);
+  slot->frame_number = framebuffersink->shared_ring_frames;
+  framebuffersink->shared_ring_slot = slot;
+  framebuffersink->shared_ring_slot_index = index;
+  return (guint8 *) slot + GST_FRAMEBUFFERSINK_SHARED_RING_SLOT_DATA_OFFSET;
+}
+
+/* Publish the slot after the frame has been presented and wake up waiting
+   consumers. */
+
+static void
+gst_framebuffersink_shared_ring_commit (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkSharedRingHeader *header = framebuffersink->shared_ring;
+  GstFramebufferSinkSharedRingSlot *slot = framebuffersink->shared_ring_slot;
+
+  slot->vblank_time = g_get_monotonic_time () * 1000;
+  /* Even again: the slot is consistent. */
+  g_atomic_int_inc ((gint *) &slot->sequence);
+  g_atomic_int_set ((gint *) &header->latest_slot,
+      framebuffersink->shared_ring_slot_index);
+  g_atomic_int_inc ((gint *) &header->sequence);
+  syscall (SYS_futex, &header->sequence, FUTEX_WAKE, G_MAXINT, NULL, NULL, 0);
+  framebuffersink->shared_ring_slot = NULL;
+  framebuffersink->shared_ring_frames++;
+}
+
+/* Prepare the thumbnail buffer for the frame about to be copied, scaled down
+   by scale. Returns FALSE if no thumbnail is produced for it. */
+
+static gboolean
+gst_framebuffersink_thumbnail_begin (GstFramebufferSink *framebuffersink,
+    int scale)
+{
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT (
+      &framebuffersink->screen_info);
+  int width, height;
+  GstBuffer **buf;
+
+  width = (framebuffersink->video_rectangle.w + scale - 1) / scale;
+  height = (framebuffersink->video_rectangle.h + scale - 1) / scale;
+  if (width == 0 || height == 0)
+    return FALSE;
+
+  if (framebuffersink->thumbnail_caps == NULL ||
+      GST_VIDEO_INFO_WIDTH (&framebuffersink->thumbnail_info) != width ||
+      GST_VIDEO_INFO_HEIGHT (&framebuffersink->thumbnail_info) != height ||
+      GST_VIDEO_INFO_FORMAT (&framebuffersink->thumbnail_info) != format) {
+    gst_framebuffersink_free_thumbnails (framebuffersink);
+    gst_video_info_set_format (&framebuffersink->thumbnail_info, format,
+        width, height);
+    framebuffersink->thumbnail_caps = gst_video_info_to_caps (
+        &framebuffersink->thumbnail_info);
+  }
+
+  buf = &framebuffersink->thumbnail_ring[framebuffersink->thumbnail_ring_index];
+  framebuffersink->thumbnail_ring_index = (framebuffersink->thumbnail_ring_index
+      + 1) % GST_FRAMEBUFFERSINK_THUMBNAIL_RING_SIZE;
+  /* Replace the buffer if a reader still holds the previous thumbnail in
+     this slot. */
+  if (*buf != NULL && !gst_buffer_is_writable (*buf)) {
+    gst_buffer_unref (*buf);
+    *buf = NULL;
+  }
+  if (*buf == NULL)
+    *buf = gst_buffer_new_allocate (NULL,
+        GST_VIDEO_INFO_SIZE (&framebuffersink->thumbnail_info), NULL);
+  if (*buf == NULL)
+    return FALSE;
+  if (!gst_buffer_map (*buf, &framebuffersink->thumbnail_map, GST_MAP_WRITE))
+    return FALSE;
+  framebuffersink->thumbnail_buffer = *buf;
+  return TRUE;
+}
+
+/* Subsample source row y of the video rectangle into the thumbnail. */
+
+static inline void
+gst_framebuffersink_thumbnail_row (GstFramebufferSink *framebuffersink,
+    const guint8 *src, int y, int scale)
+{
+  int pstride = GST_VIDEO_INFO_COMP_PSTRIDE (&framebuffersink->screen_info, 0);
+  int width = GST_VIDEO_INFO_WIDTH (&framebuffersink->thumbnail_info);
+  guint8 *dest;
+  int x;
+
+  dest = framebuffersink->thumbnail_map.data + (y / scale) *
+      GST_VIDEO_INFO_PLANE_STRIDE (&framebuffersink->thumbnail_info, 0);
+  if (pstride == 4)
+    for (x = 0; x < width; x++)
+      ((guint32 *) dest)[x] = *(const guint32 *) (src + x * scale * 4);
+  else if (pstride == 2)
+    for (x = 0; x < width; x++)
+      ((guint16 *) dest)[x] = *(const guint16 *) (src + x * scale * 2);
+  else
+    for (x = 0; x < width; x++)
+      memcpy (dest + x * pstride, src + x * scale * pstride, pstride);
+}
+
+/* Publish the thumbnail as the last-thumbnail sample. */
+
+static void
+gst_framebuffersink_thumbnail_end (GstFramebufferSink *framebuffersink,
+    GstBuffer *buffer)
+{
+  GstBuffer *thumbnail = framebuffersink->thumbnail_buffer;
+  GstSample *sample;
+
+  gst_buffer_unmap (thumbnail, &framebuffersink->thumbnail_map);
+  framebuffersink->thumbnail_buffer = NULL;
+  GST_BUFFER_PTS (thumbnail) = GST_BUFFER_PTS (buffer);
+  GST_BUFFER_DURATION (thumbnail) = GST_BUFFER_DURATION (buffer);
+  sample = gst_sample_new (thumbnail, framebuffersink->thumbnail_caps, NULL,
+      NULL);
+
+  GST_OBJECT_LOCK (framebuffersink);
+  if (framebuffersink->thumbnail_sample != NULL)
+    gst_sample_unref (framebuffersink->thumbnail_sample);
+  framebuffersink->thumbnail_sample = sample;
+  GST_OBJECT_UNLOCK (framebuffersink);
+}
+
+/* Color balance. Subclasses program the channel values into the display
+   hardware through the set_color_balance virtual function. When that is not
+   possible, the values are applied to RGB frames while they are copied from
+   system memory: saturation and hue as a fixed-point color matrix, and
+   brightness and contrast as a lookup table, so that no extra pass over the
+   frame is needed. */
+
+/* The following member functions are exported for use by derived
+   subclasses. */
+void
+gst_framebuffersink_get_color_balance_matrix (const gint *value,
+    double matrix[3][3])
+{
+  /* Luma-preserving saturation and hue rotation matrices. */
+  static const double luma[3] = { 0.213, 0.715, 0.072 };
+  double saturation = 1.0 +
+      (double) value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_SATURATION] /
+      GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX;
+  double angle = (double) value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_HUE] /
+      GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX * G_PI;
+  double c = cos (angle);
+  double s = sin (angle);
+  double hue[3][3] = {
+    { 0.213 + c * 0.787 - s * 0.213, 0.715 - c * 0.715 - s * 0.715,
+      0.072 - c * 0.072 + s * 0.928 },
+    { 0.213 - c * 0.213 + s * 0.143, 0.715 + c * 0.285 + s * 0.140,
+      0.072 - c * 0.072 - s * 0.283 },
+    { 0.213 - c * 0.213 - s * 0.787, 0.715 - c * 0.715 + s * 0.715,
+      0.072 + c * 0.928 + s * 0.072 }
+  };
+  double sat[3][3];
+  int i, j, k;
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      sat[i][j] = luma[j] * (1.0 - saturation) + (i == j ? saturation : 0.0);
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++) {
+      matrix[i][j] = 0;
+      for (k = 0; k < 3; k++)
+        matrix[i][j] += hue[i][k] * sat[k][j];
+    }
+}
+
+double
+gst_framebuffersink_get_color_balance_level (const gint *value, double level)
+{
+  double contrast = 1.0 +
+      (double) value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_CONTRAST] /
+      GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX;
+  double brightness =
+      (double) value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_BRIGHTNESS] /
+      GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX;
+
+  level = (level - 0.5) * contrast + 0.5 + brightness;
+  return CLAMP (level, 0.0, 1.0);
+}
+
+/* Set up the software color balance for the current screen format. Only
+   formats with 8-bit R, G and B components are supported. */
+
+static gboolean
+gst_framebuffersink_setup_software_color_balance (
+    GstFramebufferSink *framebuffersink, const gint *value)
+{
+  GstVideoInfo *info = &framebuffersink->screen_info;
+  double matrix[3][3];
+  int i, j;
+
+  if (framebuffersink->use_hardware_overlay ||
+      framebuffersink->use_buffer_pool || !GST_VIDEO_INFO_IS_RGB (info) ||
+      GST_VIDEO_INFO_COMP_DEPTH (info, 0) != 8 ||
+      (GST_VIDEO_INFO_COMP_PSTRIDE (info, 0) != 3 &&
+      GST_VIDEO_INFO_COMP_PSTRIDE (info, 0) != 4))
+    return FALSE;
+
+  for (i = 0; i < 3; i++)
+    framebuffersink->color_balance_offset[i] =
+        GST_VIDEO_INFO_COMP_POFFSET (info, i);
+  for (i = 0; i < 256; i++)
+    framebuffersink->color_balance_lut[i] = (guint8) lrint (
+        gst_framebuffersink_get_color_balance_level (value, i / 255.0) *
+        255.0);
+  framebuffersink->color_balance_software_matrix =
+      value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_SATURATION] != 0 ||
+      value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_HUE] != 0;
+  if (framebuffersink->color_balance_software_matrix) {
+    gst_framebuffersink_get_color_balance_matrix (value, matrix);
+    /* 10-bit fixed point. */
+    for (i = 0; i < 3; i++)
+      for (j = 0; j < 3; j++)
+        framebuffersink->color_balance_matrix[i][j] =
+            (gint) lrint (matrix[i][j] * 1024.0);
+  }
+  return TRUE;
+}
+
+/* Apply changed color balance values; called by the streaming thread before
+   showing a frame. */
+
+static void
+gst_framebuffersink_apply_color_balance (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  gint value[GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS];
+  gboolean is_default = TRUE;
+  int i;
+
+  GST_OBJECT_LOCK (framebuffersink);
+  memcpy (value, framebuffersink->color_balance, sizeof (value));
+  framebuffersink->color_balance_changed = FALSE;
+  GST_OBJECT_UNLOCK (framebuffersink);
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS; i++)
+    if (value[i] != 0)
+      is_default = FALSE;
+
+  framebuffersink->color_balance_software = FALSE;
+  if (klass->set_color_balance != NULL &&
+      klass->set_color_balance (framebuffersink, value)) {
+    GST_DEBUG_OBJECT (framebuffersink, "Color balance applied in hardware");
+    return;
+  }
+  if (is_default)
+    return;
+  if (gst_framebuffersink_setup_software_color_balance (framebuffersink,
+      value)) {
+    framebuffersink->color_balance_software = TRUE;
+    GST_DEBUG_OBJECT (framebuffersink, "Color balance applied in software");
+    return;
+  }
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+      "Color balance is not supported in this mode");
+}
+
+/* Copy a row of pixels while applying the color balance. */
+
+static void
+gst_framebuffersink_color_balance_row (GstFramebufferSink *framebuffersink,
+    guint8 *dest, const guint8 *src, int width)
+{
+  const guint8 *lut = framebuffersink->color_balance_lut;
+  int pstride = GST_VIDEO_INFO_COMP_PSTRIDE (&framebuffersink->screen_info,
+      0);
+  int r = framebuffersink->color_balance_offset[0];
+  int g = framebuffersink->color_balance_offset[1];
+  int b = framebuffersink->color_balance_offset[2];
+  guint8 pixel[4];
+  int x;
+
+  if (framebuffersink->color_balance_software_matrix) {
+    gint (*m)[3] = framebuffersink->color_balance_matrix;
+    int c[3], out;
+    int i;
+    for (x = 0; x < width; x++) {
+      memcpy (pixel, src, pstride);
+      c[0] = pixel[r];
+      c[1] = pixel[g];
+      c[2] = pixel[b];
+      for (i = 0; i < 3; i++) {
+        out = (m[i][0] * c[0] + m[i][1] * c[1] + m[i][2] * c[2] + 512) >> 10;
+        pixel[framebuffersink->color_balance_offset[i]] =
+            lut[CLAMP (out, 0, 255)];
+      }
+      memcpy (dest, pixel, pstride);
+      src += pstride;
+      dest += pstride;
+    }
+  }
+  else
+    for (x = 0; x < width; x++) {
+      memcpy (pixel, src, pstride);
+      pixel[r] = lut[pixel[r]];
+      pixel[g] = lut[pixel[g]];
+      pixel[b] = lut[pixel[b]];
+      memcpy (dest, pixel, pstride);
+      src += pstride;
+      dest += pstride;
+    }
+}
+
+/* GstColorBalance interface. */
+
+static const GList *
+gst_framebuffersink_color_balance_list_channels (GstColorBalance *balance)
+{
+  return GST_FRAMEBUFFERSINK (balance)->color_balance_channels;
+}
+
+static int
+gst_framebuffersink_color_balance_channel_index (GstColorBalanceChannel *
+    channel)
+{
+  int i;
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS; i++)
+    if (g_ascii_strcasecmp (channel->label,
+        gst_framebuffersink_color_balance_label[i]) == 0)
+      return i;
+  return - 1;
+}
+
+static void
+gst_framebuffersink_color_balance_set_value (GstColorBalance *balance,
+    GstColorBalanceChannel *channel, gint value)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (balance);
+  int i = gst_framebuffersink_color_balance_channel_index (channel);
+
+  if (i < 0)
+    return;
+  value = CLAMP (value, GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN,
+      GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX);
+  GST_OBJECT_LOCK (framebuffersink);
+  if (framebuffersink->color_balance[i] == value) {
+    GST_OBJECT_UNLOCK (framebuffersink);
+    return;
+  }
+  framebuffersink->color_balance[i] = value;
+  framebuffersink->color_balance_changed = TRUE;
+  GST_OBJECT_UNLOCK (framebuffersink);
+  gst_color_balance_value_changed (balance, channel, value);
+}
+
+static gint
+gst_framebuffersink_color_balance_get_value (GstColorBalance *balance,
+    GstColorBalanceChannel *channel)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (balance);
+  int i = gst_framebuffersink_color_balance_channel_index (channel);
+  gint value;
+
+  if (i < 0)
+    return 0;
+  GST_OBJECT_LOCK (framebuffersink);
+  value = framebuffersink->color_balance[i];
+  GST_OBJECT_UNLOCK (framebuffersink);
+  return value;
+}
+
+static GstColorBalanceType
+gst_framebuffersink_color_balance_get_balance_type (GstColorBalance *balance)
+{
+  GstFramebufferSinkClass *klass = GST_FRAMEBUFFERSINK_GET_CLASS (balance);
+
+  return klass->set_color_balance != NULL ? GST_COLOR_BALANCE_HARDWARE :
+      GST_COLOR_BALANCE_SOFTWARE;
+}
+
+static void
+gst_framebuffersink_color_balance_init (GstColorBalanceInterface *iface)
+{
+  iface->list_channels = gst_framebuffersink_color_balance_list_channels;
+  iface->set_value = gst_framebuffersink_color_balance_set_value;
+  iface->get_value = gst_framebuffersink_color_balance_get_value;
+  iface->get_balance_type =
+      gst_framebuffersink_color_balance_get_balance_type;
+}
+
+/* Copy instrumentation (perf-counters). Hardware performance counters are
+   opened with perf_event_open for the streaming thread as a single group,
+   so that they are read with one system call before and after the copy of
+   each frame. Counters that the CPU or kernel do not provide are left out;
+   when none can be opened (no PMU, perf_event_paranoid, seccomp) only the
+   copy time is measured. */
+
+static const struct {
+  guint32 type;
+  guint64 config;
+  const char *name;
+} gst_framebuffersink_perf_event[GST_FRAMEBUFFERSINK_PERF_COUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "dtlb-misses" }
+};
+
+static void
+gst_framebuffersink_perf_close (GstFramebufferSink *framebuffersink)
+{
+  int i;
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++)
+    if (framebuffersink->perf_fd[i] >= 0) {
+      close (framebuffersink->perf_fd[i]);
+      framebuffersink->perf_fd[i] = - 1;
+    }
+  framebuffersink->perf_group_size = 0;
+  framebuffersink->perf_thread = NULL;
+}
+
+/* Open the counters for the calling thread. */
+
+static void
+gst_framebuffersink_perf_open (GstFramebufferSink *framebuffersink)
+{
+  struct perf_event_attr attr;
+  int leader = - 1;
+  int i, fd;
+  gchar *s;
+
+  gst_framebuffersink_perf_close (framebuffersink);
+  framebuffersink->perf_thread = g_thread_self ();
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++) {
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = gst_framebuffersink_perf_event[i].type;
+    attr.config = gst_framebuffersink_perf_event[i].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    /* User space only, which is all that is allowed with the default
+       perf_event_paranoid setting. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+#ifdef SYS_perf_event_open
+    fd = syscall (SYS_perf_event_open, &attr, 0, - 1, leader, 0);
+#else
+    fd = - 1;
+    errno = ENOSYS;
+#endif
+    if (fd < 0) {
+      /* Without the leader (cycles) there is no group. */
+      if (i == 0)
+        break;
+      GST_INFO_OBJECT (framebuffersink, "Performance counter %s unavailable",
+          gst_framebuffersink_perf_event[i].name);
+      continue;
+    }
+    if (leader < 0)
+      leader = fd;
+    framebuffersink->perf_fd[i] = fd;
+    framebuffersink->perf_group_index[i] = framebuffersink->perf_group_size;
+    framebuffersink->perf_group_size++;
+  }
+
+  if (framebuffersink->perf_group_size == 0 &&
+      !framebuffersink->perf_unavailable_reported) {
+    s = g_strdup_printf ("Hardware performance counters unavailable (%s), "
+        "measuring copy time only", strerror (errno));
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+    g_free (s);
+    framebuffersink->perf_unavailable_reported = TRUE;
+  }
+}
+
+static gboolean
+gst_framebuffersink_perf_read (GstFramebufferSink *framebuffersink,
+    guint64 *value)
+{
+  guint64 data[1 + GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  ssize_t size;
+  int i;
+
+  size = read (framebuffersink->perf_fd[0], data, sizeof (data));
+  if (size < (ssize_t) sizeof (guint64) ||
+      data[0] != framebuffersink->perf_group_size)
+    return FALSE;
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++)
+    value[i] = framebuffersink->perf_fd[i] >= 0 ?
+        data[1 + framebuffersink->perf_group_index[i]] : 0;
+  return TRUE;
+}
+
+static void
+gst_framebuffersink_perf_begin (GstFramebufferSink *framebuffersink)
+{
+  if (framebuffersink->perf_thread != g_thread_self ())
+    gst_framebuffersink_perf_open (framebuffersink);
+  if (framebuffersink->perf_group_size > 0 &&
+      !gst_framebuffersink_perf_read (framebuffersink,
+      framebuffersink->perf_begin_value))
+    gst_framebuffersink_perf_close (framebuffersink);
+  framebuffersink->perf_begin_time = g_get_monotonic_time ();
+}
+
+static void
+gst_framebuffersink_perf_end (GstFramebufferSink *framebuffersink)
+{
+  guint64 value[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  GstClockTime time;
+  int i;
+
+  time = (g_get_monotonic_time () - framebuffersink->perf_begin_time) *
+      GST_USECOND;
+  memset (value, 0, sizeof (value));
+  if (framebuffersink->perf_group_size > 0 &&
+      gst_framebuffersink_perf_read (framebuffersink, value))
+    for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++)
+      value[i] -= framebuffersink->perf_begin_value[i];
+
+  GST_OBJECT_LOCK (framebuffersink);
+  framebuffersink->perf_frame_time = time;
+  framebuffersink->stats_perf_frames++;
+  framebuffersink->stats_perf_time_total += time;
+  if (time > framebuffersink->stats_perf_time_max)
+    framebuffersink->stats_perf_time_max = time;
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++) {
+    framebuffersink->perf_frame_value[i] = value[i];
+    framebuffersink->stats_perf_value[i] += value[i];
+  }
+  GST_OBJECT_UNLOCK (framebuffersink);
+
+  GST_LOG_OBJECT (framebuffersink, "copy: %" GST_TIME_FORMAT ", %"
+      G_GUINT64_FORMAT " cycles, %" G_GUINT64_FORMAT " instructions, %"
+      G_GUINT64_FORMAT " cache misses, %" G_GUINT64_FORMAT " dTLB misses",
+      GST_TIME_ARGS (time), value[0], value[1], value[2], value[3]);
+}
+
+/* Return the perf-stats structure. Counters that are unavailable are
+   omitted. */
+
+static GstStructure *
+gst_framebuffersink_get_perf_stats (GstFramebufferSink *framebuffersink)
+{
+  GstStructure *structure;
+  gchar *name;
+  int i;
+
+  GST_OBJECT_LOCK (framebuffersink);
+  structure = gst_structure_new ("framebuffersink-perf",
+      "frames", G_TYPE_INT, framebuffersink->stats_perf_frames,
+      "time", G_TYPE_UINT64, framebuffersink->stats_perf_time_total,
+      "max-time", G_TYPE_UINT64, framebuffersink->stats_perf_time_max,
+      "last-time", G_TYPE_UINT64, framebuffersink->perf_frame_time, NULL);
+  for (i = 0; i < GST_FRAMEBUFFERSINK_PERF_COUNTERS; i++) {
+    if (framebuffersink->perf_fd[i] < 0)
+      continue;
+    gst_structure_set (structure, gst_framebuffersink_perf_event[i].name,
+        G_TYPE_UINT64, framebuffersink->stats_perf_value[i], NULL);
+    name = g_strdup_printf ("last-%s", gst_framebuffersink_perf_event[i].name);
+    gst_structure_set (structure, name, G_TYPE_UINT64,
+        framebuffersink->perf_frame_value[i], NULL);
+    g_free (name);
+  }
+  GST_OBJECT_UNLOCK (framebuffersink);
+  return structure;
+}
+
+/* Hand a frame in system memory to the put_image function of the
+   subclass, producing the checksum, thumbnail and shared ring copy from
+   the source rows like the copy does. With the color balance applied in
+   software, the adjusted frame is built in system memory first. */
+
+static void
+gst_framebuffersink_put_image_subclass (GstFramebufferSink *framebuffersink,
+    GstMemory *vmem, uint8_t *src, int thumbnail_scale, guint8 *ring,
+    int index)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  int width_in_bytes = framebuffersink->video_rectangle_width_in_bytes;
+  int src_stride = framebuffersink->source_video_width_in_bytes[0];
+  const guint8 *frame = src;
+  int frame_stride = src_stride;
+  gboolean perf = framebuffersink->perf_counters;
+  gsize size;
+  int i;
+
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_START, copy_start,
+      vmem, width_in_bytes * framebuffersink->video_rectangle.h);
+  if (framebuffersink->color_balance_software) {
+    size = (gsize) width_in_bytes * framebuffersink->video_rectangle.h;
+    if (framebuffersink->color_balance_frame_size < size) {
+      g_free (framebuffersink->color_balance_frame);
+      framebuffersink->color_balance_frame = g_malloc (size);
+      framebuffersink->color_balance_frame_size = size;
+    }
+    frame = framebuffersink->color_balance_frame;
+    frame_stride = width_in_bytes;
+  }
+  if (perf)
+    gst_framebuffersink_perf_begin (framebuffersink);
+  for (i = 0; i < framebuffersink->video_rectangle.h; i++) {
+    if (framebuffersink->color_balance_software)
+      gst_framebuffersink_color_balance_row (framebuffersink,
+          framebuffersink->color_balance_frame + i * width_in_bytes, src,
+          framebuffersink->video_rectangle.w);
+    if (framebuffersink->checksum_enabled)
+      gst_framebuffersink_checksum_rows (framebuffersink, src,
+          width_in_bytes, 0, 1, index);
+    if (thumbnail_scale > 0 && i % thumbnail_scale == 0)
+      gst_framebuffersink_thumbnail_row (framebuffersink, src, i,
+          thumbnail_scale);
+    if (ring != NULL) {
+      memcpy (ring, src, width_in_bytes);
+      ring += width_in_bytes;
+    }
+    src += src_stride;
+  }
+  klass->put_image (framebuffersink, vmem, frame, frame_stride);
+  if (perf)
+    gst_framebuffersink_perf_end (framebuffersink);
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_END, copy_end,
+      vmem, width_in_bytes * framebuffersink->video_rectangle.h);
+}
+
+/* Copy a frame from system memory into the screen memory vmem. index is
+   the screen buffer index reported with the checksum, or -1 when vmem is
+   not one of the screens. */
+
+static void
+gst_framebuffersink_put_image_memcpy (GstFramebufferSink *framebuffersink,
+    GstMemory *vmem, uint8_t *src, int thumbnail_scale, guint8 *ring,
+    int index)
+{
+  guint8 *dest;
+  guintptr dest_stride;
+  int i;
+  GstMapInfo mapinfo;
+  gboolean res;
+  gboolean perf = framebuffersink->perf_counters;
+
+  if (framebuffersink->use_put_image) {
+    gst_framebuffersink_put_image_subclass (framebuffersink, vmem, src,
+        thumbnail_scale, ring, index);
+    return;
+  }
+
+  mapinfo.data = NULL;
+  res = gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE);
+  if (!res || mapinfo.data == NULL) {
+    GST_ERROR_OBJECT (framebuffersink, "Could not map video memory");
+    if (res)
+      gst_memory_unmap (vmem, &mapinfo);
+    return;
+  }
+  dest = mapinfo.data;
+  dest += framebuffersink->video_rectangle.y * GST_VIDEO_INFO_COMP_STRIDE (
+      &framebuffersink->screen_info, 0)
+      + framebuffersink->video_rectangle.x * GST_VIDEO_INFO_COMP_PSTRIDE (
+      &framebuffersink->screen_info, 0);
+  dest_stride = GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_START, copy_start,
+      vmem, framebuffersink->video_rectangle_width_in_bytes
+      * framebuffersink->video_rectangle.h);
+  if (perf)
+    gst_framebuffersink_perf_begin (framebuffersink);
+  if (framebuffersink->video_rectangle_width_in_bytes == dest_stride &&
+      thumbnail_scale == 0 && !framebuffersink->color_balance_software) {
+      if (framebuffersink->checksum_enabled)
+        gst_framebuffersink_copy_rows_checksum (framebuffersink, dest, src,
+            dest_stride, dest_stride, framebuffersink->video_rectangle.h,
+            index);
+      else
+        memcpy (dest, src, dest_stride * framebuffersink->video_rectangle.h);
+      if (ring != NULL)
+        memcpy (ring, src, dest_stride * framebuffersink->video_rectangle.h);
+  }
+  else
+    for (i = 0; i < framebuffersink->video_rectangle.h; i++) {
+      if (framebuffersink->color_balance_software)
+        gst_framebuffersink_color_balance_row (framebuffersink, dest, src,
+            framebuffersink->video_rectangle.w);
+      else
+        memcpy (dest, src, framebuffersink->video_rectangle_width_in_bytes);
+      /* Hash the row while it is in cache. */
+      if (framebuffersink->checksum_enabled)
+        gst_framebuffersink_checksum_rows (framebuffersink, src,
+            framebuffersink->video_rectangle_width_in_bytes, 0, 1, index);
+      if (thumbnail_scale > 0 && i % thumbnail_scale == 0)
+        gst_framebuffersink_thumbnail_row (framebuffersink, src, i,
+            thumbnail_scale);
+      if (ring != NULL) {
+        memcpy (ring, src, framebuffersink->video_rectangle_width_in_bytes);
+        ring += framebuffersink->video_rectangle_width_in_bytes;
+      }
+      src += framebuffersink->source_video_width_in_bytes[0];
+      dest += dest_stride;
+    }
+  if (perf)
+    gst_framebuffersink_perf_end (framebuffersink);
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_END, copy_end,
+      vmem, framebuffersink->video_rectangle_width_in_bytes
+      * framebuffersink->video_rectangle.h);
+  gst_memory_unmap (vmem, &mapinfo);
+  return;
+}
+
+/* Copy an overlay frame from system memory into video memory. The source
+   plane offsets and strides come from the buffer's GstVideoMeta when it has
+   one, otherwise from the negotiated video info. index is the overlay
+   buffer index reported with the checksum, or -1 when vmem is not one of
+   the overlays. */
+
+static void
+gst_framebuffersink_put_overlay_image_memcpy(GstFramebufferSink *
+    framebuffersink, GstMemory *vmem, uint8_t *src, const gsize *src_offset,
+    const gint *src_stride, int index)
+{
+  uint8_t *framebuffer_address;
+  GstMapInfo mapinfo;
+  gboolean res;
+  gboolean perf = framebuffersink->perf_counters;
+  gboolean src_is_default;
+  int i;
+
+  src_is_default = TRUE;
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&framebuffersink->video_info); i++)
+    if (src_offset[i] != GST_VIDEO_INFO_PLANE_OFFSET (
+        &framebuffersink->video_info, i) || src_stride[i] !=
+        GST_VIDEO_INFO_PLANE_STRIDE (&framebuffersink->video_info, i))
+      src_is_default = FALSE;
+
+  mapinfo.data = NULL;
+  res = gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE);
+  if (!res || mapinfo.data == NULL) {
+    GST_ERROR_OBJECT (framebuffersink, "Could not map video memory");
+    if (res)
+      gst_memory_unmap (vmem, &mapinfo);
+    return;
+  }
+  framebuffer_address = mapinfo.data;
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_START, copy_start, vmem,
+      framebuffersink->video_info.size);
+  if (perf)
+    gst_framebuffersink_perf_begin (framebuffersink);
+  /* The source frame is in system memory; the visible part of each plane
+     is hashed right after it is copied. Tiled frames are hashed as a whole,
+     in chunks. */
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (framebuffersink->video_info.finfo) &&
+      framebuffersink->checksum_enabled) {
+    gsize size = framebuffersink->video_info.size;
+    gsize pos, n;
+    for (pos = 0; pos < size; pos += n) {
+      n = MIN (size - pos, CHECKSUM_CHUNK_SIZE);
+      memcpy (framebuffer_address + pos, src + pos, n);
+      gst_framebuffersink_checksum_rows (framebuffersink, src + pos, n, 0, 1,
+          index);
+    }
+  }
+  else if ((framebuffersink->overlay_alignment_is_native && src_is_default &&
+      !framebuffersink->checksum_enabled) ||
+      GST_VIDEO_FORMAT_INFO_IS_TILED (framebuffersink->video_info.finfo))
+    memcpy(framebuffer_address, src, framebuffersink->video_info.size);
+  else {
+    int n = GST_VIDEO_INFO_N_PLANES (&framebuffersink->video_info);
+    guintptr offset;
+    uint8_t *src_plane;
+    int h;
+    for (i = 0; i < n; i++) {
+      offset = framebuffersink->overlay_plane_offset[i];
+      src_plane = src + src_offset[i];
+      h = GST_VIDEO_INFO_COMP_HEIGHT (&framebuffersink->video_info, i);
+      if (src_stride[i] == framebuffersink->overlay_scanline_stride[i] &&
+          framebuffersink->overlay_scanline_offset[i] == 0) {
+        if (framebuffersink->checksum_enabled)
+          gst_framebuffersink_copy_rows_checksum (framebuffersink,
+              framebuffer_address + offset, src_plane,
+              framebuffersink->source_video_width_in_bytes[i], src_stride[i],
+              h, index);
+        else
+          memcpy(framebuffer_address + offset, src_plane,
+              framebuffersink->overlay_scanline_stride[i] * h);
+      }
+      else {
+        int y;
+        for (y = 0; y < h; y++) {
+          memcpy(framebuffer_address + offset +
+              framebuffersink->overlay_scanline_offset[i],
+              src_plane, framebuffersink->source_video_width_in_bytes[i]);
+          if (framebuffersink->checksum_enabled)
+            gst_framebuffersink_checksum_rows (framebuffersink, src_plane,
+                framebuffersink->source_video_width_in_bytes[i], 0, 1,
+                index);
+          offset += framebuffersink->overlay_scanline_stride[i];
+          src_plane += src_stride[i];
+        }
+      }
+    }
+  }
+  if (perf)
+    gst_framebuffersink_perf_end (framebuffersink);
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, COPY_END, copy_end, vmem,
+      framebuffersink->video_info.size);
+  gst_memory_unmap (vmem, &mapinfo);
+}
+
+/* Show an overlay frame in video memory that was copied from system
+   memory. */
+
+static void
+gst_framebuffersink_flip_overlay (GstFramebufferSink *framebuffersink,
+    GstMemory *vmem)
+{
+  GstFramebufferSinkClass *klass = GST_FRAMEBUFFERSINK_GET_CLASS (
+      framebuffersink);
+
+  if (!gst_framebuffersink_group_sync (framebuffersink))
+    return;
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, FLIP_ISSUE, flip_issue, vmem,
+      0);
+  klass->show_overlay (framebuffersink, vmem);
+  framebuffersink->presented_memory = vmem;
+}
+
+/* Get the plane offsets and strides of an overlay frame in system memory.
+   Upstream may use its own strides when it was told we support
+   GstVideoMeta. */
+
+static void
+gst_framebuffersink_get_overlay_source_layout (
+    GstFramebufferSink *framebuffersink, GstBuffer *buf, gsize *src_offset,
+    gint *src_stride)
+{
+  GstVideoMeta *meta;
+  int i;
+
+  meta = gst_buffer_get_video_meta (buf);
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+    src_offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (&framebuffersink->video_info,
+        i);
+    src_stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (&framebuffersink->video_info,
+        i);
+    if (meta != NULL && i < meta->n_planes) {
+      src_offset[i] = meta->offset[i];
+      src_stride[i] = meta->stride[i];
+    }
+  }
+}
+
+/* Presentation watchdog. Every vsync wait and page flip is timed against the
+   refresh period. Subclasses that bound a wait themselves report it with
+   gst_framebuffersink_report_presentation_stall(). */
+
+/* The following member functions are exported for use by derived
+   subclasses. */
+GstClockTime
+gst_framebuffersink_get_presentation_timeout (
+    GstFramebufferSink *framebuffersink)
+{
+  GstClockTime timeout;
+  if (framebuffersink->refresh_period != 0)
+    timeout = WATCHDOG_TIMEOUT_PERIODS * framebuffersink->refresh_period;
+  else
+    timeout = WATCHDOG_TIMEOUT_PERIODS * WATCHDOG_DEFAULT_REFRESH_PERIOD;
+  if (timeout < WATCHDOG_MIN_TIMEOUT)
+    timeout = WATCHDOG_MIN_TIMEOUT;
+  return timeout;
+}
+
+void
+gst_framebuffersink_report_presentation_stall (
+    GstFramebufferSink *framebuffersink)
+{
+  framebuffersink->presentation_stall_reported = TRUE;
+}
+
+/* Returns TRUE when the hardware should not be waited on for the current
+   frame because the watchdog has fallen back to software pacing. */
+gboolean
+gst_framebuffersink_hardware_sync_bypassed (
+    GstFramebufferSink *framebuffersink)
+{
+  return framebuffersink->presentation_fallback &&
+      !framebuffersink->presentation_probe;
+}
+
+gboolean
+gst_framebuffersink_is_unlocked (GstFramebufferSink *framebuffersink)
+{
+  return g_atomic_int_get (&framebuffersink->unlocked);
+}
+
+int
+gst_framebuffersink_poll (GstFramebufferSink *framebuffersink, int fd,
+    GstClockTime timeout)
+{
+  struct pollfd pfd[2];
+  struct timespec ts;
+  gint64 end_time, now;
+  int n, res;
+
+  if (gst_framebuffersink_is_unlocked (framebuffersink))
+    return - 1;
+  n = 0;
+  if (fd >= 0) {
+    pfd[n].fd = fd;
+    pfd[n].events = POLLIN;
+    pfd[n].revents = 0;
+    n++;
+  }
+  if (framebuffersink->wakeup_fd >= 0) {
+    pfd[n].fd = framebuffersink->wakeup_fd;
+    pfd[n].events = POLLIN;
+    pfd[n].revents = 0;
+    n++;
+  }
+  end_time = g_get_monotonic_time () + timeout / GST_USECOND;
+  do {
+    now = g_get_monotonic_time ();
+    if (now > end_time)
+      now = end_time;
+    ts.tv_sec = (end_time - now) / G_USEC_PER_SEC;
+    ts.tv_nsec = ((end_time - now) % G_USEC_PER_SEC) * 1000;
+    res = ppoll (pfd, n, &ts, NULL);
+  } while (res < 0 && errno == EINTR);
+
+  if (res < 0 || gst_framebuffersink_is_unlocked (framebuffersink))
+    return - 1;
+  if (fd >= 0 && (pfd[0].revents & (POLLIN | POLLERR | POLLHUP)))
+    return 1;
+  return 0;
+}
+
+/* Wait until one refresh period after the previous presentation. */
+
+static void
+gst_framebuffersink_pace_presentation (GstFramebufferSink *framebuffersink)
+{
+  gint64 now, next;
+  GstClockTime period;
+
+  period = framebuffersink->refresh_period;
+  if (period == 0)
+    period = WATCHDOG_DEFAULT_REFRESH_PERIOD;
+  now = g_get_monotonic_time ();
+  next = framebuffersink->presentation_paced_time + period / GST_USECOND;
+  if (next > now) {
+    gst_framebuffersink_poll (framebuffersink, - 1,
+        (next - now) * GST_USECOND);
+    framebuffersink->presentation_paced_time = next;
+  }
+  else
+    framebuffersink->presentation_paced_time = now;
+}
+
+/* Check how long a vsync wait or page flip that started at start_time took,
+   and switch to or from software pacing. */
+
+static void
+gst_framebuffersink_check_presentation (GstFramebufferSink *framebuffersink,
+    gint64 start_time, const gchar *what)
+{
+  GstClockTime elapsed, timeout;
+  gint64 now;
+  gchar *s;
+
+  now = g_get_monotonic_time ();
+  framebuffersink->presentation_paced_time = now;
+  elapsed = (now - start_time) * GST_USECOND;
+  timeout = gst_framebuffersink_get_presentation_timeout (framebuffersink);
+
+  if (framebuffersink->presentation_stall_reported || elapsed > timeout) {
+    framebuffersink->stats_presentation_stalls++;
+    framebuffersink->presentation_stalls++;
+    GST_DEBUG_OBJECT (framebuffersink, "%s stalled (%.1lf ms)", what,
+        (double) elapsed / GST_MSECOND);
+    if (!framebuffersink->presentation_fallback &&
+        framebuffersink->presentation_stalls >= WATCHDOG_STALL_LIMIT) {
+      framebuffersink->presentation_fallback = TRUE;
+      framebuffersink->presentation_probe_countdown = WATCHDOG_PROBE_INTERVAL;
+      framebuffersink->stats_presentation_fallbacks++;
+      GST_ELEMENT_WARNING (framebuffersink, RESOURCE, FAILED,
+          ("Display %s timed out, pacing frames in software", what),
+          ("%s took %.1lf ms with a timeout of %.1lf ms", what,
+          (double) elapsed / GST_MSECOND, (double) timeout / GST_MSECOND));
+    }
+    return;
+  }
+
+  framebuffersink->presentation_stalls = 0;
+  if (framebuffersink->presentation_fallback) {
+    framebuffersink->presentation_fallback = FALSE;
+    s = g_strdup_printf ("Display %s responding again, resuming hardware "
+        "synchronization", what);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+    g_free (s);
+  }
+}
+
+static void
+gst_framebuffersink_watched_wait_for_vsync (
+    GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  gint64 start_time;
+
+  if (gst_framebuffersink_hardware_sync_bypassed (framebuffersink)) {
+    gst_framebuffersink_pace_presentation (framebuffersink);
+    return;
+  }
+  framebuffersink->presentation_stall_reported = FALSE;
+  start_time = g_get_monotonic_time ();
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, VSYNC_WAIT_START,
+      vsync_wait_start, 0, 0);
+  klass->wait_for_vsync (framebuffersink);
+  framebuffersink->last_vblank_time = g_get_monotonic_time ();
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, VSYNC_WAIT_END, vsync_wait_end,
+      0, 0);
+  gst_framebuffersink_check_presentation (framebuffersink, start_time,
+      "vsync wait");
+}
+
+static void
+gst_framebuffersink_watched_pan_display (GstFramebufferSink *framebuffersink,
+    GstMemory *memory)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  gint64 start_time;
+
+  framebuffersink->presentation_stall_reported = FALSE;
+  start_time = g_get_monotonic_time ();
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, FLIP_ISSUE, flip_issue, memory,
+      0);
+  klass->pan_display (framebuffersink, memory);
+  framebuffersink->presented_memory = memory;
+  if (framebuffersink->vsync && framebuffersink->pan_does_vsync)
+    framebuffersink->last_vblank_time = g_get_monotonic_time ();
+  /* While bypassed the subclass presents without waiting, so only a stall
+     it reports itself is counted; recovery is left to the probe frames. */
+  if (gst_framebuffersink_hardware_sync_bypassed (framebuffersink)) {
+    if (framebuffersink->presentation_stall_reported)
+      framebuffersink->stats_presentation_stalls++;
+    return;
+  }
+  gst_framebuffersink_check_presentation (framebuffersink, start_time,
+      "page flip");
+}
+
+/* Presentation groups. Sinks with the same group-name share a
+   GstFramebufferSinkGroup. A round collects one frame per member with the
+   same running time (within half a refresh period): a member that arrives
+   with a later frame holds its frame and restarts the round, and members
+   with earlier frames drop them until they have caught up. When every
+   member has arrived, the round is released with a present time, the first
+   vblank of the shared refresh period that all members can still reach, and
+   each member waits until just before it so that all flip on that vblank.
+   The skew is the spread of the running times of the frames released
+   together. */
+
+struct _GstFramebufferSinkGroup {
+  gchar *name;
+  /* Protected by groups_lock. */
+  int ref_count;
+  /* Protected by mutex. */
+  GMutex mutex;
+  GCond cond;
+  int members;
+  int arrived;
+  guint generation;
+  /* Generation of the last round that was released rather than restarted. */
+  guint released_generation;
+  GstClockTime target_running_time;
+  GstClockTime min_running_time;
+  GstClockTime max_running_time;
+  GstClockTime skew;
+  /* Refresh period of the first member, the latest vblank time reported by
+     a member, and the present time of the last released round. */
+  GstClockTime period;
+  gint64 vblank_time;
+  gint64 present_time;
+};
+
+static GMutex groups_lock;
+static GHashTable *groups = NULL;
+
+static void
+gst_framebuffersink_group_release (GstFramebufferSinkGroup *group)
+{
+  gint64 now, period;
+
+  if (GST_CLOCK_TIME_IS_VALID (group->min_running_time))
+    group->skew = group->max_running_time - group->min_running_time;
+  else
+    group->skew = 0;
+  /* Aim at the first vblank at least half a period away, so that the
+     members woken up now all reach it. */
+  group->present_time = 0;
+  period = group->period / GST_USECOND;
+  if (group->vblank_time > 0 && period > 0) {
+    now = g_get_monotonic_time ();
+    group->present_time = group->vblank_time +
+        ((now + period / 2 - group->vblank_time) / period + 1) * period;
+  }
+  group->arrived = 0;
+  group->released_generation = group->generation;
+  group->generation++;
+  g_cond_broadcast (&group->cond);
+}
+
+/* Restart the round for a member with a later frame. Members waiting with
+   earlier frames drop them. */
+
+static void
+gst_framebuffersink_group_restart (GstFramebufferSinkGroup *group,
+    GstClockTime running_time)
+{
+  group->target_running_time = running_time;
+  group->min_running_time = running_time;
+  group->max_running_time = running_time;
+  group->arrived = 0;
+  group->generation++;
+  g_cond_broadcast (&group->cond);
+}
+
+static void
+gst_framebuffersink_group_join (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkGroup *group;
+  gchar *s;
+
+  g_mutex_lock (&groups_lock);
+  if (groups == NULL)
+    groups = g_hash_table_new (g_str_hash, g_str_equal);
+  group = g_hash_table_lookup (groups, framebuffersink->group_name);
+  if (group == NULL) {
+    group = g_new0 (GstFramebufferSinkGroup, 1);
+    group->name = g_strdup (framebuffersink->group_name);
+    g_mutex_init (&group->mutex);
+    g_cond_init (&group->cond);
+    group->target_running_time = GST_CLOCK_TIME_NONE;
+    group->period = framebuffersink->refresh_period;
+    if (group->period == 0)
+      group->period = WATCHDOG_DEFAULT_REFRESH_PERIOD;
+    g_hash_table_insert (groups, group->name, group);
+  }
+  group->ref_count++;
+  g_mutex_unlock (&groups_lock);
+
+  g_mutex_lock (&group->mutex);
+  group->members++;
+  s = g_strdup_printf ("Joined presentation group %s (%d members)",
+      group->name, group->members);
+  g_mutex_unlock (&group->mutex);
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  g_free (s);
+
+  framebuffersink->group = group;
+}
+
+static void
+gst_framebuffersink_group_leave (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkGroup *group = framebuffersink->group;
+
+  g_mutex_lock (&group->mutex);
+  group->members--;
+  /* Don't keep the remaining members waiting for this one. */
+  if (group->arrived > 0 && group->arrived >= group->members)
+    gst_framebuffersink_group_release (group);
+  g_mutex_unlock (&group->mutex);
+
+  g_mutex_lock (&groups_lock);
+  group->ref_count--;
+  if (group->ref_count == 0) {
+    g_hash_table_remove (groups, group->name);
+    g_mutex_clear (&group->mutex);
+    g_cond_clear (&group->cond);
+    g_free (group->name);
+    g_free (group);
+  }
+  g_mutex_unlock (&groups_lock);
+
+  framebuffersink->group = NULL;
+}
+
+/* Called just before a frame is presented (before the vsync wait and pan,
+   or before the copy when not page flipping). Returns FALSE if the frame
+   should be dropped because the other members are presenting a later
+   one. */
+
+static gboolean
+gst_framebuffersink_group_sync (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkGroup *group = framebuffersink->group;
+  GstClockTime running_time = framebuffersink->group_running_time;
+  GstClockTime period;
+  GstClockTime skew;
+  gint64 end_time;
+  gint64 present_time;
+  guint generation;
+  gboolean matches;
+
+  if (group == NULL)
+    return TRUE;
+
+  g_mutex_lock (&group->mutex);
+  period = group->period;
+  if (framebuffersink->last_vblank_time > group->vblank_time)
+    group->vblank_time = framebuffersink->last_vblank_time;
+
+  /* Frames without a running time match any round. */
+  if (group->arrived > 0 && GST_CLOCK_TIME_IS_VALID (running_time) &&
+      GST_CLOCK_TIME_IS_VALID (group->target_running_time)) {
+    if (running_time + period / 2 < group->target_running_time) {
+      /* Behind the other members. */
+      g_mutex_unlock (&group->mutex);
+      framebuffersink->stats_group_drops++;
+      return FALSE;
+    }
+    if (running_time > group->target_running_time + period / 2)
+      gst_framebuffersink_group_restart (group, running_time);
+  }
+  if (group->arrived == 0) {
+    group->target_running_time = running_time;
+    group->min_running_time = running_time;
+    group->max_running_time = running_time;
+  }
+  else if (GST_CLOCK_TIME_IS_VALID (running_time)) {
+    if (!GST_CLOCK_TIME_IS_VALID (group->target_running_time))
+      group->target_running_time = running_time;
+    if (!GST_CLOCK_TIME_IS_VALID (group->min_running_time) ||
+        running_time < group->min_running_time)
+      group->min_running_time = running_time;
+    if (!GST_CLOCK_TIME_IS_VALID (group->max_running_time) ||
+        running_time > group->max_running_time)
+      group->max_running_time = running_time;
+  }
+  group->arrived++;
+  generation = group->generation;
+  if (group->arrived >= group->members)
+    gst_framebuffersink_group_release (group);
+  else {
+    end_time = g_get_monotonic_time () + GROUP_TIMEOUT_PERIODS * period /
+        GST_USECOND;
+    while (group->generation == generation &&
+        !gst_framebuffersink_is_unlocked (framebuffersink))
+      if (!g_cond_wait_until (&group->cond, &group->mutex, end_time))
+        break;
+    if (group->generation == generation &&
+        gst_framebuffersink_is_unlocked (framebuffersink))
+      /* Flushing; leave without holding up the other members. */
+      group->arrived--;
+    else if (group->generation == generation) {
+      /* A member is not delivering frames (paused, starved or at EOS). */
+      framebuffersink->stats_group_timeouts++;
+      gst_framebuffersink_group_release (group);
+    }
+  }
+  matches = group->released_generation == generation;
+  skew = group->skew;
+  present_time = group->present_time;
+  g_mutex_unlock (&group->mutex);
+
+  if (!matches) {
+    /* Another member restarted the round with a later frame, or the sink
+       is flushing. */
+    if (!gst_framebuffersink_is_unlocked (framebuffersink))
+      framebuffersink->stats_group_drops++;
+    return FALSE;
+  }
+
+  /* Wait until the period before the present time, so that the vsync wait
+     or page flip that follows completes on that vblank. */
+  if (present_time > 0) {
+    end_time = present_time - period / GST_USECOND;
+    if (end_time > g_get_monotonic_time ())
+      gst_framebuffersink_poll (framebuffersink, - 1,
+          (end_time - g_get_monotonic_time ()) * GST_USECOND);
+  }
+
+  framebuffersink->stats_group_frames++;
+  framebuffersink->stats_group_skew_total += skew;
+  if (skew > framebuffersink->stats_group_skew_max)
+    framebuffersink->stats_group_skew_max = skew;
+  GST_LOG_OBJECT (framebuffersink, "Presentation group %s skew %.2lf ms",
+      group->name, (double) skew / GST_MSECOND);
+  return TRUE;
+}
+
+static void
+gst_framebuffersink_put_image_pan(GstFramebufferSink * framebuffersink,
+    GstMemory *memory)
+{
+  if (!gst_framebuffersink_group_sync (framebuffersink))
+    return;
+  if (framebuffersink->vsync && !framebuffersink->pan_does_vsync)
+    gst_framebuffersink_watched_wait_for_vsync (framebuffersink);
+  gst_framebuffersink_watched_pan_display (framebuffersink, memory);
+}
+
+/* Benchmark functionality. */
+
+static void clear_words (uint32_t *dest, gsize size) {
+  while (size >= 32) {
+    *dest = 0;
+    *(dest + 1) = 0;
+    *(dest + 2) = 0;
+    *(dest + 3) = 0;
+    *(dest + 4) = 0;
+    *(dest + 5) = 0;
+    size -= 32;
+    *(dest + 6) = 0;
+    *(dest + 7) = 0;
+    dest += 8;
+  }
+  while (size >= 4) {
+    *dest = 0;
+    size -= 4;
+    dest++;
+  }
+}
+
+static void gst_framebuffersink_benchmark_clear_first_memset (
+GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
+    GstMemory *source_buffer)
+{
+  GstMapInfo mapinfo;
+  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
+  memset (mapinfo.data, 0, mapinfo.size);
+  gst_memory_unmap (buffers[0], &mapinfo);
+}
+
+static void gst_framebuffersink_benchmark_clear_first_words (
+    GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
+    GstMemory *source_buffer)
+{
+  GstMapInfo mapinfo;
+  uint32_t *dest;
+  int size  = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
+  dest = (uint32_t *)mapinfo.data;
+  clear_words (dest, size);
+  gst_memory_unmap (buffers[0], &mapinfo);
+}
+
+/* Test write combining. */
+
+static void gst_framebuffersink_benchmark_clear_first_bytes (
+    GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
+    GstMemory *source_buffer)
+{
+  GstMapInfo mapinfo;
+  uint8_t *dest;
+  int size  = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  gst_memory_map (buffers[0], &mapinfo, GST_MAP_WRITE);
+  dest = mapinfo.data;
+  while (size >= 16) {
+    *dest = 0;
+    *(dest + 1) = 0;
+    *(dest + 2) = 0;
+    *(dest + 3) = 0;
+    *(dest + 4) = 0;
+    *(dest + 5) = 0;
+    *(dest + 6) = 0;
+    *(dest + 7) = 0;
+    *(dest + 8) = 0;
+    *(dest + 9) = 0;
+    *(dest + 10) = 0;
+    *(dest + 11) = 0;
+    *(dest + 12) = 0;
+    *(dest + 13) = 0;
+    size -= 16;
+    *(dest + 14) = 0;
+    *(dest + 15) = 0;
+    dest += 16;
+  }
+  while (size > 0) {
+    *dest = 0;
+    size--;
+    dest++;
+  }
+  gst_memory_unmap (buffers[0], &mapinfo);
+}
+
+/* Test read access. */
 
 static void gst_framebuffersink_benchmark_read_first_words (
     GstFramebufferSink *framebuffersink, GstMemory **buffers, int nu_buffers,
@@ -1069,6 +2943,23 @@ gst_framebuffersink_start (GstBaseSink *sink)
       framebuffersink->use_buffer_pool_property;
   framebuffersink->vsync =
       framebuffersink->vsync_property;
+  /* The subclass may set this when opening the hardware. */
+  framebuffersink->converted_formats_supported =
+      overlay_formats_supported_table_empty;
+  framebuffersink->converted_formats_scaled = FALSE;
+  framebuffersink->converted_formats_in_video_memory = FALSE;
+  framebuffersink->use_put_image = FALSE;
+  framebuffersink->dmabuf_supported = FALSE;
+  framebuffersink->dmabuf_input = FALSE;
+  framebuffersink->refresh_period = 0;
+  framebuffersink->live_properties_changed = FALSE;
+  framebuffersink->live_properties_fixed = FALSE;
+  framebuffersink->live_buffer_pool = framebuffersink->use_buffer_pool_property;
+  framebuffersink->live_flip_buffers = framebuffersink->flip_buffers;
+  framebuffersink->live_max_video_memory =
+      framebuffersink->max_video_memory_property;
+  framebuffersink->live_pool_switch_pending = FALSE;
+  framebuffersink->live_depth_target = 0;
 
   if (!klass->open_hardware (framebuffersink, &framebuffersink->screen_info,
       &framebuffersink->video_memory_size,
@@ -1124,13 +3015,73 @@ gst_framebuffersink_start (GstBaseSink *sink)
   framebuffersink->current_framebuffer_index = 0;
   framebuffersink->nu_screens_used = 0;
   framebuffersink->screens = NULL;
+  framebuffersink->screens_array_size = 0;
   framebuffersink->nu_overlays_used = 0;
   framebuffersink->overlays = NULL;
+  framebuffersink->overlays_array_size = 0;
+  framebuffersink->adaptive_depth_active = FALSE;
 
   framebuffersink->stats_video_frames_video_memory = 0;
   framebuffersink->stats_video_frames_system_memory = 0;
   framebuffersink->stats_overlay_frames_video_memory = 0;
   framebuffersink->stats_overlay_frames_system_memory = 0;
+  framebuffersink->stats_resolution_changes = 0;
+  framebuffersink->stats_missed_deadlines = 0;
+  framebuffersink->stats_max_lateness = 0;
+  framebuffersink->stats_frames_prepared = 0;
+  framebuffersink->stats_dmabuf_frames = 0;
+  framebuffersink->stats_frame_cache_hits = 0;
+  framebuffersink->stats_frame_cache_misses = 0;
+  framebuffersink->prepared_buffer = NULL;
+  framebuffersink->scheduled_thread = NULL;
+  framebuffersink->scheduling_policy_in_effect = - 1;
+  framebuffersink->presentation_fallback = FALSE;
+  framebuffersink->presentation_probe = FALSE;
+  framebuffersink->presentation_stalls = 0;
+  framebuffersink->presentation_paced_time = 0;
+  framebuffersink->presented_framebuffer_index = 0;
+  framebuffersink->presented_memory = NULL;
+  framebuffersink->retired_memory = NULL;
+  framebuffersink->retired_allocator = NULL;
+  framebuffersink->retired_frames = 0;
+  framebuffersink->stats_presentation_stalls = 0;
+  framebuffersink->stats_presentation_fallbacks = 0;
+  framebuffersink->group_running_time = GST_CLOCK_TIME_NONE;
+  framebuffersink->last_vblank_time = 0;
+  framebuffersink->stats_group_frames = 0;
+  framebuffersink->stats_group_drops = 0;
+  framebuffersink->stats_group_timeouts = 0;
+  framebuffersink->stats_group_skew_total = 0;
+  framebuffersink->stats_group_skew_max = 0;
+
+  if (framebuffersink->group_name != NULL &&
+      framebuffersink->group_name[0] != '\0')
+    gst_framebuffersink_group_join (framebuffersink);
+
+  framebuffersink->stats_checksummed_frames = 0;
+  framebuffersink->perf_unavailable_reported = FALSE;
+  GST_OBJECT_LOCK (framebuffersink);
+  framebuffersink->stats_perf_frames = 0;
+  framebuffersink->stats_perf_time_total = 0;
+  framebuffersink->stats_perf_time_max = 0;
+  framebuffersink->perf_frame_time = 0;
+  memset (framebuffersink->stats_perf_value, 0,
+      sizeof (framebuffersink->stats_perf_value));
+  memset (framebuffersink->perf_frame_value, 0,
+      sizeof (framebuffersink->perf_frame_value));
+  GST_OBJECT_UNLOCK (framebuffersink);
+  if (framebuffersink->shared_ring_enabled)
+    gst_framebuffersink_shared_ring_open (framebuffersink);
+  if (framebuffersink->checksum_enabled &&
+      framebuffersink->checksum_location != NULL) {
+    framebuffersink->checksum_file = fopen (
+        framebuffersink->checksum_location, "w");
+    if (framebuffersink->checksum_file == NULL) {
+      g_sprintf (s, "Could not open checksum file %.160s, posting messages "
+          "instead", framebuffersink->checksum_location);
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+    }
+  }
 
   return TRUE;
 }
@@ -1144,16 +3095,23 @@ gst_framebuffersink_caps_set_preferences (GstFramebufferSink *framebuffersink,
   /* If hardware scaling is supported, and a specific video size is requested,
      allow any reasonable size (except when the width/height_before_scaler
      properties are set) and use the scaler. */
-  if (framebuffersink->use_hardware_overlay &&
+  if ((framebuffersink->use_hardware_overlay ||
+      framebuffersink->converted_formats_scaled) &&
       (framebuffersink->requested_video_width != 0 ||
       framebuffersink->requested_video_height != 0)) {
-    if (framebuffersink->width_before_scaling != 0)
+    if (framebuffersink->resolution_width != 0)
+      gst_caps_set_simple (caps, "width", G_TYPE_INT,
+          framebuffersink->resolution_width, NULL);
+    else if (framebuffersink->width_before_scaling != 0)
       gst_caps_set_simple (caps, "width", G_TYPE_INT,
           framebuffersink->width_before_scaling, NULL);
     else
       gst_caps_set_simple (caps, "width", GST_TYPE_INT_RANGE, 1,
           GST_VIDEO_INFO_WIDTH (&framebuffersink->screen_info), NULL);
-    if (framebuffersink->height_before_scaling != 0)
+    if (framebuffersink->resolution_height != 0)
+      gst_caps_set_simple (caps, "height", G_TYPE_INT,
+          framebuffersink->resolution_height, NULL);
+    else if (framebuffersink->height_before_scaling != 0)
       gst_caps_set_simple (caps, "height", G_TYPE_INT,
           framebuffersink->height_before_scaling, NULL);
     else
@@ -1198,6 +3156,37 @@ skip_video_size_request:
   }
 }
 
+/* When adaptive resolution asks upstream for a reduced source size, follow
+   the fixed size caps with the same caps without it, so that upstream
+   elements that cannot scale still negotiate. Must be called after the caps
+   have been simplified, which would merge the two. */
+
+static GstCaps *
+gst_framebuffersink_caps_append_unrestricted_size (
+    GstFramebufferSink *framebuffersink, GstCaps *caps)
+{
+  GstCaps *unrestricted_caps;
+
+  if (framebuffersink->resolution_width == 0 &&
+      framebuffersink->resolution_height == 0)
+    return caps;
+  unrestricted_caps = gst_caps_copy (caps);
+  if (framebuffersink->width_before_scaling != 0)
+    gst_caps_set_simple (unrestricted_caps, "width", G_TYPE_INT,
+        framebuffersink->width_before_scaling, NULL);
+  else
+    gst_caps_set_simple (unrestricted_caps, "width", GST_TYPE_INT_RANGE, 1,
+        GST_VIDEO_INFO_WIDTH (&framebuffersink->screen_info), NULL);
+  if (framebuffersink->height_before_scaling != 0)
+    gst_caps_set_simple (unrestricted_caps, "height", G_TYPE_INT,
+        framebuffersink->height_before_scaling, NULL);
+  else
+    gst_caps_set_simple (unrestricted_caps, "height", GST_TYPE_INT_RANGE, 1,
+        GST_VIDEO_INFO_HEIGHT (&framebuffersink->screen_info), NULL);
+  gst_caps_append (caps, unrestricted_caps);
+  return caps;
+}
+
 /* Return default caps, or NULL if no default caps could be not generated. */
 
 static GstCaps *gst_framebuffersink_get_default_caps (
@@ -1235,6 +3224,32 @@ static GstCaps *gst_framebuffersink_get_default_caps (
       NULL);
   gst_caps_append(caps, framebuffer_caps);
 
+  /* Finally add the formats that are converted to the framebuffer format
+     while copying. */
+  f = framebuffersink->converted_formats_supported;
+  while (*f != GST_VIDEO_FORMAT_UNKNOWN) {
+    if (*f != GST_VIDEO_INFO_FORMAT (&framebuffersink->screen_info)) {
+      GstCaps *converted_caps = gst_caps_new_simple ("video/x-raw", "format",
+          G_TYPE_STRING, gst_video_format_to_string (*f),
+          "interlace-mode", G_TYPE_STRING, "progressive",
+          "pixel-aspect-ratio", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT,
+          G_MAXINT, 1, NULL);
+      gst_caps_append (caps, converted_caps);
+    }
+    f++;
+  }
+
+  /* Offer the same formats in DMABuf memory first, so that upstream hands
+     over its dmabufs instead of downloading them into system memory. */
+  if (framebuffersink->dmabuf_supported) {
+    GstCaps *dmabuf_caps = gst_caps_copy (caps);
+    int i;
+    for (i = 0; i < gst_caps_get_size (dmabuf_caps); i++)
+      gst_caps_set_features (dmabuf_caps, i,
+          gst_caps_features_new (GST_CAPS_FEATURE_MEMORY_DMABUF, NULL));
+    caps = gst_caps_merge (dmabuf_caps, caps);
+  }
+
   return caps;
 
 unknown_format:
@@ -1355,8 +3370,11 @@ gst_framebuffersink_get_caps (GstBaseSink * sink, GstCaps * filter)
   gst_framebuffersink_caps_set_preferences(framebuffersink, caps, TRUE);
 
   /* For an ACCEPT_CAPS query, return the default caps for the screen. */
-  if (filter == NULL)
+  if (filter == NULL) {
+    caps = gst_framebuffersink_caps_append_unrestricted_size (framebuffersink,
+        caps);
     goto done_no_store;
+  }
 
   /* Check whether upstream is reporting video dimensions and par. */
   n = gst_caps_get_size (filter);
@@ -1382,6 +3400,8 @@ gst_framebuffersink_get_caps (GstBaseSink * sink, GstCaps * filter)
     /* Upstream has not yet confirmed a video size */
     /* Return the intersection of the current caps with the filter caps. */
     GstCaps *icaps;
+    caps = gst_framebuffersink_caps_append_unrestricted_size (framebuffersink,
+        caps);
     icaps = gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
     gst_caps_unref (caps);
     caps = icaps;
@@ -1400,13 +3420,18 @@ gst_framebuffersink_get_caps (GstBaseSink * sink, GstCaps * filter)
     gst_caps_set_simple(caps,
         "format", G_TYPE_STRING, gst_video_format_to_string (format), NULL);
   }
-  else
+  else if (*framebuffersink->converted_formats_supported ==
+      GST_VIDEO_FORMAT_UNKNOWN)
     /* Set the screen framebuffer format. */
     gst_caps_set_simple(caps,
         "format", G_TYPE_STRING, gst_video_format_to_string (
         GST_VIDEO_INFO_FORMAT (&framebuffersink->screen_info)), NULL);
+  /* Otherwise leave both the framebuffer format and the converted formats
+     in the caps and let the intersection with upstream pick one. */
 
   caps = gst_caps_simplify (caps);
+  caps = gst_framebuffersink_caps_append_unrestricted_size (framebuffersink,
+      caps);
 
   /* Return the intersection of the current caps with the filter caps. */
   if (filter != NULL) {
@@ -1444,13 +3469,22 @@ gst_framebuffersink_allocate_buffer_pool (GstFramebufferSink *framebuffersink,
   GstStructure *config;
   GstBufferPool *newpool;
   GstAllocator *allocator;
+  gboolean video_meta;
+  gsize size;
   int n;
   char s[256];
 
   GST_DEBUG("allocate_buffer_pool, caps: %" GST_PTR_FORMAT, caps);
 
-  /* Create a new pool for the new configuration. */
-  newpool = gst_buffer_pool_new ();
+  /* Create a new pool for the new configuration. A video buffer pool lays
+     out the buffers with the overlay alignment and describes the layout to
+     upstream with GstVideoMeta. */
+  video_meta = framebuffersink->use_hardware_overlay &&
+      framebuffersink->overlay_pool_video_meta;
+  if (video_meta)
+    newpool = gst_video_buffer_pool_new ();
+  else
+    newpool = gst_buffer_pool_new ();
 
   config = gst_buffer_pool_get_config (newpool);
 
@@ -1461,7 +3495,18 @@ gst_framebuffersink_allocate_buffer_pool (GstFramebufferSink *framebuffersink,
 #ifdef HALF_POOLS
   n /= 2;
 #endif
-  gst_buffer_pool_config_set_params (config, caps, info->size, n, n);
+  size = info->size;
+  if (video_meta)
+    size = framebuffersink->overlay_size;
+  gst_buffer_pool_config_set_params (config, caps, size, n, n);
+  if (video_meta) {
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+    gst_buffer_pool_config_set_video_alignment (config,
+        &framebuffersink->overlay_pool_alignment);
+  }
 
   if (framebuffersink->use_hardware_overlay) {
     /* Make sure one screen is allocated when using the hardware overlay. */
@@ -1489,7 +3534,7 @@ gst_framebuffersink_allocate_buffer_pool (GstFramebufferSink *framebuffersink,
     goto config_failed;
 
   g_sprintf(s, "Succesfully allocated buffer pool (frame size %zd, %d buffers)",
-      info->size, n);
+      size, n);
   GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
 
 #if 0
@@ -1517,6 +3562,43 @@ activation_failed:
 #endif
 }
 
+/* Allocate a pool of source frames in the video memory that is not used for
+   screens or frame cache entries, for subclasses that convert frames by
+   reading them in place. The frames use the default layout. */
+
+static GstBufferPool *
+gst_framebuffersink_allocate_converted_pool (
+    GstFramebufferSink *framebuffersink, GstCaps *caps, GstVideoInfo *info,
+    int *n)
+{
+  GstStructure *config;
+  GstBufferPool *newpool;
+  gsize used;
+
+  used = (framebuffersink->nu_screens_used +
+      framebuffersink->frame_cache.length) *
+      GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  if (used >= framebuffersink->video_memory_size)
+    return NULL;
+  *n = MIN (CONVERTED_POOL_BUFFERS,
+      (framebuffersink->video_memory_size - used) / info->size);
+  if (*n < 2)
+    return NULL;
+
+  newpool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (newpool);
+  gst_buffer_pool_config_set_params (config, caps, info->size, *n, *n);
+  gst_buffer_pool_config_set_allocator (config,
+      framebuffersink->screen_video_memory_allocator, NULL);
+  if (!gst_buffer_pool_set_config (newpool, config)) {
+    GST_ERROR_OBJECT (framebuffersink, "Failed to set buffer pool config");
+    gst_object_unref (newpool);
+    return NULL;
+  }
+  GST_INFO_OBJECT (framebuffersink, "Offering %d source frames in video "
+      "memory for conversion", *n);
+  return newpool;
+}
 
 /* Exported utility function to conveniently convert scanline alignment to the
    GstFramebufferSinkOverlayVideoAlignment information required by the
@@ -1598,6 +3680,66 @@ gst_framebuffersink_set_overlay_video_alignment_from_scanline_alignment (
   *video_alignment_matches = matches;
 }
 
+/* When the default layout of the video doesn't match the overlay alignment
+   requirements, try the layout that upstream produces when the overlay
+   padding and stride alignment are requested with
+   GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT. If the hardware accepts it, it
+   becomes the overlay layout and the buffer pool can still be used, with
+   GstVideoMeta describing the strides. */
+
+static gboolean
+gst_framebuffersink_set_overlay_pool_alignment (
+    GstFramebufferSink *framebuffersink, GstVideoInfo *info,
+    GstFramebufferSinkOverlayVideoAlignment *video_alignment,
+    gint overlay_align)
+{
+  GstFramebufferSinkClass *klass = GST_FRAMEBUFFERSINK_GET_CLASS (
+      framebuffersink);
+  GstFramebufferSinkOverlayVideoAlignment aligned_video_alignment;
+  GstVideoAlignment align;
+  GstVideoInfo aligned_info;
+  gint aligned_overlay_align;
+  gboolean matches;
+  int i;
+
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (info->finfo))
+    return FALSE;
+
+  /* GstVideoAlignment has a single horizontal padding; the luma (or only)
+     plane's padding is used and the stride alignment of every plane is
+     passed on. */
+  gst_video_alignment_reset (&align);
+  align.padding_top = video_alignment->padding_top;
+  align.padding_bottom = video_alignment->padding_bottom;
+  align.padding_left = video_alignment->padding_left[0];
+  align.padding_right = video_alignment->padding_right[0];
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
+    align.stride_align[i] = video_alignment->stride_align[i];
+  aligned_info = *info;
+  if (!gst_video_info_align (&aligned_info, &align))
+    return FALSE;
+  if (!klass->get_overlay_video_alignment (framebuffersink, &aligned_info,
+      &aligned_video_alignment, &aligned_overlay_align, &matches) || !matches)
+    return FALSE;
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&aligned_info); i++) {
+    framebuffersink->overlay_plane_offset[i] =
+        GST_VIDEO_INFO_PLANE_OFFSET (&aligned_info, i);
+    framebuffersink->overlay_scanline_offset[i] = 0;
+    framebuffersink->overlay_scanline_stride[i] =
+        GST_VIDEO_INFO_PLANE_STRIDE (&aligned_info, i);
+  }
+  framebuffersink->overlay_size = GST_VIDEO_INFO_SIZE (&aligned_info);
+  framebuffersink->overlay_align = overlay_align | aligned_overlay_align;
+  framebuffersink->overlay_pool_alignment = align;
+  framebuffersink->overlay_pool_video_meta = TRUE;
+  GST_DEBUG_OBJECT (framebuffersink, "Overlay pool layout with padding %u, "
+      "stride %d, size %d", align.padding_right,
+      framebuffersink->overlay_scanline_stride[0],
+      framebuffersink->overlay_size);
+  return TRUE;
+}
+
 static void
 gst_framebuffersink_calculate_plane_widths(GstFramebufferSink *framebuffersink,
     GstVideoInfo *info)
@@ -1653,6 +3795,22 @@ static void gst_framebuffersink_calculate_overlay_size (GstFramebufferSink *
     comp[plane] = i;
   }
   n = GST_VIDEO_INFO_N_PLANES (info);
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (info->finfo)) {
+    /* Tiled formats are shown in their own layout. The scanline stride is
+       the width of a row of tiles in bytes. */
+    for (i = 0; i < n; i++) {
+      framebuffersink->overlay_plane_offset[i] =
+          GST_VIDEO_INFO_PLANE_OFFSET (info, i);
+      framebuffersink->overlay_scanline_offset[i] = 0;
+      framebuffersink->overlay_scanline_stride[i] = GST_VIDEO_TILE_X_TILES (
+          GST_VIDEO_INFO_PLANE_STRIDE (info, i)) <<
+          GST_VIDEO_FORMAT_INFO_TILE_WS (info->finfo);
+    }
+    framebuffersink->overlay_size = GST_VIDEO_INFO_SIZE (info);
+    framebuffersink->overlay_align = overlay_align;
+    framebuffersink->overlay_alignment_is_native = TRUE;
+    return;
+  }
   int offset = 0;
   for (i = 0; i < n; i++) {
     int padded_width;
@@ -1698,14 +3856,19 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
   GstVideoFormat matched_overlay_format;
   GstVideoRectangle src_video_rectangle;
   GstVideoRectangle screen_video_rectangle;
+  gboolean converted;
+  gboolean dmabuf;
   int i;
 
   if (!gst_video_info_from_caps (&info, caps))
     goto invalid_format;
+  dmabuf = gst_caps_features_contains (gst_caps_get_features (caps, 0),
+      GST_CAPS_FEATURE_MEMORY_DMABUF);
 
   GST_OBJECT_LOCK (framebuffersink);
 
-  if (gst_video_info_is_equal(&info, &framebuffersink->video_info)) {
+  if (gst_video_info_is_equal(&info, &framebuffersink->video_info) &&
+      dmabuf == framebuffersink->dmabuf_input) {
     GST_OBJECT_UNLOCK (framebuffersink);
     GST_WARNING_OBJECT (framebuffersink, "set_caps called with same caps");
     return TRUE;
@@ -1714,6 +3877,27 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
   GST_INFO_OBJECT (framebuffersink, "Negotiated caps: %" GST_PTR_FORMAT "\n",
       caps);
 
+  /* When renegotiating (for example after a change of the adaptive
+     resolution), release the buffers set up for the previous caps, except
+     the one on display. */
+  if (framebuffersink->screens != NULL || framebuffersink->overlays != NULL) {
+    gst_framebuffersink_retire_presented_memory (framebuffersink);
+    gst_framebuffersink_free_buffers (framebuffersink);
+  }
+
+  /* The display mode may change; apply the color balance again before the
+     next frame. */
+  framebuffersink->color_balance_changed = TRUE;
+  framebuffersink->overlay_pool_video_meta = FALSE;
+
+  /* DMABuf frames are allocated upstream and copied. */
+  framebuffersink->dmabuf_input = dmabuf;
+  if (dmabuf && framebuffersink->use_buffer_pool) {
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+        "Cannot use buffer pool in video memory with DMABuf input");
+    framebuffersink->use_buffer_pool = FALSE;
+  }
+
   /* Set the video parameters for GstVideoSink. */
   framebuffersink->videosink.width = info.width;
   framebuffersink->videosink.height = info.height;
@@ -1728,6 +3912,12 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
   if (!gst_framebuffersink_video_format_supported_by_overlay (framebuffersink,
       matched_overlay_format))
     matched_overlay_format = GST_VIDEO_FORMAT_UNKNOWN;
+  /* Formats that the subclass converts while showing them, and scales if
+     it can. */
+  converted = matched_overlay_format == GST_VIDEO_FORMAT_UNKNOWN &&
+      klass->put_converted_image != NULL &&
+      gst_framebuffersink_video_format_converted (framebuffersink,
+      GST_VIDEO_INFO_FORMAT (&info));
 
   /* Set the dimensions of the source video rectangle and screen video
      rectangle. */
@@ -1743,7 +3933,8 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
       (&framebuffersink->screen_info);
 
   /* Clip and center video rectangle. */
-  if (matched_overlay_format == GST_VIDEO_FORMAT_UNKNOWN) {
+  if (matched_overlay_format == GST_VIDEO_FORMAT_UNKNOWN &&
+      !(converted && framebuffersink->converted_formats_scaled)) {
     if (framebuffersink->preserve_par && (info.par_n !=
         framebuffersink->screen_info.par_n ||
         info.par_d != framebuffersink->screen_info.par_d))
@@ -1806,6 +3997,11 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
       framebuffersink->video_rectangle.h <= 0)
     goto no_display_output_size;
 
+  framebuffersink->convert_frames = converted && (GST_VIDEO_INFO_FORMAT (
+      &info) != GST_VIDEO_INFO_FORMAT (&framebuffersink->screen_info) ||
+      framebuffersink->video_rectangle.w != info.width ||
+      framebuffersink->video_rectangle.h != info.height);
+
   if (framebuffersink->flip_buffers > 0) {
     if (framebuffersink->flip_buffers < framebuffersink->max_framebuffers)
       framebuffersink->max_framebuffers = framebuffersink->flip_buffers;
@@ -1853,7 +4049,9 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
       framebuffersink->nu_screens_used = 1;
       framebuffersink->nu_overlays_used = max_overlays;
       if (framebuffersink->use_buffer_pool) {
-        if (framebuffersink->overlay_alignment_is_native) {
+        if (framebuffersink->overlay_alignment_is_native ||
+            gst_framebuffersink_set_overlay_pool_alignment (framebuffersink,
+            &info, &overlay_video_alignment, overlay_align)) {
           GstBufferPool *pool;
           pool = gst_framebuffersink_allocate_buffer_pool (framebuffersink,
               caps, &info);
@@ -1868,6 +4066,7 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
           }
         }
         framebuffersink->use_buffer_pool = FALSE;
+        framebuffersink->overlay_pool_video_meta = FALSE;
         if (!framebuffersink->silent) {
           if (!framebuffersink->overlay_alignment_is_native)
             GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
@@ -1881,6 +4080,13 @@ gst_framebuffersink_set_caps (GstBaseSink * sink, GstCaps * caps)
          help. */
       if (framebuffersink->nu_overlays_used > 8)
         framebuffersink->nu_overlays_used = 8;
+      /* With adaptive buffers, start with the default number but allow
+         growing up to all overlays that fit. */
+      framebuffersink->overlays_array_size = framebuffersink->nu_overlays_used;
+      if (framebuffersink->adaptive_buffers) {
+        framebuffersink->overlays_array_size = max_overlays;
+        framebuffersink->adaptive_depth_active = TRUE;
+      }
       goto success_overlay;
     }
   }
@@ -1901,6 +4107,12 @@ reconfigure:
 
   /* When using buffer pools, do the appropriate checks and allocate a
      new buffer pool. */
+  if (framebuffersink->use_buffer_pool && framebuffersink->convert_frames) {
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+        "Cannot use buffer pool in video memory because the video is "
+        "converted to the screen format");
+    framebuffersink->use_buffer_pool = FALSE;
+  }
   if (framebuffersink->use_buffer_pool &&
       framebuffersink->video_rectangle_width_in_bytes !=
       GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0)) {
@@ -1966,8 +4178,20 @@ success:
         framebuffersink->nu_screens_used);
     GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
     g_free (s);
+    /* With adaptive buffers, start with the default number of screens but
+       allow growing up to the buffer-pool limit. */
+    framebuffersink->screens_array_size = framebuffersink->nu_screens_used;
+    if (framebuffersink->adaptive_buffers &&
+        framebuffersink->nu_screens_used >= ADAPTIVE_MIN_DEPTH) {
+      framebuffersink->screens_array_size = framebuffersink->max_framebuffers;
+      if (framebuffersink->flip_buffers == 0
+          && framebuffersink->screens_array_size > 10
+          && framebuffersink->max_video_memory_property != - 2)
+        framebuffersink->screens_array_size = 10;
+      framebuffersink->adaptive_depth_active = TRUE;
+    }
     framebuffersink->screens = g_slice_alloc (sizeof (GstMemory *) *
-        framebuffersink->nu_screens_used);
+        framebuffersink->screens_array_size);
     for (i = 0; i < framebuffersink->nu_screens_used; i++) {
       framebuffersink->screens[i] = gst_allocator_alloc (
         framebuffersink->screen_video_memory_allocator,
@@ -1987,6 +4211,41 @@ finish:
 
   framebuffersink->video_info = info;
 
+  /* Adaptive resolution only makes sense when the hardware scaler fills a
+     fixed output size, and is not supported with a buffer pool in video
+     memory (which is sized for the negotiated video). */
+  framebuffersink->resolution_active = framebuffersink->adaptive_resolution
+      && framebuffersink->use_hardware_overlay
+      && !framebuffersink->use_buffer_pool
+      && (framebuffersink->requested_video_width != 0 ||
+      framebuffersink->requested_video_height != 0);
+  if (framebuffersink->resolution_active) {
+    if (framebuffersink->resolution_step == 0) {
+      /* Remember the full resolution to step down from. */
+      framebuffersink->resolution_full_width = info.width;
+      framebuffersink->resolution_full_height = info.height;
+    }
+    framebuffersink->resolution_last_pts = GST_CLOCK_TIME_NONE;
+    framebuffersink->resolution_frames = 0;
+    framebuffersink->resolution_late_frames = 0;
+    framebuffersink->resolution_early_frames = 0;
+    framebuffersink->resolution_settle_windows = RESOLUTION_SETTLE_WINDOWS;
+    framebuffersink->resolution_headroom_windows = 0;
+  }
+
+  if (framebuffersink->adaptive_depth_active) {
+    int depth = framebuffersink->use_hardware_overlay ?
+        framebuffersink->nu_overlays_used : framebuffersink->nu_screens_used;
+    framebuffersink->adaptive_last_frame_time = 0;
+    framebuffersink->adaptive_average_interval = 0;
+    framebuffersink->adaptive_frames = 0;
+    framebuffersink->adaptive_pressure_frames = 0;
+    framebuffersink->adaptive_steady_windows = 0;
+    framebuffersink->stats_buffer_depth_min = depth;
+    framebuffersink->stats_buffer_depth_max = depth;
+    framebuffersink->stats_buffer_depth_changes = 0;
+  }
+
   /* Clear all used framebuffers to black. */
   if (framebuffersink->clear) {
     if (framebuffersink->use_hardware_overlay)
@@ -2004,17 +4263,21 @@ success_overlay:
 
   if (!framebuffersink->use_buffer_pool) {
     framebuffersink->screens = g_slice_alloc (sizeof (GstMemory *));
+    framebuffersink->screens_array_size = 1;
     framebuffersink->screens[0] = gst_allocator_alloc (
         framebuffersink->screen_video_memory_allocator,
         GST_VIDEO_INFO_HEIGHT (&framebuffersink->screen_info) *
         GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0), NULL);
+    if (framebuffersink->overlay_video_memory_allocator)
+      g_object_unref (framebuffersink->overlay_video_memory_allocator);
     framebuffersink->overlay_video_memory_allocator =
         klass->video_memory_allocator_new (framebuffersink, &info, FALSE, TRUE);
     framebuffersink->overlays = g_slice_alloc (sizeof (GstMemory *) *
-        framebuffersink->nu_overlays_used);
+        framebuffersink->overlays_array_size);
     for (i = 0; i < framebuffersink->nu_overlays_used; i++) {
       framebuffersink->overlays[i] = gst_allocator_alloc (
-          framebuffersink->overlay_video_memory_allocator, info.size, NULL);
+          framebuffersink->overlay_video_memory_allocator,
+          framebuffersink->overlay_size, NULL);
       if (framebuffersink->overlays[i] == NULL) {
         framebuffersink->nu_overlays_used = i;
         break;
@@ -2061,39 +4324,256 @@ overlay_failed:
   }
 }
 
-/* Reset function. Called from gst_framebuffersink_stop and when going
- * from PAUSED to READY. */
+/* Return the video memory available for screens, or for overlays in
+   overlay mode, lowered to max_video_memory MB when that is positive, and
+   in size the size of one buffer. The flip buffers and the frame cache
+   share this budget. */
+
+static guint64
+gst_framebuffersink_get_video_memory_budget (
+    GstFramebufferSink *framebuffersink, int max_video_memory, gsize *size)
+{
+  guint64 budget;
+  gsize first_overlay_offset;
+
+  if (framebuffersink->use_hardware_overlay) {
+    first_overlay_offset = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+    ALIGNMENT_APPLY (first_overlay_offset, framebuffersink->overlay_align);
+    budget = framebuffersink->video_memory_size - first_overlay_offset;
+    *size = ALIGNMENT_GET_ALIGNED (framebuffersink->overlay_size,
+        framebuffersink->overlay_align);
+  }
+  else {
+    budget = framebuffersink->pannable_video_memory_size;
+    *size = GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  }
+  if (max_video_memory > 0 &&
+      (guint64) max_video_memory * 1024 * 1024 < budget)
+    budget = (guint64) max_video_memory * 1024 * 1024;
+  return budget;
+}
+
+/* Whether another buffer fits in the video memory budget next to the flip
+   buffers and the frame cache entries. */
+
+static gboolean
+gst_framebuffersink_video_memory_budget_allows (
+    GstFramebufferSink *framebuffersink)
+{
+  guint64 budget;
+  gsize size;
+  int n;
+
+  budget = gst_framebuffersink_get_video_memory_budget (framebuffersink,
+      framebuffersink->live_max_video_memory, &size);
+  n = framebuffersink->use_hardware_overlay ?
+      framebuffersink->nu_overlays_used : framebuffersink->nu_screens_used;
+  return (guint64) (n + framebuffersink->frame_cache.length + 1) * size <=
+      budget;
+}
+
+/* Video memory frame cache. Frames copied from system memory are copied
+   into cache entries instead of the flip buffers and shown by flipping to
+   the entry, so that a frame that repeats is shown without copying it
+   again. Entries are allocated from the screen or overlay allocator until
+   frame-cache entries exist or video memory runs out; after that the least
+   recently shown entry is reused. */
+
+typedef struct {
+  GstMemory *vmem;
+  GstAllocator *allocator;
+  /* Hash and size of the source; size is 0 when the entry is invalid. */
+  guint64 hash;
+  gsize size;
+  guint64 checksum;
+  gboolean checksum_valid;
+} GstFramebufferSinkFrameCacheEntry;
+
+static void
+gst_framebuffersink_frame_cache_set_source (
+    GstFramebufferSink *framebuffersink, GstMemory *mem)
+{
+  if (framebuffersink->frame_cache_source == mem)
+    return;
+  if (framebuffersink->frame_cache_source != NULL) {
+    gst_memory_unlock (framebuffersink->frame_cache_source,
+        GST_LOCK_FLAG_EXCLUSIVE);
+    gst_memory_unref (framebuffersink->frame_cache_source);
+    framebuffersink->frame_cache_source = NULL;
+  }
+  /* Only memory that is already shared (as by imagefreeze) is kept, so that
+     a buffer pool upstream is not starved of its buffers. */
+  if (mem != NULL && !gst_memory_is_writable (mem) &&
+      gst_memory_lock (mem, GST_LOCK_FLAG_EXCLUSIVE))
+    framebuffersink->frame_cache_source = gst_memory_ref (mem);
+}
+
+static GstFramebufferSinkFrameCacheEntry *
+gst_framebuffersink_frame_cache_lookup (GstFramebufferSink *framebuffersink,
+    guint64 hash, gsize size)
+{
+  GList *l;
+
+  for (l = framebuffersink->frame_cache.head; l != NULL; l = l->next) {
+    GstFramebufferSinkFrameCacheEntry *entry = l->data;
+    if (entry->size == size && entry->hash == hash)
+      return entry;
+  }
+  return NULL;
+}
+
+/* Return an entry to copy a new frame into, or NULL if there is none. */
+
+static GstFramebufferSinkFrameCacheEntry *
+gst_framebuffersink_frame_cache_get_entry (
+    GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  GstFramebufferSinkFrameCacheEntry *entry;
+  GstAllocator *allocator;
+  GstMemory *vmem;
+  gsize size;
+
+  if (framebuffersink->frame_cache.length <
+      framebuffersink->frame_cache_size &&
+      gst_framebuffersink_video_memory_budget_allows (framebuffersink)) {
+    if (framebuffersink->use_hardware_overlay) {
+      allocator = framebuffersink->overlay_video_memory_allocator;
+      size = framebuffersink->overlay_size;
+    }
+    else {
+      allocator = framebuffersink->screen_video_memory_allocator;
+      size = GST_VIDEO_INFO_HEIGHT (&framebuffersink->screen_info) *
+          GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+    }
+    vmem = gst_allocator_alloc (allocator, size, NULL);
+    /* Screen memory that pan_display can't reach is of no use. */
+    if (vmem != NULL && !framebuffersink->use_hardware_overlay &&
+        klass->video_memory_is_pannable != NULL &&
+        !klass->video_memory_is_pannable (framebuffersink, vmem)) {
+      gst_allocator_free (allocator, vmem);
+      vmem = NULL;
+    }
+    if (vmem != NULL) {
+      if (!framebuffersink->use_hardware_overlay && framebuffersink->clear)
+        gst_framebuffersink_clear_memory (framebuffersink, vmem);
+      entry = g_slice_new0 (GstFramebufferSinkFrameCacheEntry);
+      entry->vmem = vmem;
+      entry->allocator = allocator;
+      return entry;
+    }
+  }
+  if (framebuffersink->frame_cache.length <= FRAME_CACHE_RESERVED)
+    return NULL;
+  entry = g_queue_peek_tail (&framebuffersink->frame_cache);
+  entry->size = 0;
+  return entry;
+}
+
+/* Free the least recently shown entry. Returns FALSE if there is none that
+   can be freed. */
+
+static gboolean
+gst_framebuffersink_frame_cache_shrink (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkFrameCacheEntry *entry;
+
+  if (framebuffersink->frame_cache.length <= FRAME_CACHE_RESERVED)
+    return FALSE;
+  entry = g_queue_pop_tail (&framebuffersink->frame_cache);
+  gst_allocator_free (entry->allocator, entry->vmem);
+  g_slice_free (GstFramebufferSinkFrameCacheEntry, entry);
+  return TRUE;
+}
+
+/* Make all entries miss, for example after a change of the software color
+   balance. The video memory is kept for reuse. */
+
+static void
+gst_framebuffersink_frame_cache_invalidate (
+    GstFramebufferSink *framebuffersink)
+{
+  GList *l;
+
+  for (l = framebuffersink->frame_cache.head; l != NULL; l = l->next)
+    ((GstFramebufferSinkFrameCacheEntry *) l->data)->size = 0;
+  gst_framebuffersink_frame_cache_set_source (framebuffersink, NULL);
+}
+
+static void
+gst_framebuffersink_frame_cache_flush (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkFrameCacheEntry *entry;
+
+  while ((entry = g_queue_pop_head (&framebuffersink->frame_cache)) != NULL) {
+    gst_allocator_free (entry->allocator, entry->vmem);
+    g_slice_free (GstFramebufferSinkFrameCacheEntry, entry);
+  }
+  gst_framebuffersink_frame_cache_set_source (framebuffersink, NULL);
+  framebuffersink->frame_cache_shown = FALSE;
+}
+
+/* Free the screen and overlay buffers allocated by set_caps when not using a
+   buffer pool. */
 
 static void
-gst_framebuffersink_reset (GstFramebufferSink *framebuffersink)
+gst_framebuffersink_free_buffers (GstFramebufferSink *framebuffersink)
 {
   int i;
   /* Free screen buffers, but be careful because in buffer-pool mode,
      nu_screens_used will be > 0 but screens will be NULL. */
   if (framebuffersink->screens != NULL)  {
     for (i = 0; i < framebuffersink->nu_screens_used; i++)
-      gst_allocator_free (framebuffersink->screen_video_memory_allocator,
-          framebuffersink->screens[i]);
-    if (framebuffersink->nu_screens_used > 0)
-      g_slice_free1 (sizeof (GstMemory *) * framebuffersink->nu_screens_used,
+      if (framebuffersink->screens[i] != NULL)
+        gst_allocator_free (framebuffersink->screen_video_memory_allocator,
+            framebuffersink->screens[i]);
+    if (framebuffersink->screens_array_size > 0)
+      g_slice_free1 (sizeof (GstMemory *) * framebuffersink->screens_array_size,
           framebuffersink->screens);
   }
 
   /* Free overlay buffers. */
   if (framebuffersink->overlays != NULL) {
     for (i = 0; i < framebuffersink->nu_overlays_used; i++)
-      gst_allocator_free (framebuffersink->overlay_video_memory_allocator,
-          framebuffersink->overlays[i]);
-    if (framebuffersink->nu_overlays_used > 0)
-      g_slice_free1 (sizeof (GstMemory *) * framebuffersink->nu_overlays_used,
-          framebuffersink->overlays);
+      if (framebuffersink->overlays[i] != NULL)
+        gst_allocator_free (framebuffersink->overlay_video_memory_allocator,
+            framebuffersink->overlays[i]);
+    if (framebuffersink->overlays_array_size > 0)
+      g_slice_free1 (sizeof (GstMemory *) *
+          framebuffersink->overlays_array_size, framebuffersink->overlays);
   }
 
   framebuffersink->current_framebuffer_index = 0;
   framebuffersink->nu_screens_used = 0;
   framebuffersink->screens = NULL;
+  framebuffersink->screens_array_size = 0;
   framebuffersink->nu_overlays_used = 0;
   framebuffersink->overlays = NULL;
+  framebuffersink->overlays_array_size = 0;
+  framebuffersink->adaptive_depth_active = FALSE;
+  framebuffersink->live_depth_target = 0;
+  framebuffersink->prepared_buffer = NULL;
+  gst_framebuffersink_frame_cache_flush (framebuffersink);
+}
+
+/* Reset function. Called from gst_framebuffersink_stop and when going
+ * from PAUSED to READY. */
+
+static void
+gst_framebuffersink_reset (GstFramebufferSink *framebuffersink)
+{
+  gst_framebuffersink_release_retired_memory (framebuffersink);
+  gst_framebuffersink_free_buffers (framebuffersink);
+  framebuffersink->presented_memory = NULL;
+  gst_framebuffersink_free_thumbnails (framebuffersink);
+  g_free (framebuffersink->color_balance_frame);
+  framebuffersink->color_balance_frame = NULL;
+  framebuffersink->color_balance_frame_size = 0;
+
+  framebuffersink->resolution_step = 0;
+  framebuffersink->resolution_width = 0;
+  framebuffersink->resolution_height = 0;
 
   GST_OBJECT_LOCK (framebuffersink);
   if (framebuffersink->pool) {
@@ -2125,49 +4605,842 @@ gst_framebuffersink_reset (GstFramebufferSink *framebuffersink)
   }
 }
 
-/* The stop function should release resources. */
+/* The stop function should release resources. */
+
+static gboolean
+gst_framebuffersink_stop (GstBaseSink * sink)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  char s[128];
+
+  GST_DEBUG_OBJECT (framebuffersink, "stop");
+
+  sprintf(s, "%d frames rendered, %d from system memory, %d from video memory",
+      framebuffersink->stats_video_frames_video_memory +
+      framebuffersink->stats_overlay_frames_video_memory +
+      framebuffersink->stats_video_frames_system_memory +
+      framebuffersink->stats_overlay_frames_system_memory,
+      framebuffersink->stats_video_frames_system_memory +
+      framebuffersink->stats_overlay_frames_system_memory,
+      framebuffersink->stats_video_frames_video_memory +
+      framebuffersink->stats_overlay_frames_video_memory);
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+
+  if (framebuffersink->adaptive_depth_active) {
+    gboolean overlay = framebuffersink->use_hardware_overlay;
+    sprintf(s, "Adaptive buffering: %d %s at end (range %d-%d, max %d), "
+        "%d adjustments",
+        overlay ? framebuffersink->nu_overlays_used :
+        framebuffersink->nu_screens_used, overlay ? "overlays" : "screens",
+        framebuffersink->stats_buffer_depth_min,
+        framebuffersink->stats_buffer_depth_max,
+        overlay ? framebuffersink->overlays_array_size :
+        framebuffersink->screens_array_size,
+        framebuffersink->stats_buffer_depth_changes);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->adaptive_resolution) {
+    sprintf(s, "Adaptive resolution: %d source resolution changes",
+        framebuffersink->stats_resolution_changes);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->scheduling_policy_in_effect >= 0) {
+    int policy = framebuffersink->scheduling_policy_in_effect;
+    sprintf(s, "Streaming thread scheduling: %s, priority %d",
+        policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" :
+        "SCHED_OTHER", framebuffersink->scheduling_priority_in_effect);
+    if (framebuffersink->cpu_affinity != 0)
+      sprintf(s + strlen (s), ", CPU affinity mask 0x%x",
+          framebuffersink->cpu_affinity);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  /* The streaming thread belongs to upstream, which is still paused and
+     keeps the thread alive. */
+  gst_framebuffersink_restore_scheduling (framebuffersink, TRUE);
+  if (framebuffersink->stats_frames_prepared > 0) {
+    sprintf(s, "%d frames uploaded before the clock wait",
+        framebuffersink->stats_frames_prepared);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->stats_dmabuf_frames > 0) {
+    sprintf(s, "%d frames copied from DMABuf memory",
+        framebuffersink->stats_dmabuf_frames);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->stats_frame_cache_hits +
+      framebuffersink->stats_frame_cache_misses > 0) {
+    sprintf(s, "%d of %d frames shown from the frame cache",
+        framebuffersink->stats_frame_cache_hits,
+        framebuffersink->stats_frame_cache_hits +
+        framebuffersink->stats_frame_cache_misses);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->stats_missed_deadlines > 0) {
+    sprintf(s, "%d frames missed their deadline (max %.1lf ms late)",
+        framebuffersink->stats_missed_deadlines,
+        (double) framebuffersink->stats_max_lateness / GST_MSECOND);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->stats_presentation_stalls > 0) {
+    sprintf(s, "Presentation watchdog: %d stalled vsync waits or page flips, "
+        "fell back to software pacing %d times",
+        framebuffersink->stats_presentation_stalls,
+        framebuffersink->stats_presentation_fallbacks);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->group != NULL) {
+    gchar *str;
+    str = g_strdup_printf ("Presentation group %s: %d frames presented "
+        "together, skew average %.2lf ms, max %.2lf ms, %d timeouts, "
+        "%d frames dropped to catch up",
+        framebuffersink->group_name, framebuffersink->stats_group_frames,
+        framebuffersink->stats_group_frames == 0 ? 0.0 :
+        (double) framebuffersink->stats_group_skew_total /
+        framebuffersink->stats_group_frames / GST_MSECOND,
+        (double) framebuffersink->stats_group_skew_max / GST_MSECOND,
+        framebuffersink->stats_group_timeouts,
+        framebuffersink->stats_group_drops);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, str);
+    g_free (str);
+    gst_framebuffersink_group_leave (framebuffersink);
+  }
+
+  if (framebuffersink->checksum_enabled) {
+    sprintf(s, "%d frame checksums computed",
+        framebuffersink->stats_checksummed_frames);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  }
+  if (framebuffersink->checksum_file != NULL) {
+    fclose (framebuffersink->checksum_file);
+    framebuffersink->checksum_file = NULL;
+  }
+  if (framebuffersink->shared_ring != NULL) {
+    sprintf(s, "%" G_GUINT64_FORMAT " frames published in shared memory",
+        framebuffersink->shared_ring_frames);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+    gst_framebuffersink_shared_ring_close (framebuffersink);
+  }
+  if (framebuffersink->stats_perf_frames > 0) {
+    gchar *str;
+    double n = framebuffersink->stats_perf_frames;
+    str = g_strdup_printf ("Copy: %d frames, average %.2lf ms, max %.2lf ms",
+        framebuffersink->stats_perf_frames,
+        (double) framebuffersink->stats_perf_time_total / n / GST_MSECOND,
+        (double) framebuffersink->stats_perf_time_max / GST_MSECOND);
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, str);
+    g_free (str);
+    if (framebuffersink->perf_group_size > 0) {
+      str = g_strdup_printf ("Copy per frame: %.0lf cycles, %.2lf "
+          "instructions per cycle, %.0lf cache misses, %.0lf dTLB misses",
+          framebuffersink->stats_perf_value[0] / n,
+          framebuffersink->stats_perf_value[0] == 0 ? 0.0 :
+          (double) framebuffersink->stats_perf_value[1] /
+          framebuffersink->stats_perf_value[0],
+          framebuffersink->stats_perf_value[2] / n,
+          framebuffersink->stats_perf_value[3] / n);
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, str);
+      g_free (str);
+    }
+  }
+  gst_framebuffersink_perf_close (framebuffersink);
+
+  gst_framebuffersink_reset (framebuffersink);
+
+  /* Free the screen allocator. */
+  g_object_unref (framebuffersink->screen_video_memory_allocator);
+
+  klass->close_hardware (framebuffersink);
+
+  /* The device property string should probably not be freed because start
+     may be called again. */
+  /* g_free (framebuffersink->device); */
+
+  return TRUE;
+}
+
+/* The show frame function can deal with both video memory buffers
+   that require a pan and with regular buffers that need to be memcpy-ed.
+   There are seperate show_frame functions for overlays (with a video memory
+   or a system memory buffer pool), screen buffers with buffer 
+   pool in video memory, and screen buffers with a buffer pool in
+   system memory. */
+
+/* Determine how late a buffer is being shown according to the pipeline
+   clock (negative when early). Returns FALSE if this can't be determined. */
+
+static gboolean
+gst_framebuffersink_get_buffer_lateness (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf, GstClockTimeDiff *lateness)
+{
+  GstBaseSink *basesink = GST_BASE_SINK (framebuffersink);
+  GstClock *clock;
+  GstClockTime running_time;
+  GstClockTime clock_time;
+  GstClockTime base_time;
+  GstClockTime duration;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buf))
+    return FALSE;
+  clock = gst_element_get_clock (GST_ELEMENT_CAST (framebuffersink));
+  if (clock == NULL)
+    return FALSE;
+  running_time = gst_segment_to_running_time (&basesink->segment,
+      GST_FORMAT_TIME, GST_BUFFER_PTS (buf));
+  clock_time = gst_clock_get_time (clock);
+  base_time = gst_element_get_base_time (GST_ELEMENT_CAST (framebuffersink));
+  gst_object_unref (clock);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time) || clock_time < base_time)
+    return FALSE;
+  duration = GST_BUFFER_DURATION_IS_VALID (buf) ? GST_BUFFER_DURATION (buf) :
+      0;
+  *lateness = (GstClockTimeDiff) (clock_time - base_time) -
+      (GstClockTimeDiff) (running_time + duration);
+  return TRUE;
+}
+
+/* Grow or shrink the active set of screen buffers (page flipping) or overlay
+   buffers by one. Buffers beyond the active set are returned to the
+   allocator. The set is not shrunk below min_depth or while the buffer that
+   would be freed is being displayed. Returns TRUE if the depth was
+   changed. */
+
+static gboolean
+gst_framebuffersink_step_buffer_depth (GstFramebufferSink *framebuffersink,
+    gboolean grow, int min_depth)
+{
+  GstMemory **buffers;
+  GstAllocator *allocator;
+  int *n;
+  int *index;
+  int max;
+  gsize size;
+
+  if (framebuffersink->use_hardware_overlay) {
+    buffers = framebuffersink->overlays;
+    allocator = framebuffersink->overlay_video_memory_allocator;
+    n = &framebuffersink->nu_overlays_used;
+    index = &framebuffersink->current_overlay_index;
+    max = framebuffersink->overlays_array_size;
+    size = framebuffersink->overlay_size;
+  }
+  else {
+    buffers = framebuffersink->screens;
+    allocator = framebuffersink->screen_video_memory_allocator;
+    n = &framebuffersink->nu_screens_used;
+    index = &framebuffersink->current_framebuffer_index;
+    max = framebuffersink->screens_array_size;
+    size = GST_VIDEO_INFO_HEIGHT (&framebuffersink->screen_info) *
+        GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+  }
+
+  if (grow) {
+    if (*n >= max)
+      return FALSE;
+    /* Video memory used by the frame cache is given back first. */
+    while (!gst_framebuffersink_video_memory_budget_allows (framebuffersink)
+        && gst_framebuffersink_frame_cache_shrink (framebuffersink));
+    buffers[*n] = gst_allocator_alloc (allocator, size, NULL);
+    while (buffers[*n] == NULL &&
+        gst_framebuffersink_frame_cache_shrink (framebuffersink))
+      buffers[*n] = gst_allocator_alloc (allocator, size, NULL);
+    if (buffers[*n] == NULL) {
+      /* Out of video memory; don't try to grow any further. */
+      if (framebuffersink->use_hardware_overlay)
+        framebuffersink->overlays_array_size = *n;
+      else
+        framebuffersink->screens_array_size = *n;
+      return FALSE;
+    }
+    (*n)++;
+    if (!framebuffersink->use_hardware_overlay && framebuffersink->clear)
+      gst_framebuffersink_clear_screen (framebuffersink, *n - 1);
+  }
+  else {
+    /* The buffer that is currently displayed is the one before index; don't
+       free it if it's the last one. */
+    if (*n <= min_depth || *index == 0)
+      return FALSE;
+    (*n)--;
+    gst_allocator_free (allocator, buffers[*n]);
+    buffers[*n] = NULL;
+    if (*index >= *n)
+      *index = 0;
+  }
+  return TRUE;
+}
+
+/* Adaptive buffer depth. Grow or shrink the active depth by one and keep
+   the depth statistics. Returns TRUE if the depth was changed. */
+
+static gboolean
+gst_framebuffersink_adapt_buffer_depth (GstFramebufferSink *framebuffersink,
+    gboolean grow)
+{
+  int n;
+
+  if (!gst_framebuffersink_step_buffer_depth (framebuffersink, grow,
+      ADAPTIVE_MIN_DEPTH))
+    return FALSE;
+
+  n = framebuffersink->use_hardware_overlay ?
+      framebuffersink->nu_overlays_used : framebuffersink->nu_screens_used;
+  if (n < framebuffersink->stats_buffer_depth_min)
+    framebuffersink->stats_buffer_depth_min = n;
+  if (n > framebuffersink->stats_buffer_depth_max)
+    framebuffersink->stats_buffer_depth_max = n;
+  framebuffersink->stats_buffer_depth_changes++;
+  GST_INFO_OBJECT (framebuffersink, "Adaptive buffering: now using %d %s",
+      n, framebuffersink->use_hardware_overlay ? "overlays" : "screens");
+  return TRUE;
+}
+
+/* Record the arrival of a frame and periodically adjust the buffer depth.
+   A frame counts as pressure when it is late according to the clock, or
+   when its arrival interval deviates strongly from the average interval
+   (upstream delivering frames in bursts). */
+
+static void
+gst_framebuffersink_update_adaptive_depth (GstFramebufferSink *framebuffersink,
+    gboolean have_lateness, GstClockTimeDiff lateness)
+{
+  gint64 now;
+  gint64 interval;
+  gboolean pressure;
+
+  now = g_get_monotonic_time ();
+  pressure = FALSE;
+  if (framebuffersink->adaptive_last_frame_time != 0) {
+    interval = now - framebuffersink->adaptive_last_frame_time;
+    if (framebuffersink->adaptive_average_interval == 0)
+      framebuffersink->adaptive_average_interval = interval;
+    else {
+      if (interval * 4 < framebuffersink->adaptive_average_interval ||
+          interval > framebuffersink->adaptive_average_interval * 2)
+        pressure = TRUE;
+      framebuffersink->adaptive_average_interval =
+          (framebuffersink->adaptive_average_interval * 7 + interval) / 8;
+    }
+  }
+  framebuffersink->adaptive_last_frame_time = now;
+
+  if (have_lateness && lateness > 0)
+    pressure = TRUE;
+
+  if (pressure)
+    framebuffersink->adaptive_pressure_frames++;
+  framebuffersink->adaptive_frames++;
+  if (framebuffersink->adaptive_frames < ADAPTIVE_WINDOW_FRAMES)
+    return;
+
+  if (framebuffersink->adaptive_pressure_frames * ADAPTIVE_PRESSURE_RATIO >
+      framebuffersink->adaptive_frames) {
+    framebuffersink->adaptive_steady_windows = 0;
+    gst_framebuffersink_adapt_buffer_depth (framebuffersink, TRUE);
+  }
+  else if (framebuffersink->adaptive_pressure_frames == 0) {
+    framebuffersink->adaptive_steady_windows++;
+    if (framebuffersink->adaptive_steady_windows >= ADAPTIVE_STEADY_WINDOWS &&
+        gst_framebuffersink_adapt_buffer_depth (framebuffersink, FALSE))
+      framebuffersink->adaptive_steady_windows = 0;
+  }
+  else
+    framebuffersink->adaptive_steady_windows = 0;
+  framebuffersink->adaptive_frames = 0;
+  framebuffersink->adaptive_pressure_frames = 0;
+}
+
+/* Adaptive source resolution. When the hardware scaler is used to fill the
+   requested output size, the source resolution asked from upstream can be
+   lowered when frames are late or dropped (the pipeline is CPU-bound) and
+   raised again when there is sustained headroom. A change is applied by
+   dropping the stored caps and sending a RECONFIGURE event upstream. */
+
+static const int resolution_steps[] = { 8, 6, 4, 3, 2 };
+#define RESOLUTION_STEP_COUNT ((int) (sizeof (resolution_steps) / sizeof (int)))
+
+static void
+gst_framebuffersink_set_resolution_step (GstFramebufferSink *framebuffersink,
+    int step)
+{
+  gchar *s;
+
+  GST_OBJECT_LOCK (framebuffersink);
+  framebuffersink->resolution_step = step;
+  if (step == 0) {
+    framebuffersink->resolution_width = 0;
+    framebuffersink->resolution_height = 0;
+  }
+  else {
+    /* Keep the width a multiple of 8 and the height even so that all planar
+       formats remain usable. */
+    framebuffersink->resolution_width = (framebuffersink->resolution_full_width
+        * resolution_steps[step] / 8) & ~7;
+    framebuffersink->resolution_height =
+        (framebuffersink->resolution_full_height * resolution_steps[step] / 8)
+        & ~1;
+    if (framebuffersink->resolution_width < 16)
+      framebuffersink->resolution_width = 16;
+    if (framebuffersink->resolution_height < 16)
+      framebuffersink->resolution_height = 16;
+  }
+  if (framebuffersink->caps) {
+    gst_caps_unref (framebuffersink->caps);
+    framebuffersink->caps = NULL;
+  }
+  GST_OBJECT_UNLOCK (framebuffersink);
+
+  s = g_strdup_printf ("Adaptive resolution: requesting %d x %d source video",
+      step == 0 ? framebuffersink->resolution_full_width :
+      framebuffersink->resolution_width,
+      step == 0 ? framebuffersink->resolution_full_height :
+      framebuffersink->resolution_height);
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  g_free (s);
+  framebuffersink->stats_resolution_changes++;
+
+  gst_pad_push_event (GST_BASE_SINK_PAD (framebuffersink),
+      gst_event_new_reconfigure ());
+}
+
+static void
+gst_framebuffersink_update_adaptive_resolution (
+    GstFramebufferSink *framebuffersink, GstBuffer *buf,
+    gboolean have_lateness, GstClockTimeDiff lateness)
+{
+  GstClockTime duration;
+
+  duration = GST_BUFFER_DURATION_IS_VALID (buf) ? GST_BUFFER_DURATION (buf) :
+      GST_CLOCK_TIME_NONE;
+
+  /* Frames dropped by the QoS handling in GstBaseSink show up as gaps in the
+     timestamps. */
+  if (GST_CLOCK_TIME_IS_VALID (duration) && duration > 0 &&
+      GST_BUFFER_PTS_IS_VALID (buf) &&
+      GST_CLOCK_TIME_IS_VALID (framebuffersink->resolution_last_pts) &&
+      GST_BUFFER_PTS (buf) > framebuffersink->resolution_last_pts +
+      duration * 3 / 2)
+    framebuffersink->resolution_late_frames += (GST_BUFFER_PTS (buf) -
+        framebuffersink->resolution_last_pts) / duration - 1;
+  framebuffersink->resolution_last_pts = GST_BUFFER_PTS (buf);
+
+  if (have_lateness) {
+    if (lateness > 0)
+      framebuffersink->resolution_late_frames++;
+    else if (GST_CLOCK_TIME_IS_VALID (duration) &&
+        - lateness > (GstClockTimeDiff) duration / 2)
+      framebuffersink->resolution_early_frames++;
+  }
+
+  framebuffersink->resolution_frames++;
+  if (framebuffersink->resolution_frames < RESOLUTION_WINDOW_FRAMES)
+    return;
+
+  if (framebuffersink->resolution_settle_windows > 0)
+    /* Give upstream time to settle after a change. */
+    framebuffersink->resolution_settle_windows--;
+  else if (framebuffersink->resolution_late_frames * 5 >
+      framebuffersink->resolution_frames) {
+    framebuffersink->resolution_headroom_windows = 0;
+    if (framebuffersink->resolution_step < RESOLUTION_STEP_COUNT - 1) {
+      gst_framebuffersink_set_resolution_step (framebuffersink,
+          framebuffersink->resolution_step + 1);
+      framebuffersink->resolution_settle_windows = RESOLUTION_SETTLE_WINDOWS;
+    }
+  }
+  else if (framebuffersink->resolution_late_frames == 0 &&
+      framebuffersink->resolution_early_frames * 10 >=
+      framebuffersink->resolution_frames * 9) {
+    /* Stepping up requires a longer period of headroom than stepping down
+       requires lateness, to avoid oscillating between two sizes. */
+    framebuffersink->resolution_headroom_windows++;
+    if (framebuffersink->resolution_headroom_windows >=
+        RESOLUTION_HEADROOM_WINDOWS && framebuffersink->resolution_step > 0) {
+      gst_framebuffersink_set_resolution_step (framebuffersink,
+          framebuffersink->resolution_step - 1);
+      framebuffersink->resolution_settle_windows = RESOLUTION_SETTLE_WINDOWS;
+      framebuffersink->resolution_headroom_windows = 0;
+    }
+  }
+  else
+    framebuffersink->resolution_headroom_windows = 0;
+
+  framebuffersink->resolution_frames = 0;
+  framebuffersink->resolution_late_frames = 0;
+  framebuffersink->resolution_early_frames = 0;
+}
+
+/* Live presentation properties. vsync and pan-does-vsync take effect with
+   the next frame. In non-buffer-pool mode, flip-buffers and video-memory
+   resize the set of screens or overlays by one buffer per frame. A change of
+   buffer-pool, or of the buffer count while using a buffer pool, sets up the
+   buffers for the current caps again and sends a RECONFIGURE event upstream
+   so that the allocation is renegotiated. */
+
+/* Resize the array holding the active set of screens or overlays, keeping
+   the buffers in use. */
+
+static void
+gst_framebuffersink_resize_buffer_array (GstFramebufferSink *framebuffersink,
+    int size)
+{
+  GstMemory ***buffers;
+  GstMemory **new_buffers;
+  int *array_size;
+  int n;
+
+  if (framebuffersink->use_hardware_overlay) {
+    buffers = &framebuffersink->overlays;
+    array_size = &framebuffersink->overlays_array_size;
+    n = framebuffersink->nu_overlays_used;
+  }
+  else {
+    buffers = &framebuffersink->screens;
+    array_size = &framebuffersink->screens_array_size;
+    n = framebuffersink->nu_screens_used;
+  }
+  if (size < n)
+    size = n;
+  if (size == *array_size)
+    return;
+  new_buffers = g_slice_alloc0 (sizeof (GstMemory *) * size);
+  memcpy (new_buffers, *buffers, sizeof (GstMemory *) * n);
+  g_slice_free1 (sizeof (GstMemory *) * *array_size, *buffers);
+  *buffers = new_buffers;
+  *array_size = size;
+}
+
+/* Return the number of screens or overlays that set_caps would use in
+   non-buffer-pool mode with the given flip-buffers and video-memory values,
+   and in ceiling the limit for adaptive buffering. A positive video-memory
+   value can only lower the budget below the video memory that was set up
+   when the hardware was opened. */
+
+static int
+gst_framebuffersink_get_live_depth (GstFramebufferSink *framebuffersink,
+    int flip_buffers, int max_video_memory, int *ceiling)
+{
+  guint64 budget;
+  gsize size;
+  int max;
+  int depth;
+
+  budget = gst_framebuffersink_get_video_memory_budget (framebuffersink,
+      max_video_memory, &size);
+  max = budget / size;
+
+  if (framebuffersink->use_hardware_overlay) {
+    if (max_video_memory != - 2 && max > 30)
+      max = 30;
+    depth = MIN (max, 8);
+    *ceiling = max;
+  }
+  else {
+    if (flip_buffers > 0 && flip_buffers < max)
+      max = flip_buffers;
+    depth = max;
+    if (flip_buffers == 0 && depth > 3)
+      depth = 3;
+    *ceiling = max;
+    if (flip_buffers == 0 && *ceiling > 10 && max_video_memory != - 2)
+      *ceiling = 10;
+  }
+  if (depth < 1)
+    depth = 1;
+  if (*ceiling < depth)
+    *ceiling = depth;
+  return depth;
+}
+
+static void
+gst_framebuffersink_release_retired_memory (
+    GstFramebufferSink *framebuffersink)
+{
+  if (framebuffersink->retired_memory == NULL)
+    return;
+  if (framebuffersink->presented_memory == framebuffersink->retired_memory)
+    framebuffersink->presented_memory = NULL;
+  gst_allocator_free (framebuffersink->retired_allocator,
+      framebuffersink->retired_memory);
+  gst_object_unref (framebuffersink->retired_allocator);
+  framebuffersink->retired_memory = NULL;
+  framebuffersink->retired_allocator = NULL;
+  framebuffersink->retired_frames = 0;
+}
+
+/* Take the buffer on display out of the screens, overlays or frame cache,
+   so that setting up the buffers again does not free it while it is being
+   scanned out. */
+
+static void
+gst_framebuffersink_retire_presented_memory (
+    GstFramebufferSink *framebuffersink)
+{
+  GstMemory *mem = framebuffersink->presented_memory;
+  GstAllocator *allocator = NULL;
+  GList *l;
+  int i;
+
+  gst_framebuffersink_release_retired_memory (framebuffersink);
+  if (mem == NULL)
+    return;
+
+  for (l = framebuffersink->frame_cache.head; l != NULL; l = l->next) {
+    GstFramebufferSinkFrameCacheEntry *entry = l->data;
+    if (entry->vmem == mem) {
+      allocator = entry->allocator;
+      g_queue_delete_link (&framebuffersink->frame_cache, l);
+      g_slice_free (GstFramebufferSinkFrameCacheEntry, entry);
+      goto found;
+    }
+  }
+  if (framebuffersink->screens != NULL)
+    for (i = 0; i < framebuffersink->nu_screens_used; i++)
+      if (framebuffersink->screens[i] == mem) {
+        allocator = framebuffersink->screen_video_memory_allocator;
+        framebuffersink->screens[i] = NULL;
+        goto found;
+      }
+  if (framebuffersink->overlays != NULL)
+    for (i = 0; i < framebuffersink->nu_overlays_used; i++)
+      if (framebuffersink->overlays[i] == mem) {
+        allocator = framebuffersink->overlay_video_memory_allocator;
+        framebuffersink->overlays[i] = NULL;
+        goto found;
+      }
+  /* Buffer pool memory stays with its buffer. */
+  return;
+
+found:
+  framebuffersink->retired_memory = mem;
+  framebuffersink->retired_allocator = gst_object_ref (allocator);
+  /* The flip away from it has completed once a second frame is shown. */
+  framebuffersink->retired_frames = 2;
+}
+
+/* Set up the buffers for the current caps again in the given buffer pool
+   mode. The pool is only released; upstream deactivates it when it
+   renegotiates the allocation after the RECONFIGURE event. */
+
+static gboolean
+gst_framebuffersink_renegotiate_buffers (GstFramebufferSink *framebuffersink,
+    gboolean use_buffer_pool)
+{
+  GstCaps *caps;
+  gboolean res;
+
+  caps = gst_pad_get_current_caps (GST_BASE_SINK_PAD (framebuffersink));
+  if (caps == NULL)
+    return FALSE;
+
+  GST_OBJECT_LOCK (framebuffersink);
+  if (framebuffersink->pool) {
+    gst_object_unref (framebuffersink->pool);
+    framebuffersink->pool = NULL;
+  }
+  framebuffersink->use_buffer_pool = use_buffer_pool;
+  /* set_caps lowers max_framebuffers to flip-buffers. */
+  framebuffersink->max_framebuffers =
+      framebuffersink->pannable_video_memory_size /
+      GST_VIDEO_INFO_SIZE (&framebuffersink->screen_info);
+  /* Make set_caps treat the caps as new. */
+  gst_video_info_init (&framebuffersink->video_info);
+  GST_OBJECT_UNLOCK (framebuffersink);
+
+  res = gst_framebuffersink_set_caps (GST_BASE_SINK (framebuffersink), caps);
+  gst_caps_unref (caps);
+  return res;
+}
+
+static void
+gst_framebuffersink_apply_live_properties (GstFramebufferSink *framebuffersink)
+{
+  gboolean use_buffer_pool;
+  gboolean depth_changed;
+  int flip_buffers;
+  int max_video_memory;
+  int depth;
+  int ceiling;
+  int n;
+  gchar *s;
+
+  GST_OBJECT_LOCK (framebuffersink);
+  framebuffersink->live_properties_changed = FALSE;
+  use_buffer_pool = framebuffersink->use_buffer_pool_property;
+  flip_buffers = framebuffersink->flip_buffers;
+  max_video_memory = framebuffersink->max_video_memory_property;
+  GST_OBJECT_UNLOCK (framebuffersink);
+
+  /* Hardware without vsync or page flipping keeps the settings made when it
+     was opened. */
+  if (framebuffersink->live_properties_fixed)
+    return;
+
+  framebuffersink->vsync = framebuffersink->vsync_property;
+
+  depth_changed = flip_buffers != framebuffersink->live_flip_buffers ||
+      max_video_memory != framebuffersink->live_max_video_memory;
+  if (use_buffer_pool == framebuffersink->live_buffer_pool && !depth_changed)
+    return;
+  framebuffersink->live_flip_buffers = flip_buffers;
+  framebuffersink->live_max_video_memory = max_video_memory;
+
+  if (use_buffer_pool && (!framebuffersink->live_buffer_pool ||
+      framebuffersink->use_buffer_pool)) {
+    /* Set up the (resized) pool right away; upstream picks it up when it
+       renegotiates the allocation. */
+    framebuffersink->live_buffer_pool = TRUE;
+    if (!gst_framebuffersink_renegotiate_buffers (framebuffersink, TRUE))
+      return;
+    if (framebuffersink->use_buffer_pool) {
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+          "Buffer pool changed, renegotiating allocation with upstream");
+      framebuffersink->live_pool_switch_pending = TRUE;
+    }
+    gst_pad_push_event (GST_BASE_SINK_PAD (framebuffersink),
+        gst_event_new_reconfigure ());
+    return;
+  }
+
+  if (!use_buffer_pool && framebuffersink->live_buffer_pool) {
+    framebuffersink->live_buffer_pool = FALSE;
+    if (framebuffersink->use_buffer_pool) {
+      /* Keep showing buffers from the pool until upstream has switched to
+         system memory; the screen buffers are set up at that point. Upstream
+         deactivates the pool when it renegotiates. */
+      GST_OBJECT_LOCK (framebuffersink);
+      if (framebuffersink->pool) {
+        gst_object_unref (framebuffersink->pool);
+        framebuffersink->pool = NULL;
+      }
+      GST_OBJECT_UNLOCK (framebuffersink);
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+          "Buffer pool disabled, renegotiating allocation with upstream");
+      framebuffersink->live_pool_switch_pending = TRUE;
+      gst_pad_push_event (GST_BASE_SINK_PAD (framebuffersink),
+          gst_event_new_reconfigure ());
+      return;
+    }
+  }
+
+  if (!depth_changed || framebuffersink->use_buffer_pool ||
+      (framebuffersink->use_hardware_overlay ? framebuffersink->overlays :
+      framebuffersink->screens) == NULL)
+    return;
+
+  n = framebuffersink->use_hardware_overlay ?
+      framebuffersink->nu_overlays_used : framebuffersink->nu_screens_used;
+  depth = gst_framebuffersink_get_live_depth (framebuffersink, flip_buffers,
+      max_video_memory, &ceiling);
+  if (framebuffersink->adaptive_depth_active)
+    /* Adaptive buffering keeps its own depth within the new limit. */
+    depth = MIN (n, ceiling);
+  else
+    ceiling = depth;
+  gst_framebuffersink_resize_buffer_array (framebuffersink,
+      MAX (depth, ceiling));
+  framebuffersink->live_depth_target = depth;
+  framebuffersink->live_depth_ceiling = ceiling;
+
+  s = g_strdup_printf ("Changing the number of %s from %d to %d",
+      framebuffersink->use_hardware_overlay ? "overlays" : "screens", n, depth);
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  g_free (s);
+}
+
+/* While a buffer pool switch is pending, upstream may still send buffers of
+   the previous kind. Returns FALSE if the buffer should not be shown. */
 
 static gboolean
-gst_framebuffersink_stop (GstBaseSink * sink)
+gst_framebuffersink_check_pool_switch (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf)
 {
-  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
-  GstFramebufferSinkClass *klass =
-      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
-  char s[128];
-
-  GST_DEBUG_OBJECT (framebuffersink, "stop");
+  GstMemory *mem;
+  gboolean video_memory;
 
-  sprintf(s, "%d frames rendered, %d from system memory, %d from video memory",
-      framebuffersink->stats_video_frames_video_memory +
-      framebuffersink->stats_overlay_frames_video_memory +
-      framebuffersink->stats_video_frames_system_memory +
-      framebuffersink->stats_overlay_frames_system_memory,
-      framebuffersink->stats_video_frames_system_memory +
-      framebuffersink->stats_overlay_frames_system_memory,
-      framebuffersink->stats_video_frames_video_memory +
-      framebuffersink->stats_overlay_frames_video_memory);
-  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT(framebuffersink, s);
+  mem = gst_buffer_get_memory (buf, 0);
+  video_memory = mem != NULL &&
+      gst_framebuffersink_is_video_memory (framebuffersink, mem);
+  if (mem != NULL)
+    gst_memory_unref (mem);
 
-  gst_framebuffersink_reset (framebuffersink);
+  if (framebuffersink->live_buffer_pool) {
+    /* Skip system memory buffers until upstream streams into the pool. */
+    if (!video_memory && framebuffersink->use_buffer_pool)
+      return FALSE;
+    framebuffersink->live_pool_switch_pending = FALSE;
+    return TRUE;
+  }
 
-  /* Free the screen allocator. */
-  g_object_unref (framebuffersink->screen_video_memory_allocator);
+  if (video_memory)
+    return TRUE;
+  framebuffersink->live_pool_switch_pending = FALSE;
+  return gst_framebuffersink_renegotiate_buffers (framebuffersink, FALSE);
+}
 
-  klass->close_hardware (framebuffersink);
+/* Move the active depth one buffer towards live_depth_target. Shrinking
+   waits while the buffer to be freed is being displayed. */
 
-  /* The device property string should probably not be freed because start
-     may be called again. */
-  /* g_free (framebuffersink->device); */
+static void
+gst_framebuffersink_step_live_depth (GstFramebufferSink *framebuffersink)
+{
+  int *n;
+  gboolean done;
+  gchar *s;
+
+  n = framebuffersink->use_hardware_overlay ?
+      &framebuffersink->nu_overlays_used : &framebuffersink->nu_screens_used;
+  if (*n < framebuffersink->live_depth_target)
+    /* Stop when out of video memory. */
+    done = !gst_framebuffersink_step_buffer_depth (framebuffersink, TRUE, 1)
+        || *n == framebuffersink->live_depth_target;
+  else if (*n > framebuffersink->live_depth_target) {
+    gst_framebuffersink_step_buffer_depth (framebuffersink, FALSE,
+        framebuffersink->live_depth_target);
+    done = *n == framebuffersink->live_depth_target;
+  }
+  else
+    done = TRUE;
+  if (!done)
+    return;
 
-  return TRUE;
+  gst_framebuffersink_resize_buffer_array (framebuffersink,
+      framebuffersink->live_depth_ceiling);
+  framebuffersink->live_depth_target = 0;
+  if (framebuffersink->adaptive_depth_active) {
+    if (*n < framebuffersink->stats_buffer_depth_min)
+      framebuffersink->stats_buffer_depth_min = *n;
+    if (*n > framebuffersink->stats_buffer_depth_max)
+      framebuffersink->stats_buffer_depth_max = *n;
+  }
+  s = g_strdup_printf ("Now using %d %s", *n,
+      framebuffersink->use_hardware_overlay ? "overlays" : "screens");
+  GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+  g_free (s);
 }
 
-/* The show frame function can deal with both video memory buffers
-   that require a pan and with regular buffers that need to be memcpy-ed.
-   There are seperate show_frame functions for overlays (with a video memory
-   or a system memory buffer pool), screen buffers with buffer 
-   pool in video memory, and screen buffers with a buffer pool in
-   system memory. */
+/* When using page flipping, wait for vsync after copying and then flip to the
+   screen that was copied into. */
+
+static void
+gst_framebuffersink_flip_screen (GstFramebufferSink *framebuffersink)
+{
+  /* A dropped frame is overwritten by the next one. */
+  if (!gst_framebuffersink_group_sync (framebuffersink))
+    return;
+  if (framebuffersink->vsync && !framebuffersink->pan_does_vsync)
+    gst_framebuffersink_watched_wait_for_vsync (framebuffersink);
+  gst_framebuffersink_watched_pan_display (framebuffersink,
+      framebuffersink->screens[framebuffersink->current_framebuffer_index]);
+  framebuffersink->presented_framebuffer_index =
+      framebuffersink->current_framebuffer_index;
+  framebuffersink->frame_cache_shown = FALSE;
+  framebuffersink->current_framebuffer_index++;
+  if (framebuffersink->current_framebuffer_index >=
+      framebuffersink->nu_screens_used)
+    framebuffersink->current_framebuffer_index = 0;
+}
 
 static GstFlowReturn
 gst_framebuffersink_show_frame_memcpy (GstFramebufferSink *framebuffersink,
@@ -2176,6 +5449,10 @@ gst_framebuffersink_show_frame_memcpy (GstFramebufferSink *framebuffersink,
       GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
   GstMapInfo mapinfo;
   GstMemory *mem;
+  gboolean page_flip;
+  int thumbnail_scale;
+  guint8 *ring;
+  GstFlowReturn res;
 
   mem = gst_buffer_get_memory (buffer, 0);
   if (!gst_memory_map(mem, &mapinfo, GST_MAP_READ)) {
@@ -2184,26 +5461,63 @@ gst_framebuffersink_show_frame_memcpy (GstFramebufferSink *framebuffersink,
     gst_memory_unref (mem);
     return GST_FLOW_ERROR;
   }
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, MAP, map, buffer, mapinfo.size);
+  page_flip = framebuffersink->nu_screens_used >= 2;
+  /* While the watchdog has given up on the hardware, copy into the screen
+     that is being displayed instead of flipping, unless a frame cache entry
+     is being displayed. */
+  if (page_flip && !framebuffersink->frame_cache_shown &&
+      gst_framebuffersink_hardware_sync_bypassed (framebuffersink)) {
+    page_flip = FALSE;
+    framebuffersink->current_framebuffer_index =
+        framebuffersink->presented_framebuffer_index;
+  }
   /* When not using page flipping, wait for vsync before copying. */
-  if (framebuffersink->nu_screens_used == 1 && framebuffersink->vsync)
-    klass->wait_for_vsync (framebuffersink);
-  gst_framebuffersink_put_image_memcpy (framebuffersink, mapinfo.data);
+  if (!page_flip) {
+    if (!gst_framebuffersink_group_sync (framebuffersink)) {
+      gst_memory_unmap (mem, &mapinfo);
+      gst_memory_unref (mem);
+      return GST_FLOW_OK;
+    }
+    if (framebuffersink->vsync)
+      gst_framebuffersink_watched_wait_for_vsync (framebuffersink);
+  }
+  res = GST_FLOW_OK;
+  thumbnail_scale = 0;
+  ring = NULL;
+  if (framebuffersink->convert_frames)
+    /* The thumbnail and the shared ring need the screen format, so they are
+       not produced for converted video. */
+    res = klass->put_converted_image (framebuffersink, buffer,
+        framebuffersink->screens[framebuffersink->current_framebuffer_index]);
+  else {
+    thumbnail_scale = framebuffersink->thumbnail_scale;
+    if (thumbnail_scale > 0 && !gst_framebuffersink_thumbnail_begin (
+        framebuffersink, thumbnail_scale))
+      thumbnail_scale = 0;
+    if (framebuffersink->shared_ring != NULL)
+      ring = gst_framebuffersink_shared_ring_begin (framebuffersink, buffer);
+    gst_framebuffersink_put_image_memcpy (framebuffersink,
+        framebuffersink->screens[framebuffersink->current_framebuffer_index],
+        mapinfo.data, thumbnail_scale, ring,
+        framebuffersink->current_framebuffer_index);
+  }
   gst_memory_unmap(mem, &mapinfo);
-
-  /* When using page flipping, wait for vsync after copying and then flip. */
-  if (framebuffersink->nu_screens_used >= 2) {
-    if (framebuffersink->vsync && !framebuffersink->pan_does_vsync)
-      klass->wait_for_vsync (framebuffersink);
-    klass->pan_display(framebuffersink, framebuffersink->screens[
-        framebuffersink->current_framebuffer_index]);
-    framebuffersink->current_framebuffer_index++;
-    if (framebuffersink->current_framebuffer_index >=
-        framebuffersink->nu_screens_used)
-      framebuffersink->current_framebuffer_index = 0;
+  if (res != GST_FLOW_OK) {
+    gst_memory_unref (mem);
+    return res;
   }
+  if (thumbnail_scale > 0)
+    gst_framebuffersink_thumbnail_end (framebuffersink, buffer);
+
+  if (page_flip)
+    gst_framebuffersink_flip_screen (framebuffersink);
 
   gst_memory_unref (mem);
 
+  if (ring != NULL)
+    gst_framebuffersink_shared_ring_commit (framebuffersink);
+
   framebuffersink->stats_video_frames_system_memory++;
 
   return GST_FLOW_OK;
@@ -2259,6 +5573,8 @@ GstBuffer * buf)
       GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
   GstMemory *mem;
   GstMapInfo mapinfo;
+  gsize src_offset[GST_VIDEO_MAX_PLANES];
+  gint src_stride[GST_VIDEO_MAX_PLANES];
 
   mem = gst_buffer_get_memory (buf, 0);
   if (!mem)
@@ -2271,9 +5587,16 @@ GstBuffer * buf)
        "Video memory overlay buffer encountered, mem = %p", mem);
 
     /* Wait for vsync before changing the overlay address. */
+    if (!gst_framebuffersink_group_sync (framebuffersink)) {
+      gst_memory_unref (mem);
+      return GST_FLOW_OK;
+    }
     if (framebuffersink->vsync)
-      klass->wait_for_vsync(framebuffersink);
+      gst_framebuffersink_watched_wait_for_vsync (framebuffersink);
+    GST_FRAMEBUFFERSINK_TRACE (framebuffersink, FLIP_ISSUE, flip_issue, mem,
+        0);
     klass->show_overlay(framebuffersink, mem);
+    framebuffersink->presented_memory = mem;
 
     gst_memory_unref (mem);
 
@@ -2293,6 +5616,11 @@ GstBuffer * buf)
       gst_memory_unref (mem);
       return GST_FLOW_ERROR;
     }
+    GST_FRAMEBUFFERSINK_TRACE (framebuffersink, MAP, map, buf,
+        mapinfo.size);
+
+    gst_framebuffersink_get_overlay_source_layout (framebuffersink, buf,
+        src_offset, src_stride);
 
     if (framebuffersink->use_buffer_pool) {
       /* When using a buffer pool in video memory, being requested to show an
@@ -2304,13 +5632,15 @@ GstBuffer * buf)
 
       GstMemory *vmem;
       vmem = gst_allocator_alloc(
-          framebuffersink->overlay_video_memory_allocator, mapinfo.size, NULL);
+          framebuffersink->overlay_video_memory_allocator,
+          framebuffersink->overlay_size, NULL);
       if (vmem == NULL)
         GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
             "Could not allocate temporary video memory buffer for overlay");
       else {
         gst_framebuffersink_put_overlay_image_memcpy (framebuffersink,
-            vmem, mapinfo.data);
+            vmem, mapinfo.data, src_offset, src_stride, - 1);
+        gst_framebuffersink_flip_overlay (framebuffersink, vmem);
         gst_allocator_free (framebuffersink->overlay_video_memory_allocator,
             vmem);
       }
@@ -2322,7 +5652,10 @@ GstBuffer * buf)
        screen. */
     gst_framebuffersink_put_overlay_image_memcpy(framebuffersink,
         framebuffersink->overlays[framebuffersink->current_overlay_index],
-        mapinfo.data);
+        mapinfo.data, src_offset, src_stride,
+        framebuffersink->current_overlay_index);
+    gst_framebuffersink_flip_overlay (framebuffersink,
+        framebuffersink->overlays[framebuffersink->current_overlay_index]);
     framebuffersink->current_overlay_index++;
     if (framebuffersink->current_overlay_index >=
         framebuffersink->nu_overlays_used)
@@ -2343,18 +5676,560 @@ invalid_memory:
     return GST_FLOW_ERROR;
 }
 
+/* Whether buf can be shown through the frame cache. The cache is not used
+   for frames that need per-frame copy side effects (thumbnails, the shared
+   ring), or while the watchdog has given up on the hardware. */
+
+static gboolean
+gst_framebuffersink_frame_cache_usable (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf)
+{
+  GstMemory *mem;
+
+  if (framebuffersink->frame_cache_size == 0 ||
+      framebuffersink->use_buffer_pool ||
+      framebuffersink->thumbnail_scale > 0 ||
+      framebuffersink->shared_ring != NULL ||
+      gst_framebuffersink_hardware_sync_bypassed (framebuffersink))
+    return FALSE;
+  if (framebuffersink->use_hardware_overlay ?
+      framebuffersink->nu_overlays_used < 2 :
+      framebuffersink->nu_screens_used < 2)
+    return FALSE;
+  /* Only the first memory is hashed and copied. */
+  if (gst_buffer_n_memory (buf) != 1)
+    return FALSE;
+  mem = gst_buffer_peek_memory (buf, 0);
+  return mem != NULL &&
+      !gst_framebuffersink_is_video_memory (framebuffersink, mem);
+}
+
+static GstFlowReturn
+gst_framebuffersink_show_frame_cached (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf)
+{
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  GstFramebufferSinkFrameCacheEntry *entry;
+  GstMemory *mem;
+  GstMapInfo mapinfo;
+  gsize src_offset[GST_VIDEO_MAX_PLANES];
+  gint src_stride[GST_VIDEO_MAX_PLANES];
+  guint64 hash;
+  GstFlowReturn res;
+
+  mem = gst_buffer_peek_memory (buf, 0);
+  /* The locked source memory of the previous frame cannot have been
+     written since. */
+  if (mem == framebuffersink->frame_cache_source &&
+      framebuffersink->frame_cache.head != NULL) {
+    entry = framebuffersink->frame_cache.head->data;
+    if (entry->size != 0)
+      goto hit;
+  }
+
+  if (!gst_memory_map (mem, &mapinfo, GST_MAP_READ)) {
+    GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink,
+        "memory_map of system memory buffer for reading failed");
+    return GST_FLOW_ERROR;
+  }
+  hash = gst_framebuffersink_checksum_row (0, mapinfo.data, mapinfo.size);
+  entry = gst_framebuffersink_frame_cache_lookup (framebuffersink, hash,
+      mapinfo.size);
+  if (entry != NULL) {
+    gst_memory_unmap (mem, &mapinfo);
+    goto hit;
+  }
+
+  entry = gst_framebuffersink_frame_cache_get_entry (framebuffersink);
+  if (entry == NULL) {
+    /* Out of video memory with too few entries to reuse one. */
+    gst_memory_unmap (mem, &mapinfo);
+    if (framebuffersink->use_hardware_overlay)
+      return gst_framebuffersink_show_frame_overlay (framebuffersink, buf);
+    return gst_framebuffersink_show_frame_memcpy (framebuffersink, buf);
+  }
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, MAP, map, buf, mapinfo.size);
+  res = GST_FLOW_OK;
+  if (framebuffersink->use_hardware_overlay) {
+    gst_framebuffersink_get_overlay_source_layout (framebuffersink, buf,
+        src_offset, src_stride);
+    gst_framebuffersink_put_overlay_image_memcpy (framebuffersink,
+        entry->vmem, mapinfo.data, src_offset, src_stride, - 1);
+  }
+  else if (framebuffersink->convert_frames)
+    res = klass->put_converted_image (framebuffersink, buf, entry->vmem);
+  else
+    gst_framebuffersink_put_image_memcpy (framebuffersink, entry->vmem,
+        mapinfo.data, 0, NULL, - 1);
+  gst_memory_unmap (mem, &mapinfo);
+  if (res != GST_FLOW_OK) {
+    /* The entry may have been written partially. */
+    g_queue_remove (&framebuffersink->frame_cache, entry);
+    gst_allocator_free (entry->allocator, entry->vmem);
+    g_slice_free (GstFramebufferSinkFrameCacheEntry, entry);
+    return res;
+  }
+  entry->hash = hash;
+  entry->size = mapinfo.size;
+  entry->checksum = framebuffersink->checksum;
+  entry->checksum_valid = framebuffersink->checksum_valid;
+  framebuffersink->stats_frame_cache_misses++;
+  goto show;
+
+hit:
+  framebuffersink->checksum = entry->checksum;
+  framebuffersink->checksum_valid = entry->checksum_valid;
+  framebuffersink->stats_frame_cache_hits++;
+
+show:
+  g_queue_remove (&framebuffersink->frame_cache, entry);
+  g_queue_push_head (&framebuffersink->frame_cache, entry);
+  gst_framebuffersink_frame_cache_set_source (framebuffersink, mem);
+  if (framebuffersink->use_hardware_overlay) {
+    gst_framebuffersink_flip_overlay (framebuffersink, entry->vmem);
+    framebuffersink->stats_overlay_frames_system_memory++;
+  }
+  else {
+    gst_framebuffersink_put_image_pan (framebuffersink, entry->vmem);
+    framebuffersink->frame_cache_shown = TRUE;
+    framebuffersink->stats_video_frames_system_memory++;
+  }
+  return GST_FLOW_OK;
+}
+
+/* Bracket CPU reads of the dmabuf memories of buffer with
+   DMA_BUF_IOCTL_SYNC, so that the caches are coherent with what the device
+   wrote. Returns TRUE if buffer has dmabuf memory. Kernels without the ioctl
+   are coherent already. */
+
+static gboolean
+gst_framebuffersink_sync_dmabuf (GstFramebufferSink *framebuffersink,
+    GstBuffer *buffer, gboolean start)
+{
+  gboolean found;
+  guint i, n;
+
+  found = FALSE;
+  n = gst_buffer_n_memory (buffer);
+  for (i = 0; i < n; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+#ifdef HAVE_LINUX_DMA_BUF_H
+    struct dma_buf_sync sync;
+    int res;
+#endif
+
+    if (!gst_is_dmabuf_memory (mem))
+      continue;
+    found = TRUE;
+#ifdef HAVE_LINUX_DMA_BUF_H
+    sync.flags = DMA_BUF_SYNC_READ |
+        (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+    do
+      res = ioctl (gst_dmabuf_memory_get_fd (mem), DMA_BUF_IOCTL_SYNC, &sync);
+    while (res < 0 && (errno == EINTR || errno == EAGAIN));
+    if (res < 0 && errno != ENOTTY)
+      GST_WARNING_OBJECT (framebuffersink, "DMA_BUF_IOCTL_SYNC failed: %s",
+          strerror (errno));
+#endif
+  }
+  return found;
+}
+
+/* Upload a frame from system memory into the next free screen or overlay
+   in prepare(), before GstBaseSink waits for the clock, so that show_frame
+   only has to flip at the deadline. This is only done with page flipping in
+   the steady state; everything else is left to show_frame. A prepared frame
+   that is dropped by QoS is never shown, and the next frame is prepared into
+   the same buffer. */
+
+static GstFlowReturn
+gst_framebuffersink_prepare (GstBaseSink * sink, GstBuffer * buf)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
+  GstFramebufferSinkClass *klass =
+      GST_FRAMEBUFFERSINK_GET_CLASS (framebuffersink);
+  GstMemory *mem;
+  GstMapInfo mapinfo;
+  gsize src_offset[GST_VIDEO_MAX_PLANES];
+  gint src_stride[GST_VIDEO_MAX_PLANES];
+  GstFlowReturn res;
+  gboolean dmabuf;
+
+  framebuffersink->prepared_buffer = NULL;
+
+  /* The thumbnail and the shared ring are produced for frames that are
+     shown only. */
+  if (framebuffersink->use_buffer_pool ||
+      framebuffersink->presentation_fallback ||
+      framebuffersink->live_properties_changed ||
+      framebuffersink->live_pool_switch_pending ||
+      framebuffersink->live_depth_target != 0 ||
+      framebuffersink->thumbnail_scale > 0 ||
+      framebuffersink->shared_ring != NULL ||
+      framebuffersink->frame_cache_size > 0)
+    return GST_FLOW_OK;
+  if (framebuffersink->use_hardware_overlay) {
+    if (framebuffersink->overlays == NULL ||
+        framebuffersink->nu_overlays_used < 2)
+      return GST_FLOW_OK;
+  }
+  else if (framebuffersink->screens == NULL ||
+      framebuffersink->nu_screens_used < 2)
+    return GST_FLOW_OK;
+
+  mem = gst_buffer_get_memory (buf, 0);
+  if (mem == NULL)
+    return GST_FLOW_OK;
+  /* Errors are reported when show_frame tries again. */
+  if (gst_framebuffersink_is_video_memory (framebuffersink, mem) ||
+      !gst_memory_map (mem, &mapinfo, GST_MAP_READ)) {
+    gst_memory_unref (mem);
+    return GST_FLOW_OK;
+  }
+  GST_FRAMEBUFFERSINK_TRACE (framebuffersink, MAP, map, buf, mapinfo.size);
+  dmabuf = gst_framebuffersink_sync_dmabuf (framebuffersink, buf, TRUE);
+
+  framebuffersink->checksum = 0;
+  framebuffersink->checksum_valid = FALSE;
+  res = GST_FLOW_OK;
+  if (framebuffersink->use_hardware_overlay) {
+    gst_framebuffersink_get_overlay_source_layout (framebuffersink, buf,
+        src_offset, src_stride);
+    gst_framebuffersink_put_overlay_image_memcpy (framebuffersink,
+        framebuffersink->overlays[framebuffersink->current_overlay_index],
+        mapinfo.data, src_offset, src_stride,
+        framebuffersink->current_overlay_index);
+    framebuffersink->prepared_index = framebuffersink->current_overlay_index;
+  }
+  else {
+    if (framebuffersink->convert_frames)
+      res = klass->put_converted_image (framebuffersink, buf,
+          framebuffersink->screens[
+          framebuffersink->current_framebuffer_index]);
+    else
+      gst_framebuffersink_put_image_memcpy (framebuffersink,
+          framebuffersink->screens[
+          framebuffersink->current_framebuffer_index], mapinfo.data, 0, NULL,
+          framebuffersink->current_framebuffer_index);
+    framebuffersink->prepared_index =
+        framebuffersink->current_framebuffer_index;
+  }
+  if (dmabuf) {
+    gst_framebuffersink_sync_dmabuf (framebuffersink, buf, FALSE);
+    framebuffersink->stats_dmabuf_frames++;
+  }
+  gst_memory_unmap (mem, &mapinfo);
+  gst_memory_unref (mem);
+  if (res != GST_FLOW_OK)
+    return res;
+
+  framebuffersink->prepared_buffer = buf;
+  framebuffersink->prepared_overlay = framebuffersink->use_hardware_overlay;
+  return GST_FLOW_OK;
+}
+
+/* Make blocking waits return early, for a flushing seek or a state change,
+   until unlock_stop is called. */
+
+static gboolean
+gst_framebuffersink_unlock (GstBaseSink * sink)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
+  guint64 value = 1;
+
+  GST_DEBUG_OBJECT (framebuffersink, "unlock");
+
+  g_atomic_int_set (&framebuffersink->unlocked, TRUE);
+  if (framebuffersink->wakeup_fd >= 0 &&
+      write (framebuffersink->wakeup_fd, &value, sizeof (value)) < 0)
+    GST_WARNING_OBJECT (framebuffersink, "Could not signal eventfd: %s",
+        strerror (errno));
+  if (framebuffersink->group != NULL) {
+    g_mutex_lock (&framebuffersink->group->mutex);
+    g_cond_broadcast (&framebuffersink->group->cond);
+    g_mutex_unlock (&framebuffersink->group->mutex);
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_framebuffersink_unlock_stop (GstBaseSink * sink)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sink);
+  guint64 value;
+
+  GST_DEBUG_OBJECT (framebuffersink, "unlock_stop");
+
+  /* Reading resets the eventfd counter; it fails with EAGAIN when it was
+     not signalled. */
+  if (framebuffersink->wakeup_fd >= 0 &&
+      read (framebuffersink->wakeup_fd, &value, sizeof (value)) < 0 &&
+      errno != EAGAIN)
+    GST_WARNING_OBJECT (framebuffersink, "Could not reset eventfd: %s",
+        strerror (errno));
+  g_atomic_int_set (&framebuffersink->unlocked, FALSE);
+  return TRUE;
+}
+
+/* Return TRUE if buf was uploaded by prepare() into the screen or overlay
+   that is to be shown next. The prepared frame is consumed either way. */
+
+static gboolean
+gst_framebuffersink_take_prepared_frame (GstFramebufferSink *framebuffersink,
+    GstBuffer *buf)
+{
+  gboolean prepared;
+
+  prepared = framebuffersink->prepared_buffer == buf &&
+      framebuffersink->prepared_overlay ==
+      framebuffersink->use_hardware_overlay &&
+      framebuffersink->prepared_index ==
+      (framebuffersink->use_hardware_overlay ?
+      framebuffersink->current_overlay_index :
+      framebuffersink->current_framebuffer_index) &&
+      !gst_framebuffersink_hardware_sync_bypassed (framebuffersink);
+  framebuffersink->prepared_buffer = NULL;
+  return prepared;
+}
+
+static GstFlowReturn
+gst_framebuffersink_show_prepared_frame (GstFramebufferSink *framebuffersink)
+{
+  if (framebuffersink->use_hardware_overlay) {
+    gst_framebuffersink_flip_overlay (framebuffersink,
+        framebuffersink->overlays[framebuffersink->current_overlay_index]);
+    framebuffersink->current_overlay_index++;
+    if (framebuffersink->current_overlay_index >=
+        framebuffersink->nu_overlays_used)
+      framebuffersink->current_overlay_index = 0;
+    framebuffersink->stats_overlay_frames_system_memory++;
+  }
+  else {
+    gst_framebuffersink_flip_screen (framebuffersink);
+    framebuffersink->stats_video_frames_system_memory++;
+  }
+  framebuffersink->stats_frames_prepared++;
+  return GST_FLOW_OK;
+}
+
+typedef struct {
+  pthread_t thread;
+  int policy;
+  struct sched_param param;
+  gboolean have_affinity;
+  cpu_set_t affinity;
+} GstFramebufferSinkSavedScheduling;
+
+/* Give the thread the scheduling it had before the properties were applied
+   to it, and if forget is set, drop the saved scheduling. */
+
+static void
+gst_framebuffersink_restore_scheduling (GstFramebufferSink *framebuffersink,
+    gboolean forget)
+{
+  GstFramebufferSinkSavedScheduling *saved =
+      framebuffersink->saved_scheduling;
+
+  if (saved == NULL)
+    return;
+  pthread_setschedparam (saved->thread, saved->policy, &saved->param);
+  if (saved->have_affinity)
+    pthread_setaffinity_np (saved->thread, sizeof (saved->affinity),
+        &saved->affinity);
+  if (forget) {
+    g_slice_free (GstFramebufferSinkSavedScheduling, saved);
+    framebuffersink->saved_scheduling = NULL;
+    framebuffersink->scheduled_thread = NULL;
+  }
+}
+
+/* Apply the scheduling-policy, scheduling-priority and cpu-affinity
+   properties to the thread calling show_frame. This is done again whenever
+   a different streaming thread is seen, after giving the previous thread
+   its original scheduling back. Failures (normally a lack of privileges)
+   are reported once and otherwise ignored. */
+
+static void
+gst_framebuffersink_apply_scheduling (GstFramebufferSink *framebuffersink)
+{
+  GstFramebufferSinkSavedScheduling *saved;
+  struct sched_param param;
+  int policy;
+  int res;
+  gchar *s;
+
+  saved = framebuffersink->saved_scheduling;
+  if (saved != NULL && !pthread_equal (saved->thread, pthread_self ())) {
+    gst_framebuffersink_restore_scheduling (framebuffersink, TRUE);
+    saved = NULL;
+  }
+  if (saved == NULL) {
+    saved = g_slice_new0 (GstFramebufferSinkSavedScheduling);
+    saved->thread = pthread_self ();
+    if (pthread_getschedparam (saved->thread, &saved->policy,
+        &saved->param) != 0) {
+      saved->policy = SCHED_OTHER;
+      memset (&saved->param, 0, sizeof (saved->param));
+    }
+    saved->have_affinity = pthread_getaffinity_np (saved->thread,
+        sizeof (saved->affinity), &saved->affinity) == 0;
+    framebuffersink->saved_scheduling = saved;
+  }
+  else
+    /* The properties changed; start again from the original scheduling. */
+    gst_framebuffersink_restore_scheduling (framebuffersink, FALSE);
+
+  framebuffersink->scheduled_thread = g_thread_self ();
+
+  policy = SCHED_OTHER;
+  if (framebuffersink->scheduling_policy_str != NULL) {
+    if (strcmp (framebuffersink->scheduling_policy_str, "fifo") == 0)
+      policy = SCHED_FIFO;
+    else if (strcmp (framebuffersink->scheduling_policy_str, "rr") == 0)
+      policy = SCHED_RR;
+  }
+  if (policy != SCHED_OTHER) {
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = framebuffersink->scheduling_priority;
+    res = pthread_setschedparam (pthread_self (), policy, &param);
+    if (res != 0) {
+      s = g_strdup_printf ("Could not set %s real-time scheduling with "
+          "priority %d (%s), continuing with normal scheduling",
+          policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+          framebuffersink->scheduling_priority, strerror (res));
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+      g_free (s);
+    }
+  }
+
+  if (framebuffersink->cpu_affinity != 0) {
+    cpu_set_t cpu_set;
+    int i;
+    CPU_ZERO (&cpu_set);
+    for (i = 0; i < 31; i++)
+      if (framebuffersink->cpu_affinity & (1 << i))
+        CPU_SET (i, &cpu_set);
+    /* A pid of zero refers to the calling thread. */
+    if (sched_setaffinity (0, sizeof (cpu_set), &cpu_set) != 0) {
+      s = g_strdup_printf ("Could not set CPU affinity mask 0x%x (%s)",
+          framebuffersink->cpu_affinity, strerror (errno));
+      GST_FRAMEBUFFERSINK_MESSAGE_OBJECT (framebuffersink, s);
+      g_free (s);
+    }
+  }
+
+  /* Record the scheduling actually in effect for the stats. */
+  if (pthread_getschedparam (pthread_self (), &policy, &param) == 0) {
+    framebuffersink->scheduling_policy_in_effect = policy;
+    framebuffersink->scheduling_priority_in_effect = param.sched_priority;
+  }
+}
+
 static GstFlowReturn
 gst_framebuffersink_show_frame (GstVideoSink * vsink, GstBuffer * buf)
 {
   GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (vsink);
   GstFlowReturn res;
+  GstClockTimeDiff lateness;
+  gboolean have_lateness;
+  gboolean prepared;
+  gboolean dmabuf;
+
+  if (framebuffersink->scheduled_thread != g_thread_self ()) {
+    if (framebuffersink->scheduling_policy_str != NULL ||
+        framebuffersink->cpu_affinity != 0)
+      gst_framebuffersink_apply_scheduling (framebuffersink);
+    else
+      /* The properties were cleared. */
+      gst_framebuffersink_restore_scheduling (framebuffersink, TRUE);
+  }
 
-  if (framebuffersink->use_hardware_overlay)
+  if (framebuffersink->group != NULL)
+    framebuffersink->group_running_time = GST_BUFFER_PTS_IS_VALID (buf) ?
+        gst_segment_to_running_time (&GST_BASE_SINK (framebuffersink)->segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buf)) : GST_CLOCK_TIME_NONE;
+
+  /* While the presentation watchdog has fallen back to software pacing,
+     retry the hardware every WATCHDOG_PROBE_INTERVAL frames. */
+  framebuffersink->presentation_probe = FALSE;
+  if (framebuffersink->presentation_fallback) {
+    framebuffersink->presentation_probe_countdown--;
+    if (framebuffersink->presentation_probe_countdown <= 0) {
+      framebuffersink->presentation_probe = TRUE;
+      framebuffersink->presentation_probe_countdown = WATCHDOG_PROBE_INTERVAL;
+    }
+  }
+
+  /* Between frames is a safe point to apply changed properties. */
+  if (G_UNLIKELY (framebuffersink->live_properties_changed))
+    gst_framebuffersink_apply_live_properties (framebuffersink);
+  if (G_UNLIKELY (framebuffersink->live_pool_switch_pending) &&
+      !gst_framebuffersink_check_pool_switch (framebuffersink, buf))
+    return GST_FLOW_OK;
+  if (G_UNLIKELY (framebuffersink->live_depth_target != 0))
+    gst_framebuffersink_step_live_depth (framebuffersink);
+
+  if (G_UNLIKELY (framebuffersink->color_balance_changed)) {
+    gst_framebuffersink_apply_color_balance (framebuffersink);
+    gst_framebuffersink_frame_cache_invalidate (framebuffersink);
+  }
+  while (framebuffersink->frame_cache.length >
+      framebuffersink->frame_cache_size &&
+      gst_framebuffersink_frame_cache_shrink (framebuffersink));
+
+  /* The checksum of a prepared frame was computed while uploading it. */
+  prepared = gst_framebuffersink_take_prepared_frame (framebuffersink, buf);
+  if (!prepared) {
+    framebuffersink->checksum = 0;
+    framebuffersink->checksum_valid = FALSE;
+  }
+
+  dmabuf = !prepared && !framebuffersink->use_buffer_pool &&
+      gst_framebuffersink_sync_dmabuf (framebuffersink, buf, TRUE);
+  if (prepared)
+    res = gst_framebuffersink_show_prepared_frame (framebuffersink);
+  else if (gst_framebuffersink_frame_cache_usable (framebuffersink, buf))
+    res = gst_framebuffersink_show_frame_cached (framebuffersink, buf);
+  else if (framebuffersink->use_hardware_overlay)
     res = gst_framebuffersink_show_frame_overlay(framebuffersink, buf);
   else if (framebuffersink->use_buffer_pool)
     res = gst_framebuffersink_show_frame_buffer_pool(framebuffersink, buf);
   else
     res = gst_framebuffersink_show_frame_memcpy(framebuffersink, buf);
+  if (dmabuf) {
+    gst_framebuffersink_sync_dmabuf (framebuffersink, buf, FALSE);
+    framebuffersink->stats_dmabuf_frames++;
+  }
+  if (res != GST_FLOW_OK)
+    return res;
+
+  if (G_UNLIKELY (framebuffersink->retired_memory != NULL) &&
+      --framebuffersink->retired_frames <= 0)
+    gst_framebuffersink_release_retired_memory (framebuffersink);
+
+  if (framebuffersink->checksum_valid) {
+    gst_framebuffersink_post_checksum (framebuffersink, buf);
+    framebuffersink->stats_checksummed_frames++;
+  }
+
+  /* A frame that is only shown after the end of its display period has
+     missed its deadline. */
+  have_lateness = gst_framebuffersink_get_buffer_lateness (framebuffersink,
+      buf, &lateness);
+  if (have_lateness && lateness > 0) {
+    framebuffersink->stats_missed_deadlines++;
+    if (lateness > framebuffersink->stats_max_lateness)
+      framebuffersink->stats_max_lateness = lateness;
+  }
+
+  if (framebuffersink->adaptive_depth_active &&
+      framebuffersink->live_depth_target == 0)
+    gst_framebuffersink_update_adaptive_depth (framebuffersink, have_lateness,
+        lateness);
+  if (framebuffersink->resolution_active)
+    gst_framebuffersink_update_adaptive_resolution (framebuffersink, buf,
+        have_lateness, lateness);
   return res;
 }
 
@@ -2375,6 +6250,9 @@ gst_framebuffersink_set_buffer_pool_query_answer (
     n = framebuffersink->nu_screens_used;
     if (framebuffersink->use_hardware_overlay)
       n = framebuffersink->nu_overlays_used;
+    if (framebuffersink->use_hardware_overlay &&
+        framebuffersink->overlay_pool_video_meta)
+      size = framebuffersink->overlay_size;
 
     config = gst_buffer_pool_get_config (pool);
 #ifdef HALF_POOLS
@@ -2433,6 +6311,11 @@ gst_framebuffersink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
 
   GST_OBJECT_LOCK (framebuffersink);
 
+  /* DMABuf memory is allocated upstream; only propose the metadata. */
+  if (gst_caps_features_contains (gst_caps_get_features (caps, 0),
+      GST_CAPS_FEATURE_MEMORY_DMABUF))
+    goto end;
+
   /* Take a look at our pre-initialized pool in video memory. */
   pool = framebuffersink->pool ? gst_object_ref (framebuffersink->pool) : NULL;
 
@@ -2468,7 +6351,8 @@ gst_framebuffersink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
   }
 
 #ifdef MULTIPLE_VIDEO_MEMORY_POOLS
-  if (framebuffersink->use_buffer_pool && pool == NULL && need_pool) {
+  if (framebuffersink->use_buffer_pool && framebuffersink->live_buffer_pool
+      && pool == NULL && need_pool) {
     /* Try to provide (another) pool from video memory. */
 
     pool = gst_framebuffersink_allocate_buffer_pool (framebuffersink, caps,
@@ -2479,6 +6363,22 @@ gst_framebuffersink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
   }
 #endif
 
+  /* Frames that are converted by reading them in place are best written
+     into video memory by upstream. */
+  if (pool == NULL && need_pool && framebuffersink->convert_frames &&
+      framebuffersink->converted_formats_in_video_memory) {
+    int n;
+    pool = gst_framebuffersink_allocate_converted_pool (framebuffersink,
+        caps, &info, &n);
+    if (pool != NULL) {
+      gst_query_add_allocation_param (query,
+          framebuffersink->screen_video_memory_allocator, NULL);
+      gst_query_add_allocation_pool (query, pool, info.size, n, n);
+      gst_object_unref (pool);
+      goto end;
+    }
+  }
+
   /* At this point if pool is not NULL we have a video memory pool */
   /* to provide. */
   if (pool != NULL) {
@@ -2525,7 +6425,9 @@ gst_framebuffersink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
 
 end:
   /* we also support various metadata */
-//  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  /* Overlay frames are copied or shown with the strides in GstVideoMeta. */
+  if (framebuffersink->use_hardware_overlay)
+    gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
 //  gst_query_add_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE, NULL);
 
   GST_OBJECT_UNLOCK (framebuffersink);
@@ -2617,8 +6519,16 @@ gst_framebuffersink_get_type (void)
       (GInstanceInitFunc) gst_framebuffersink_init,
     };
 
+    static const GInterfaceInfo color_balance_info = {
+      (GInterfaceInitFunc) gst_framebuffersink_color_balance_init,
+      NULL,
+      NULL,
+    };
+
     framebuffersink_type = g_type_register_static( GST_TYPE_VIDEO_SINK,
         "GstFramebufferSink", &framebuffersink_info, 0);
+    g_type_add_interface_static (framebuffersink_type,
+        GST_TYPE_COLOR_BALANCE, &color_balance_info);
   }
 
   return framebuffersink_type;
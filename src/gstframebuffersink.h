@@ -20,13 +20,20 @@
 #ifndef _GST_FRAMEBUFFERSINK_H_
 #define _GST_FRAMEBUFFERSINK_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <linux/fb.h>
 #include <gst/video/gstvideosink.h>
 #include <gst/video/video.h>
+#include <gst/allocators/gstdmabuf.h>
 
 G_BEGIN_DECLS
 
+/* Only defined by gstreamer-allocators 1.12 and later. */
+#ifndef GST_CAPS_FEATURE_MEMORY_DMABUF
+#define GST_CAPS_FEATURE_MEMORY_DMABUF "memory:DMABuf"
+#endif
+
 
 /* We can't reuse GstVideoAlignment because the horizontal padding might be
    different for different planes. */
@@ -41,6 +48,69 @@ struct _GstFramebufferSinkOverlayVideoAlignment {
   guint stride_align[GST_VIDEO_MAX_PLANES];
 };
 
+/* Layout of the shared frame ring (shared-ring property). The memfd starts
+   with a GstFramebufferSinkSharedRingHeader, followed at header_size by
+   n_slots slots of slot_size bytes. Each slot starts with a
+   GstFramebufferSinkSharedRingSlot and holds the frame's rows (stride bytes
+   each) at GST_FRAMEBUFFERSINK_SHARED_RING_SLOT_DATA_OFFSET. The header
+   sequence is incremented for each frame published in latest_slot and can be
+   waited on with FUTEX_WAIT. A slot's sequence is odd while it is being
+   written; consumers should copy the slot and retry if its sequence was odd
+   or changed in the meantime. */
+
+#define GST_FRAMEBUFFERSINK_SHARED_RING_MAGIC 0x52534246 /* "FBSR" */
+#define GST_FRAMEBUFFERSINK_SHARED_RING_VERSION 1
+#define GST_FRAMEBUFFERSINK_SHARED_RING_SLOTS 3
+#define GST_FRAMEBUFFERSINK_SHARED_RING_HEADER_SIZE 4096
+#define GST_FRAMEBUFFERSINK_SHARED_RING_SLOT_DATA_OFFSET 64
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t slot_size;
+  uint32_t header_size;
+  volatile uint32_t latest_slot;
+  volatile uint32_t sequence;
+  uint32_t reserved;
+} GstFramebufferSinkSharedRingHeader;
+
+typedef struct {
+  volatile uint32_t sequence;
+  /* GstVideoFormat of the rows. */
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t reserved;
+  uint64_t pts;
+  /* CLOCK_MONOTONIC time in nanoseconds at which the frame was presented. */
+  uint64_t vblank_time;
+  uint64_t frame_number;
+} GstFramebufferSinkSharedRingSlot;
+
+/* Number of monitoring thumbnail buffers that are cycled through. */
+#define GST_FRAMEBUFFERSINK_THUMBNAIL_RING_SIZE 3
+
+/* Hardware performance counters sampled around the copy of each frame:
+   cycles, instructions, cache misses and dTLB (load) misses. */
+#define GST_FRAMEBUFFERSINK_PERF_COUNTERS 4
+
+/* Color balance channels, in the order of the values passed to the
+   set_color_balance virtual function. Values range from
+   GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN to GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX
+   with 0 meaning no adjustment. */
+typedef enum {
+  GST_FRAMEBUFFERSINK_COLOR_BALANCE_BRIGHTNESS,
+  GST_FRAMEBUFFERSINK_COLOR_BALANCE_CONTRAST,
+  GST_FRAMEBUFFERSINK_COLOR_BALANCE_SATURATION,
+  GST_FRAMEBUFFERSINK_COLOR_BALANCE_HUE,
+  GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS
+} GstFramebufferSinkColorBalanceChannel;
+
+#define GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN (- 1000)
+#define GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX 1000
+
 /* Main class. */
 
 #define GST_TYPE_FRAMEBUFFERSINK (gst_framebuffersink_get_type())
@@ -56,6 +126,7 @@ struct _GstFramebufferSinkOverlayVideoAlignment {
     GST_TYPE_FRAMEBUFFER_SINK, GstFramebufferSinkClass))
 
 typedef struct _GstFramebufferSink GstFramebufferSink;
+typedef struct _GstFramebufferSinkGroup GstFramebufferSinkGroup;
 typedef struct _GstFramebufferSinkClass GstFramebufferSinkClass;
 
 struct _GstFramebufferSink
@@ -81,6 +152,18 @@ struct _GstFramebufferSink
   gint max_video_memory_property;
   gchar *preferred_overlay_format_str;
   gboolean benchmark;
+  gboolean adaptive_buffers;
+  gboolean adaptive_resolution;
+  gchar *scheduling_policy_str;
+  gint scheduling_priority;
+  gint cpu_affinity;
+  gchar *group_name;
+  gboolean checksum_enabled;
+  gchar *checksum_location;
+  gint thumbnail_scale;
+  gboolean shared_ring_enabled;
+  gboolean perf_counters;
+  gint frame_cache_size;
 
   /* Variables (derived from properties) that may be altered when
      the element starts processing a stream. */
@@ -91,6 +174,23 @@ struct _GstFramebufferSink
   /* Invariant device parameters. */
   GstVideoInfo screen_info;
   GstVideoFormat *overlay_formats_supported;
+  /* Additional source formats that the subclass converts to the screen
+     format while copying; terminated by GST_VIDEO_FORMAT_UNKNOWN. */
+  GstVideoFormat *converted_formats_supported;
+  /* Set by the subclass when put_converted_image also scales, in which case
+     converted formats (including the screen format when listed) are scaled
+     to the requested video size like overlays. */
+  gboolean converted_formats_scaled;
+  /* Set by the subclass when put_converted_image reads frames in video
+     memory in place, in which case upstream is offered a pool of source
+     frames in video memory. */
+  gboolean converted_formats_in_video_memory;
+  /* Set by the subclass when frames in the screen format are written into
+     screen memory by its put_image function instead of copied. */
+  gboolean use_put_image;
+  /* Set by the subclass when it accepts memory:DMABuf caps, which are
+     mapped and copied like system memory. */
+  gboolean dmabuf_supported;
   gsize video_memory_size;
   gsize pannable_video_memory_size;
   int max_framebuffers;
@@ -103,10 +203,137 @@ struct _GstFramebufferSink
   GstAllocationParams *screen_allocation_params;
   int nu_screens_used;
   GstMemory **screens;
+  int screens_array_size;
   GstAllocator *overlay_video_memory_allocator;
   GstAllocationParams *overlay_allocation_params;
   int nu_overlays_used;
   GstMemory **overlays;
+  int overlays_array_size;
+  /* Adaptive buffer depth. The screens/overlays arrays are sized for the
+     maximum depth; nu_screens_used/nu_overlays_used is the active depth. */
+  gboolean adaptive_depth_active;
+  gint64 adaptive_last_frame_time;
+  gint64 adaptive_average_interval;
+  int adaptive_frames;
+  int adaptive_pressure_frames;
+  int adaptive_steady_windows;
+  /* Adaptive source resolution. resolution_width/height override
+     width/height_before_scaling in the caps when non-zero. */
+  gboolean resolution_active;
+  int resolution_step;
+  int resolution_full_width, resolution_full_height;
+  int resolution_width, resolution_height;
+  GstClockTime resolution_last_pts;
+  int resolution_frames;
+  int resolution_late_frames;
+  int resolution_early_frames;
+  int resolution_settle_windows;
+  int resolution_headroom_windows;
+  /* Presentation properties changed while streaming. They are applied in
+     show_frame before the next frame; live_buffer_pool, live_flip_buffers and
+     live_max_video_memory are the values last applied. A pending pool switch
+     waits for upstream to send buffers of the new kind, and a pending depth
+     change moves the active depth one buffer per frame towards
+     live_depth_target (0 when none). The subclass sets
+     live_properties_fixed for hardware without vsync or page flipping. */
+  gboolean live_properties_changed;
+  gboolean live_properties_fixed;
+  gboolean live_buffer_pool;
+  int live_flip_buffers;
+  int live_max_video_memory;
+  gboolean live_pool_switch_pending;
+  int live_depth_target;
+  int live_depth_ceiling;
+  /* Frame uploaded by prepare() before the clock wait: the buffer (compared
+     by address only) and the screen or overlay it was copied into. */
+  GstBuffer *prepared_buffer;
+  gboolean prepared_overlay;
+  int prepared_index;
+  /* Set between GstBaseSink's unlock and unlock_stop. wakeup_fd is an
+     eventfd that becomes readable on unlock, so that waits polling it
+     return early. */
+  gint unlocked;
+  int wakeup_fd;
+  /* Presentation watchdog. refresh_period is filled in by the subclass when
+     opening the hardware (0 if unknown). */
+  GstClockTime refresh_period;
+  gboolean presentation_fallback;
+  gboolean presentation_probe;
+  gboolean presentation_stall_reported;
+  int presentation_stalls;
+  int presentation_probe_countdown;
+  gint64 presentation_paced_time;
+  int presented_framebuffer_index;
+  /* Video memory last handed to pan_display or show_overlay. When the
+     buffers are set up again while streaming, the buffer on display is
+     retired and only freed after the flip to a new buffer has completed. */
+  GstMemory *presented_memory;
+  GstMemory *retired_memory;
+  GstAllocator *retired_allocator;
+  int retired_frames;
+  /* Presentation group joined when group-name is set, the running time
+     of the frame being presented, and the monotonic time of the last vblank
+     waited for. */
+  GstFramebufferSinkGroup *group;
+  GstClockTime group_running_time;
+  gint64 last_vblank_time;
+  /* Checksum of the frame being shown, accumulated while it is copied. */
+  guint64 checksum;
+  gboolean checksum_valid;
+  int checksum_buffer_index;
+  FILE *checksum_file;
+  /* Monitoring thumbnail. thumbnail_sample is protected by the object
+     lock. */
+  GstSample *thumbnail_sample;
+  GstVideoInfo thumbnail_info;
+  GstCaps *thumbnail_caps;
+  GstBuffer *thumbnail_ring[GST_FRAMEBUFFERSINK_THUMBNAIL_RING_SIZE];
+  int thumbnail_ring_index;
+  GstBuffer *thumbnail_buffer;
+  GstMapInfo thumbnail_map;
+  /* Shared frame ring. */
+  GstFramebufferSinkSharedRingHeader *shared_ring;
+  gsize shared_ring_size;
+  int shared_ring_fd;
+  GstFramebufferSinkSharedRingSlot *shared_ring_slot;
+  guint shared_ring_slot_index;
+  guint64 shared_ring_frames;
+  /* Video memory frame cache, most recently shown entry first. The source
+     memory of the last frame is kept locked so that a still that is pushed
+     again can be recognized without hashing it. */
+  GQueue frame_cache;
+  GstMemory *frame_cache_source;
+  gboolean frame_cache_shown;
+  /* Hardware performance counters of the streaming thread. perf_fd[0] is
+     the group leader; counters that could not be opened are -1. */
+  GThread *perf_thread;
+  int perf_fd[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  int perf_group_index[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  int perf_group_size;
+  gboolean perf_unavailable_reported;
+  guint64 perf_begin_value[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  gint64 perf_begin_time;
+  /* Color balance. The values and color_balance_changed are protected by
+     the object lock, the rest is used by the streaming thread. When the
+     hardware cannot apply the values they are applied with a color matrix
+     and a lookup table while frames are copied. */
+  GList *color_balance_channels;
+  gint color_balance[GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS];
+  gboolean color_balance_changed;
+  gboolean color_balance_software;
+  /* Frame with the color balance applied that is passed to put_image. */
+  guint8 *color_balance_frame;
+  gsize color_balance_frame_size;
+  gboolean color_balance_software_matrix;
+  int color_balance_offset[3];
+  gint color_balance_matrix[3][3];
+  guint8 color_balance_lut[256];
+  /* Streaming thread scheduling. saved_scheduling holds the scheduling of
+     the thread before the properties were first applied to it. */
+  GThread *scheduled_thread;
+  int scheduling_policy_in_effect;
+  int scheduling_priority_in_effect;
+  gpointer saved_scheduling;
 
   /* Video information. */
   GstVideoInfo video_info;
@@ -116,6 +343,10 @@ struct _GstFramebufferSink
   GstVideoRectangle video_rectangle;
   /* Precalculated video rectangle width * framebuffer bytes per pixel. */
   int video_rectangle_width_in_bytes;
+  /* Whether frames are shown with put_converted_image. */
+  gboolean convert_frames;
+  /* Whether the negotiated caps have the memory:DMABuf feature. */
+  gboolean dmabuf_input;
 
   /* Overlay alignment restriction in video memory. */
   gint overlay_align;
@@ -127,6 +358,11 @@ struct _GstFramebufferSink
   /* Whether the video format provided by GStreamer matches the native */
   /* alignment requirements. */
   gboolean overlay_alignment_is_native;
+  /* Whether the overlay buffer pool adds GstVideoMeta and lays out buffers
+     with overlay_pool_alignment, so that upstream writes the overlay layout
+     directly when the default layout doesn't match it. */
+  gboolean overlay_pool_video_meta;
+  GstVideoAlignment overlay_pool_alignment;
 
   GstBufferPool *pool;
   GstCaps *caps;
@@ -136,6 +372,32 @@ struct _GstFramebufferSink
   int stats_video_frames_system_memory;
   int stats_overlay_frames_video_memory;
   int stats_overlay_frames_system_memory;
+  int stats_buffer_depth_min;
+  int stats_buffer_depth_max;
+  int stats_buffer_depth_changes;
+  int stats_resolution_changes;
+  int stats_missed_deadlines;
+  int stats_frames_prepared;
+  int stats_dmabuf_frames;
+  int stats_frame_cache_hits;
+  int stats_frame_cache_misses;
+  GstClockTimeDiff stats_max_lateness;
+  int stats_presentation_stalls;
+  int stats_presentation_fallbacks;
+  int stats_group_frames;
+  int stats_group_timeouts;
+  int stats_group_drops;
+  GstClockTime stats_group_skew_total;
+  GstClockTime stats_group_skew_max;
+  int stats_checksummed_frames;
+  /* Copy instrumentation (perf-counters), protected by the object lock.
+     The perf_frame_* values are those of the last frame. */
+  int stats_perf_frames;
+  GstClockTime stats_perf_time_total;
+  GstClockTime stats_perf_time_max;
+  guint64 stats_perf_value[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
+  GstClockTime perf_frame_time;
+  guint64 perf_frame_value[GST_FRAMEBUFFERSINK_PERF_COUNTERS];
 };
 
 struct _GstFramebufferSinkClass
@@ -171,6 +433,35 @@ struct _GstFramebufferSinkClass
   GstAllocator * (*video_memory_allocator_new) (
       GstFramebufferSink *framebuffersink, GstVideoInfo *info,
       gboolean pannable, gboolean is_overlay);
+  /* Apply the color balance values (indexed by
+     GstFramebufferSinkColorBalanceChannel) in hardware. Called from the
+     streaming thread before a frame is shown. Returns FALSE when the
+     hardware cannot apply them in the current mode, in which case they are
+     applied in software where possible. May be NULL. */
+  gboolean (*set_color_balance) (GstFramebufferSink *framebuffersink,
+      const gint *value);
+  /* Convert a source frame in one of the converted_formats_supported into
+     the video rectangle of the screen memory vmem, scaling it to the size of
+     the video rectangle. Used instead of the copy in non-overlay mode when
+     the format or size of the video differs from that of the screen. May be
+     NULL. */
+  GstFlowReturn (*put_converted_image) (GstFramebufferSink *framebuffersink,
+      GstBuffer *buffer, GstMemory *vmem);
+  /* Write a frame in the screen format from system memory into the video
+     rectangle of the screen memory vmem, for devices where only what
+     changed should be written. Each of the video_rectangle.h rows of src is
+     video_rectangle_width_in_bytes wide and rows are src_stride bytes
+     apart. Used instead of the copy when use_put_image is set; checksums,
+     thumbnails, the shared ring and the color balance are still handled by
+     the base class. May be NULL. */
+  void (*put_image) (GstFramebufferSink *framebuffersink, GstMemory *vmem,
+      const guint8 *src, int src_stride);
+  /* Return whether the screen memory vmem lies within the range that
+     pan_display can show. Used for screen memory that is allocated beyond
+     the flip buffers, such as frame cache entries. May be NULL if all
+     screen memory can be shown. */
+  gboolean (*video_memory_is_pannable) (GstFramebufferSink *framebuffersink,
+      GstMemory *vmem);
 };
 
 GType gst_framebuffersink_get_type (void);
@@ -185,6 +476,39 @@ void gst_framebuffersink_set_overlay_video_alignment_from_scanline_alignment (
     GstFramebufferSinkOverlayVideoAlignment *video_alignment,
     gboolean *video_alignment_matches);
 
+/* Presentation watchdog. Subclasses whose pan_display or wait_for_vsync
+   gives up on the hardware after the presentation timeout report it with
+   gst_framebuffersink_report_presentation_stall(). While
+   gst_framebuffersink_hardware_sync_bypassed() returns TRUE they should
+   present without waiting for hardware events. */
+
+GstClockTime gst_framebuffersink_get_presentation_timeout (
+    GstFramebufferSink *framebuffersink);
+void gst_framebuffersink_report_presentation_stall (
+    GstFramebufferSink *framebuffersink);
+gboolean gst_framebuffersink_hardware_sync_bypassed (
+    GstFramebufferSink *framebuffersink);
+
+/* Interruptible waits. While the sink is unlocked for a flushing seek or a
+   state change, waits return early instead of waiting for the hardware.
+   gst_framebuffersink_poll() waits until fd (if not negative) is readable,
+   for at most timeout. It returns 1 when fd is readable, 0 on timeout and
+   -1 when the sink was unlocked. */
+
+int gst_framebuffersink_poll (GstFramebufferSink *framebuffersink, int fd,
+    GstClockTime timeout);
+gboolean gst_framebuffersink_is_unlocked (GstFramebufferSink *framebuffersink);
+
+/* Color balance. The color matrix (saturation and hue, applied to
+   non-linear RGB) and the transfer function (brightness and contrast,
+   mapping a level in the range [0, 1]) that correspond to the channel
+   values, for subclasses that program them into the hardware. */
+
+void gst_framebuffersink_get_color_balance_matrix (const gint *value,
+    double matrix[3][3]);
+double gst_framebuffersink_get_color_balance_level (const gint *value,
+    double level);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,76 @@
+/* GStreamer GstFramebufferSink tracing
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_FRAMEBUFFERSINK_TRACE_H_
+#define _GST_FRAMEBUFFERSINK_TRACE_H_
+
+#include <glib.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+G_BEGIN_DECLS
+
+/* Stages of the display path. Each stage is emitted as a USDT probe in the
+   "framebuffersink" provider (when sys/sdt.h was available at build time)
+   with the sink, a buffer id and a byte count as arguments, and passed to
+   the trace function if one is installed (normally by the fbsinkstages
+   tracer). Both cost next to nothing when not in use. */
+
+typedef enum {
+  GST_FRAMEBUFFERSINK_STAGE_MAP,
+  GST_FRAMEBUFFERSINK_STAGE_COPY_START,
+  GST_FRAMEBUFFERSINK_STAGE_COPY_END,
+  GST_FRAMEBUFFERSINK_STAGE_VSYNC_WAIT_START,
+  GST_FRAMEBUFFERSINK_STAGE_VSYNC_WAIT_END,
+  GST_FRAMEBUFFERSINK_STAGE_FLIP_ISSUE,
+  GST_FRAMEBUFFERSINK_STAGE_FLIP_COMPLETE,
+  GST_FRAMEBUFFERSINK_STAGE_VIDEO_MEMORY_ALLOC,
+  GST_FRAMEBUFFERSINK_STAGE_VIDEO_MEMORY_FREE,
+  GST_FRAMEBUFFERSINK_STAGE_COUNT
+} GstFramebufferSinkStage;
+
+typedef void (*GstFramebufferSinkTraceFunc) (gpointer sink,
+    GstFramebufferSinkStage stage, guint64 id, guint64 bytes);
+
+extern GstFramebufferSinkTraceFunc gst_framebuffersink_trace_func;
+
+#ifdef HAVE_SYS_SDT_H
+#define GST_FRAMEBUFFERSINK_PROBE(probe, sink, id, bytes) \
+    DTRACE_PROBE3 (framebuffersink, probe, sink, id, bytes)
+#else
+#define GST_FRAMEBUFFERSINK_PROBE(probe, sink, id, bytes)
+#endif
+
+/* Usage: GST_FRAMEBUFFERSINK_TRACE (sink, COPY_START, copy_start, id, bytes).
+   The buffer id is the address of the GstBuffer or GstMemory involved. */
+#define GST_FRAMEBUFFERSINK_TRACE(sink, stage, probe, id, bytes) \
+    G_STMT_START { \
+      GST_FRAMEBUFFERSINK_PROBE (probe, (gpointer) (sink), \
+          (guint64) (guintptr) (id), (guint64) (bytes)); \
+      if (G_UNLIKELY (gst_framebuffersink_trace_func != NULL)) \
+        gst_framebuffersink_trace_func ((gpointer) (sink), \
+            GST_FRAMEBUFFERSINK_STAGE_##stage, (guint64) (guintptr) (id), \
+            (guint64) (bytes)); \
+    } G_STMT_END
+
+G_END_DECLS
+
+#endif
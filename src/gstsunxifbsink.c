@@ -157,19 +157,42 @@ static gboolean gst_sunxifbsink_prepare_overlay (
     GstFramebufferSink *framebuffersink, GstVideoFormat format);
 static GstFlowReturn gst_sunxifbsink_show_overlay (
     GstFramebufferSink *framebuffersink, GstMemory *memory);
+static gboolean gst_sunxifbsink_set_color_balance (
+    GstFramebufferSink *framebuffersink, const gint *value);
+static GstFlowReturn gst_sunxifbsink_put_converted_image (
+    GstFramebufferSink *framebuffersink, GstBuffer *buffer, GstMemory *vmem);
+static void gst_sunxifbsink_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_sunxifbsink_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
 
 static gboolean gst_sunxifbsink_reserve_layer (GstSunxifbsink *sunxifbsink);
 static void gst_sunxifbsink_release_layer (GstSunxifbsink *sunxifbsink);
 static gboolean gst_sunxifbsink_show_layer (GstSunxifbsink *sunxifbsink);
 static void gst_sunxifbsink_hide_layer (GstSunxifbsink *sunxifbsink);
+static void gst_sunxifbsink_release_scaler (GstSunxifbsink *sunxifbsink);
 
 enum
 {
   PROP_0,
+  PROP_SCALER_CONVERT,
 };
 
+/* NV12 in the 32x32 macroblock-tiled (MB32) layout produced by the
+   Allwinner hardware video decoder, which the display engine scans out
+   directly. */
+#if GST_CHECK_VERSION(1, 18, 0)
+#define HAVE_NV12_32L32
+#define GST_SUNXIFBSINK_TILED_CAPS "; " GST_VIDEO_CAPS_MAKE ("NV12_32L32")
+#else
+#define GST_SUNXIFBSINK_TILED_CAPS
+#endif
+
 #define GST_SUNXIFBSINK_TEMPLATE_CAPS \
-        GST_VIDEO_CAPS_MAKE ("RGB") \
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF, \
+            "{ RGB, BGR, RGBx, BGRx, xRGB, xBGR, YUY2, UYVY, Y444, AYUV, " \
+            "I420, YV12, NV12, NV21 }") \
+        "; " GST_VIDEO_CAPS_MAKE ("RGB") \
         "; " GST_VIDEO_CAPS_MAKE ("BGR") \
         "; " GST_VIDEO_CAPS_MAKE ("RGBx") \
         "; " GST_VIDEO_CAPS_MAKE ("BGRx") \
@@ -179,6 +202,7 @@ enum
         "; " GST_VIDEO_CAPS_MAKE ("UYVY") \
         "; " GST_VIDEO_CAPS_MAKE ("Y444") \
         "; " GST_VIDEO_CAPS_MAKE ("AYUV") \
+        GST_SUNXIFBSINK_TILED_CAPS \
         "; " GST_VIDEO_CAPS_MAKE ("I420") \
         "; " GST_VIDEO_CAPS_MAKE ("YV12") \
         "; " GST_VIDEO_CAPS_MAKE ("NV12") \
@@ -194,13 +218,16 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     );
 
 static GstVideoFormat sunxifbsink_supported_overlay_formats_table[] = {
-  /* List the formats that support odds widths first. */
+#ifdef HAVE_NV12_32L32
+  /* Decoder output that needs no CPU access at all. */
+  GST_VIDEO_FORMAT_NV12_32L32,
+#endif
   GST_VIDEO_FORMAT_YUY2,
   GST_VIDEO_FORMAT_UYVY,
   GST_VIDEO_FORMAT_Y444,
   GST_VIDEO_FORMAT_AYUV,
   GST_VIDEO_FORMAT_BGRx,
-  /* These formats do not properly support odd widths. */
+  /* With odd widths, these formats are padded to an even stride. */
   GST_VIDEO_FORMAT_I420,
   GST_VIDEO_FORMAT_YV12,
   GST_VIDEO_FORMAT_NV12,
@@ -208,6 +235,21 @@ static GstVideoFormat sunxifbsink_supported_overlay_formats_table[] = {
   GST_VIDEO_FORMAT_UNKNOWN
 };
 
+/* Formats that are converted (and scaled) into the screen when the video is
+   not shown on the hardware layer. The screen format is included so that it
+   is scaled as well. */
+static GstVideoFormat sunxifbsink_converted_formats_table[] = {
+  GST_VIDEO_FORMAT_I420,
+  GST_VIDEO_FORMAT_YV12,
+  GST_VIDEO_FORMAT_NV12,
+  GST_VIDEO_FORMAT_NV21,
+  GST_VIDEO_FORMAT_YUY2,
+  GST_VIDEO_FORMAT_UYVY,
+  GST_VIDEO_FORMAT_Y444,
+  GST_VIDEO_FORMAT_BGRx,
+  GST_VIDEO_FORMAT_UNKNOWN
+};
+
 /* Class initialization. */
 
 #define gst_sunxifbsink_parent_class fbdevframebuffersink_parent_class
@@ -219,12 +261,21 @@ G_DEFINE_TYPE_WITH_CODE (GstSunxifbsink, gst_sunxifbsink,
 static void
 gst_sunxifbsink_class_init (GstSunxifbsinkClass* klass)
 {
-/*  GObjectClass *gobject_class = G_OBJECT_CLASS (klass); */
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstFramebufferSinkClass *framebuffer_sink_class =
       GST_FRAMEBUFFERSINK_CLASS (klass);
 
-/*  gobject_class->set_property = gst_sunxifbsink_set_property;
-    gobject_class->get_property = gst_sunxifbsink_get_property; */
+  gobject_class->set_property = gst_sunxifbsink_set_property;
+  gobject_class->get_property = gst_sunxifbsink_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SCALER_CONVERT,
+      g_param_spec_int ("scaler-convert", "Scaler conversion",
+      "Convert and scale video that is not shown on the hardware layer into "
+      "the screen with the memory-to-memory scaler of the display engine, "
+      "falling back to the CPU. 0 (the default) does so when the scaler is "
+      "available and the hardware layer is not used, 1 always does so "
+      "instead of using the hardware layer and -1 disables it.",
+      -1, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
@@ -249,64 +300,173 @@ gst_sunxifbsink_class_init (GstSunxifbsinkClass* klass)
       GST_DEBUG_FUNCPTR (gst_sunxifbsink_prepare_overlay);
   framebuffer_sink_class->show_overlay =
       GST_DEBUG_FUNCPTR (gst_sunxifbsink_show_overlay);
+  framebuffer_sink_class->set_color_balance =
+      GST_DEBUG_FUNCPTR (gst_sunxifbsink_set_color_balance);
+  framebuffer_sink_class->put_converted_image =
+      GST_DEBUG_FUNCPTR (gst_sunxifbsink_put_converted_image);
 }
 
 /* Class member functions. */
 
 static void
 gst_sunxifbsink_init (GstSunxifbsink *sunxifbsink) {
+  sunxifbsink->scaler_convert_property = 0;
+  sunxifbsink->fd_disp = -1;
+  sunxifbsink->layer_id = -1;
+  sunxifbsink->scaler_handle = -1;
 }
 
-static gboolean
-gst_sunxifbsink_open_hardware (GstFramebufferSink *framebuffersink,
-    GstVideoInfo *info, gsize *video_memory_size,
-    gsize *pannable_video_memory_size)
+static void
+gst_sunxifbsink_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
 {
-  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (framebuffersink);
-  GstFbdevFramebufferSink *fbdevframebuffersink =
-      GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
-  int version;
-  uint32_t tmp;
+  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (object);
+
+  GST_DEBUG_OBJECT (sunxifbsink, "set_property");
+  g_return_if_fail (GST_IS_SUNXIFBSINK (object));
+
+  switch (property_id) {
+    case PROP_SCALER_CONVERT:
+      sunxifbsink->scaler_convert_property = g_value_get_int (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
 
-  if (!gst_fbdevframebuffersink_open_hardware(framebuffersink, info,
-      video_memory_size, pannable_video_memory_size))
-    return FALSE;
+static void
+gst_sunxifbsink_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (object);
+
+  GST_DEBUG_OBJECT (sunxifbsink, "get_property");
+  g_return_if_fail (GST_IS_SUNXIFBSINK (object));
+
+  switch (property_id) {
+    case PROP_SCALER_CONVERT:
+      g_value_set_int (value, sunxifbsink->scaler_convert_property);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
 
-  sunxifbsink->hardware_overlay_available = FALSE;
+/* Open the display engine device. */
 
-  if (framebuffersink->use_hardware_overlay == FALSE)
-    return TRUE;
+static gboolean
+gst_sunxifbsink_open_disp (GstSunxifbsink *sunxifbsink)
+{
+  int version;
+  uint32_t tmp;
 
   sunxifbsink->fd_disp = open ("/dev/disp", O_RDWR);
 
   if (sunxifbsink->fd_disp < 0)
-    return TRUE;
+    return FALSE;
 
   tmp = SUNXI_DISP_VERSION;
   version = ioctl (sunxifbsink->fd_disp, DISP_CMD_VERSION, &tmp);
   if (version < 0) {
     close(sunxifbsink->fd_disp);
+    sunxifbsink->fd_disp = -1;
     GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink,
         "Could not open sunxi disp controller");
-    return TRUE;
+    return FALSE;
   }
+  return TRUE;
+}
 
-  /* Get the ID of the screen layer. */
-  if (ioctl (fbdevframebuffersink->fd, sunxifbsink->framebuffer_id == 0 ?
-  FBIOGET_LAYER_HDL_0 : FBIOGET_LAYER_HDL_1, &sunxifbsink->gfx_layer_id)) {
-    close(sunxifbsink->fd_disp);
-    return TRUE;
+/* Set up conversion of video that is not shown on the hardware layer. */
+
+static void
+gst_sunxifbsink_setup_conversion (GstSunxifbsink *sunxifbsink,
+    GstVideoInfo *info)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sunxifbsink);
+  uint32_t tmp[4];
+
+  /* The scaler only writes 32bpp ARGB. */
+  if (sunxifbsink->fd_disp >= 0 &&
+      GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_BGRx) {
+    tmp[0] = sunxifbsink->framebuffer_id;
+    sunxifbsink->scaler_handle =
+        ioctl (sunxifbsink->fd_disp, DISP_CMD_SCALER_REQUEST, tmp);
   }
 
-  if (!gst_sunxifbsink_reserve_layer(sunxifbsink)) {
-    close(sunxifbsink->fd_disp);
-    return TRUE;
+  if (sunxifbsink->scaler_handle < 0) {
+    sunxifbsink->scaler_handle = -1;
+#if GST_CHECK_VERSION(1, 6, 0)
+    /* Converting with the CPU is no better than converting upstream, so
+       only do so when asked. */
+    if (sunxifbsink->scaler_convert_property != 1)
+      return;
+#else
+    return;
+#endif
   }
 
-  sunxifbsink->layer_is_visible = FALSE;
+  framebuffersink->converted_formats_supported =
+      sunxifbsink_converted_formats_table;
+  framebuffersink->converted_formats_scaled = TRUE;
+  framebuffersink->converted_formats_in_video_memory =
+      sunxifbsink->scaler_handle >= 0;
+  GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink,
+      sunxifbsink->scaler_handle >= 0 ?
+      "Converting and scaling video with the display engine scaler" :
+      "Converting and scaling video with the CPU");
+}
+
+static gboolean
+gst_sunxifbsink_open_hardware (GstFramebufferSink *framebuffersink,
+    GstVideoInfo *info, gsize *video_memory_size,
+    gsize *pannable_video_memory_size)
+{
+  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (framebuffersink);
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (framebuffersink);
+
+  if (!gst_fbdevframebuffersink_open_hardware(framebuffersink, info,
+      video_memory_size, pannable_video_memory_size))
+    return FALSE;
+
+  sunxifbsink->hardware_overlay_available = FALSE;
+  sunxifbsink->layer_id = -1;
+  sunxifbsink->scaler_handle = -1;
+  sunxifbsink->scaler_width_reported = FALSE;
+  sunxifbsink->stats_scaler_frames = 0;
+  sunxifbsink->stats_scaler_in_place_frames = 0;
+  sunxifbsink->stats_cpu_converted_frames = 0;
+
+  /* With scaler-convert=1 the video is always converted into the screen. */
+  if (sunxifbsink->scaler_convert_property == 1)
+    framebuffersink->use_hardware_overlay = FALSE;
+
+  if (!framebuffersink->use_hardware_overlay &&
+      sunxifbsink->scaler_convert_property < 0)
+    return TRUE;
 
-  sunxifbsink->hardware_overlay_available = TRUE;
-  GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink, "Hardware overlay available");
+  if (gst_sunxifbsink_open_disp (sunxifbsink) &&
+      framebuffersink->use_hardware_overlay) {
+    /* Get the ID of the screen layer. */
+    if (ioctl (fbdevframebuffersink->fd, sunxifbsink->framebuffer_id == 0 ?
+        FBIOGET_LAYER_HDL_0 : FBIOGET_LAYER_HDL_1,
+        &sunxifbsink->gfx_layer_id) == 0 &&
+        gst_sunxifbsink_reserve_layer(sunxifbsink)) {
+      sunxifbsink->layer_is_visible = FALSE;
+      sunxifbsink->hardware_overlay_available = TRUE;
+      GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink,
+          "Hardware overlay available");
+    }
+  }
+
+  if (!sunxifbsink->hardware_overlay_available) {
+    framebuffersink->use_hardware_overlay = FALSE;
+    if (sunxifbsink->scaler_convert_property >= 0)
+      gst_sunxifbsink_setup_conversion (sunxifbsink, info);
+  }
 
   return TRUE;
 }
@@ -319,10 +479,35 @@ gst_sunxifbsink_close_hardware (GstFramebufferSink *framebuffersink) {
     gst_sunxifbsink_hide_layer(sunxifbsink);
     gst_sunxifbsink_release_layer(sunxifbsink);
   }
-  /* Before calling close_hardware, use_hardware_overlay is expected to have
-     been reset to the original value it had when open_hardware was called. */
-  if (framebuffersink->use_hardware_overlay)
+
+  if (sunxifbsink->stats_scaler_frames > 0 ||
+      sunxifbsink->stats_cpu_converted_frames > 0) {
+    gchar *s = g_strdup_printf ("%d frames converted by the display engine "
+        "scaler (%d read in place from video memory), %d by the CPU",
+        sunxifbsink->stats_scaler_frames,
+        sunxifbsink->stats_scaler_in_place_frames,
+        sunxifbsink->stats_cpu_converted_frames);
+    GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink, s);
+    g_free (s);
+  }
+  /* The staging memory has to be returned before the video memory is
+     released by the parent class. */
+  if (sunxifbsink->scaler_source != NULL) {
+    gst_memory_unref (sunxifbsink->scaler_source);
+    sunxifbsink->scaler_source = NULL;
+  }
+  gst_sunxifbsink_release_scaler (sunxifbsink);
+#if GST_CHECK_VERSION(1, 6, 0)
+  if (sunxifbsink->converter != NULL) {
+    gst_video_converter_free (sunxifbsink->converter);
+    sunxifbsink->converter = NULL;
+  }
+#endif
+
+  if (sunxifbsink->fd_disp >= 0) {
     close(sunxifbsink->fd_disp);
+    sunxifbsink->fd_disp = -1;
+  }
 
   gst_fbdevframebuffersink_close_hardware (framebuffersink);
 }
@@ -349,19 +534,30 @@ gst_sunxifbsink_get_overlay_video_alignment(GstFramebufferSink *framebuffersink,
 {
   GstVideoFormat format;
   format = GST_VIDEO_INFO_FORMAT (video_info);
-  if (format == GST_VIDEO_FORMAT_I420 ||
-      format == GST_VIDEO_FORMAT_YV12 ||
-      format == GST_VIDEO_FORMAT_NV12 ||
-      format == GST_VIDEO_FORMAT_NV21) {
-    if (GST_VIDEO_INFO_WIDTH (video_info) & 1)
-      /* Hardware overlay not supported for odd widths for all planar formats
-         except Y444. Although it almost works for odd widths, there is an
-         artifact line at the right of the scaled area, related to the
-         alignment requirements of the width. */
-      return FALSE;
+#ifdef HAVE_NV12_32L32
+  if (format == GST_VIDEO_FORMAT_NV12_32L32) {
+    /* The tiled layout is used as is; the display engine derives the tile
+       row stride from the width. Planes start at a tile boundary. */
+    int i;
+    video_alignment->padding_top = 0;
+    video_alignment->padding_bottom = 0;
+    for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+      video_alignment->padding_left[i] = 0;
+      video_alignment->padding_right[i] = 0;
+      video_alignment->stride_align[i] = 0;
+    }
+    *overlay_align = 1023;
+    *video_alignment_matches = TRUE;
+    return TRUE;
   }
-  /* When uses other formats, some artifacts have been observed when the width
-     is odd, but for now leave support for odd widths enabled. */
+#endif
+  /* Odd widths are accepted for the 4:2:0 formats as well. Their scanlines
+     are always padded to an even number of luma pixels (the chroma planes
+     are rounded up); the framebuffer width given to the display engine is
+     the padded width, while the source window keeps the real width so that
+     only the padding is cropped. With other formats some artifacts have
+     been observed when the width is odd, but for now leave support for odd
+     widths enabled. */
   *overlay_align = 15;
   /* For the Allwinner hardware overlay, scanlines need to be aligned to pixel
      boundaries with a minimum alignment of word-aligned. This is a good match
@@ -370,6 +566,36 @@ gst_sunxifbsink_get_overlay_video_alignment(GstFramebufferSink *framebuffersink,
   gst_framebuffersink_set_overlay_video_alignment_from_scanline_alignment (
       framebuffersink, video_info, 3, TRUE, video_alignment,
       video_alignment_matches);
+  if (format == GST_VIDEO_FORMAT_I420 || format == GST_VIDEO_FORMAT_YV12) {
+    /* The display engine derives the chroma stride from the luma width in
+       the framebuffer description, so the luma stride has to be exactly
+       twice the chroma stride. Pad every plane to that even width; for odd
+       widths the default GStreamer layout rarely matches it. */
+    int width = GST_VIDEO_INFO_WIDTH (video_info);
+    int chroma_stride = ALIGNMENT_GET_ALIGNED ((width + 1) / 2, 3);
+    int i;
+    for (i = 0; i < 3; i++) {
+      video_alignment->padding_left[i] = 0;
+      video_alignment->padding_right[i] = chroma_stride * 2 - width;
+    }
+    *video_alignment_matches = GST_VIDEO_INFO_PLANE_STRIDE (video_info, 0) ==
+        chroma_stride * 2 &&
+        GST_VIDEO_INFO_PLANE_STRIDE (video_info, 1) == chroma_stride &&
+        GST_VIDEO_INFO_PLANE_STRIDE (video_info, 2) == chroma_stride;
+  }
+  else if (format == GST_VIDEO_FORMAT_NV12 || format == GST_VIDEO_FORMAT_NV21) {
+    /* Likewise the interleaved chroma plane has the same stride as the luma
+       plane, which is padded to an even width. */
+    int width = GST_VIDEO_INFO_WIDTH (video_info);
+    int stride = ALIGNMENT_GET_ALIGNED ((width + 1) & ~1, 3);
+    int i;
+    for (i = 0; i < 2; i++) {
+      video_alignment->padding_left[i] = 0;
+      video_alignment->padding_right[i] = stride - width;
+    }
+    *video_alignment_matches = GST_VIDEO_INFO_PLANE_STRIDE (video_info, 0) ==
+        stride && GST_VIDEO_INFO_PLANE_STRIDE (video_info, 1) == stride;
+  }
   return TRUE;
 }
 
@@ -444,6 +670,17 @@ gst_sunxifbsink_show_overlay_yuv_planar (GstFramebufferSink *framebuffersink,
         fb.seq = DISP_SEQ_VUVU;
       fb.mode = DISP_MOD_NON_MB_UV_COMBINED;
     }
+#ifdef HAVE_NV12_32L32
+    else if (format == GST_VIDEO_FORMAT_NV12_32L32) {
+      fb.addr[0] = fbdevframebuffersink->fixinfo.smem_start +
+          framebuffer_offset;
+      fb.addr[1] = fbdevframebuffersink->fixinfo.smem_start + framebuffer_offset
+          + framebuffersink->overlay_plane_offset[1];
+      fb.format = DISP_FORMAT_YUV420;
+      fb.seq = DISP_SEQ_UVUV;
+      fb.mode = DISP_MOD_MB_UV_COMBINED;
+    }
+#endif
     else {
       fb.addr[0] = fbdevframebuffersink->fixinfo.smem_start +
           framebuffer_offset;
@@ -643,7 +880,11 @@ gst_sunxifbsink_show_overlay (GstFramebufferSink *framebuffersink,
       sunxifbsink->overlay_format == GST_VIDEO_FORMAT_YV12 ||
       sunxifbsink->overlay_format == GST_VIDEO_FORMAT_Y444 ||
       sunxifbsink->overlay_format == GST_VIDEO_FORMAT_NV12 ||
-      sunxifbsink->overlay_format == GST_VIDEO_FORMAT_NV21)
+      sunxifbsink->overlay_format == GST_VIDEO_FORMAT_NV21
+#ifdef HAVE_NV12_32L32
+      || sunxifbsink->overlay_format == GST_VIDEO_FORMAT_NV12_32L32
+#endif
+      )
     res =  gst_sunxifbsink_show_overlay_yuv_planar (framebuffersink,
         framebuffer_offset, sunxifbsink->overlay_format);
   else if (sunxifbsink->overlay_format == GST_VIDEO_FORMAT_YUY2 ||
@@ -659,6 +900,299 @@ gst_sunxifbsink_show_overlay (GstFramebufferSink *framebuffersink,
   return res;
 }
 
+/* Describe a frame laid out according to info at the physical address
+   address for the display engine. */
+
+static gboolean
+gst_sunxifbsink_get_disp_fb (__disp_fb_t *fb, GstVideoInfo *info,
+    guintptr address)
+{
+  int i;
+
+  memset(fb, 0, sizeof (*fb));
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++)
+    fb->addr[i] = address + GST_VIDEO_INFO_PLANE_OFFSET (info, i);
+  fb->size.width = GST_VIDEO_INFO_PLANE_STRIDE (info, 0) /
+      GST_VIDEO_INFO_COMP_PSTRIDE (info, 0);
+  fb->size.height = GST_VIDEO_INFO_HEIGHT (info);
+
+  switch (GST_VIDEO_INFO_FORMAT (info)) {
+    case GST_VIDEO_FORMAT_YV12:
+      fb->addr[1] = address + GST_VIDEO_INFO_PLANE_OFFSET (info, 2);
+      fb->addr[2] = address + GST_VIDEO_INFO_PLANE_OFFSET (info, 1);
+      /* Fall through. */
+    case GST_VIDEO_FORMAT_I420:
+      fb->format = DISP_FORMAT_YUV420;
+      fb->seq = DISP_SEQ_P3210;
+      fb->mode = DISP_MOD_NON_MB_PLANAR;
+      break;
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+      fb->format = DISP_FORMAT_YUV420;
+      fb->seq = GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_NV12 ?
+          DISP_SEQ_UVUV : DISP_SEQ_VUVU;
+      fb->mode = DISP_MOD_NON_MB_UV_COMBINED;
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_UYVY:
+      fb->format = DISP_FORMAT_YUV422;
+      fb->seq = GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_YUY2 ?
+          DISP_SEQ_YUYV : DISP_SEQ_UYVY;
+      fb->mode = DISP_MOD_INTERLEAVED;
+      break;
+    case GST_VIDEO_FORMAT_Y444:
+      fb->format = DISP_FORMAT_YUV444;
+      fb->seq = DISP_SEQ_P3210;
+      fb->mode = DISP_MOD_NON_MB_PLANAR;
+      break;
+    case GST_VIDEO_FORMAT_BGRx:
+      fb->format = DISP_FORMAT_ARGB8888;
+      fb->seq = DISP_SEQ_ARGB;
+      fb->mode = DISP_MOD_INTERLEAVED;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Return the address in video memory of a frame that upstream wrote into
+   the video memory pool with the default layout, or 0 if it is elsewhere. */
+
+static guintptr
+gst_sunxifbsink_get_frame_address (GstSunxifbsink *sunxifbsink,
+    GstBuffer *buffer)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sunxifbsink);
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (sunxifbsink);
+  GstVideoInfo *info = &framebuffersink->video_info;
+  GstVideoMeta *meta;
+  GstMemory *mem;
+  GstMapInfo mapinfo;
+  guintptr address;
+  int i;
+
+  if (gst_buffer_n_memory (buffer) != 1)
+    return 0;
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (!GST_MEMORY_FLAG_IS_SET (mem, GST_MEMORY_FLAG_VIDEO_MEMORY) ||
+      mem->allocator != framebuffersink->screen_video_memory_allocator)
+    return 0;
+  meta = gst_buffer_get_video_meta (buffer);
+  if (meta != NULL)
+    for (i = 0; i < meta->n_planes; i++)
+      if (meta->offset[i] != GST_VIDEO_INFO_PLANE_OFFSET (info, i) ||
+          meta->stride[i] != GST_VIDEO_INFO_PLANE_STRIDE (info, i))
+        return 0;
+  if (!gst_memory_map (mem, &mapinfo, GST_MAP_READ))
+    return 0;
+  address = fbdevframebuffersink->fixinfo.smem_start +
+      (mapinfo.data - fbdevframebuffersink->framebuffer);
+  gst_memory_unmap (mem, &mapinfo);
+  return address;
+}
+
+/* Convert and scale a frame into the video rectangle of the screen memory
+   vmem with the memory-to-memory scaler. The scaler writes whole scanlines,
+   so the video rectangle has to span the width of the screen. A frame that
+   is not in video memory is copied to the staging memory first. */
+
+static gboolean
+gst_sunxifbsink_scaler_convert (GstSunxifbsink *sunxifbsink,
+    GstBuffer *buffer, GstMemory *vmem)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sunxifbsink);
+  GstFbdevFramebufferSink *fbdevframebuffersink =
+      GST_FBDEVFRAMEBUFFERSINK (sunxifbsink);
+  GstVideoInfo *info = &framebuffersink->video_info;
+  __disp_scaler_para_t para;
+  GstMapInfo mapinfo;
+  guintptr source_address;
+  guintptr dest_address;
+  uint32_t tmp[4];
+  gboolean in_place;
+
+  source_address = gst_sunxifbsink_get_frame_address (sunxifbsink, buffer);
+  in_place = source_address != 0;
+  if (!in_place) {
+    if (sunxifbsink->scaler_source != NULL &&
+        sunxifbsink->scaler_source->size < GST_VIDEO_INFO_SIZE (info)) {
+      gst_memory_unref (sunxifbsink->scaler_source);
+      sunxifbsink->scaler_source = NULL;
+    }
+    if (sunxifbsink->scaler_source == NULL) {
+      sunxifbsink->scaler_source = gst_allocator_alloc (
+          framebuffersink->screen_video_memory_allocator,
+          GST_VIDEO_INFO_SIZE (info), NULL);
+      if (sunxifbsink->scaler_source == NULL)
+        return FALSE;
+    }
+
+    if (!gst_memory_map (sunxifbsink->scaler_source, &mapinfo, GST_MAP_WRITE))
+      return FALSE;
+    gst_buffer_extract (buffer, 0, mapinfo.data, GST_VIDEO_INFO_SIZE (info));
+    source_address = fbdevframebuffersink->fixinfo.smem_start +
+        (mapinfo.data - fbdevframebuffersink->framebuffer);
+    gst_memory_unmap (sunxifbsink->scaler_source, &mapinfo);
+  }
+
+  if (!gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE))
+    return FALSE;
+  dest_address = fbdevframebuffersink->fixinfo.smem_start +
+      (mapinfo.data - fbdevframebuffersink->framebuffer) +
+      framebuffersink->video_rectangle.y *
+      GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0);
+  gst_memory_unmap (vmem, &mapinfo);
+
+  if (!gst_sunxifbsink_get_disp_fb (&para.input_fb, info, source_address))
+    return FALSE;
+  para.source_regn.x = 0;
+  para.source_regn.y = 0;
+  para.source_regn.width = GST_VIDEO_INFO_WIDTH (info);
+  para.source_regn.height = GST_VIDEO_INFO_HEIGHT (info);
+  memset(&para.output_fb, 0, sizeof (para.output_fb));
+  para.output_fb.addr[0] = dest_address;
+  para.output_fb.size.width = framebuffersink->video_rectangle.w;
+  para.output_fb.size.height = framebuffersink->video_rectangle.h;
+  para.output_fb.format = DISP_FORMAT_ARGB8888;
+  para.output_fb.seq = DISP_SEQ_ARGB;
+  para.output_fb.mode = DISP_MOD_INTERLEAVED;
+
+  tmp[0] = sunxifbsink->framebuffer_id;
+  tmp[1] = sunxifbsink->scaler_handle;
+  tmp[2] = (uintptr_t)&para;
+  /* The call returns when the scaler has written the frame. */
+  if (ioctl (sunxifbsink->fd_disp, DISP_CMD_SCALER_EXECUTE, tmp) < 0)
+    return FALSE;
+  if (in_place)
+    sunxifbsink->stats_scaler_in_place_frames++;
+  return TRUE;
+}
+
+#if GST_CHECK_VERSION(1, 6, 0)
+
+/* Convert and scale a frame into the video rectangle of the screen memory
+   vmem with the CPU. */
+
+static gboolean
+gst_sunxifbsink_cpu_convert (GstSunxifbsink *sunxifbsink, GstBuffer *buffer,
+    GstMemory *vmem)
+{
+  GstFramebufferSink *framebuffersink = GST_FRAMEBUFFERSINK (sunxifbsink);
+  GstVideoInfo *screen_info = &framebuffersink->screen_info;
+  GstVideoInfo out_info;
+  GstVideoFrame src_frame;
+  GstVideoFrame dest_frame;
+  GstBuffer *dest;
+  GstMapInfo mapinfo;
+  int stride = GST_VIDEO_INFO_COMP_STRIDE (screen_info, 0);
+  int pstride = GST_VIDEO_INFO_COMP_PSTRIDE (screen_info, 0);
+  gboolean res = FALSE;
+
+  /* Describe the video rectangle on the screen, so that the converter
+     writes straight into it. */
+  gst_video_info_set_format (&out_info, GST_VIDEO_INFO_FORMAT (screen_info),
+      framebuffersink->video_rectangle.w, framebuffersink->video_rectangle.h);
+  out_info.stride[0] = stride;
+  out_info.size = (out_info.height - 1) * stride + out_info.width * pstride;
+
+  if (sunxifbsink->converter != NULL && (!gst_video_info_is_equal (
+      &sunxifbsink->converter_in_info, &framebuffersink->video_info) ||
+      !gst_video_info_is_equal (&sunxifbsink->converter_out_info,
+      &out_info))) {
+    gst_video_converter_free (sunxifbsink->converter);
+    sunxifbsink->converter = NULL;
+  }
+  if (sunxifbsink->converter == NULL) {
+    sunxifbsink->converter = gst_video_converter_new (
+        &framebuffersink->video_info, &out_info, NULL);
+    if (sunxifbsink->converter == NULL)
+      return FALSE;
+    sunxifbsink->converter_in_info = framebuffersink->video_info;
+    sunxifbsink->converter_out_info = out_info;
+  }
+
+  if (!gst_memory_map (vmem, &mapinfo, GST_MAP_WRITE))
+    return FALSE;
+  dest = gst_buffer_new_wrapped_full (0, mapinfo.data +
+      framebuffersink->video_rectangle.y * stride +
+      framebuffersink->video_rectangle.x * pstride, out_info.size, 0,
+      out_info.size, NULL, NULL);
+  if (!gst_video_frame_map (&src_frame, &framebuffersink->video_info, buffer,
+      GST_MAP_READ))
+    goto done;
+  if (gst_video_frame_map (&dest_frame, &out_info, dest, GST_MAP_WRITE)) {
+    gst_video_converter_frame (sunxifbsink->converter, &src_frame,
+        &dest_frame);
+    gst_video_frame_unmap (&dest_frame);
+    res = TRUE;
+  }
+  gst_video_frame_unmap (&src_frame);
+
+done:
+  gst_buffer_unref (dest);
+  gst_memory_unmap (vmem, &mapinfo);
+  return res;
+}
+
+#endif
+
+static GstFlowReturn
+gst_sunxifbsink_put_converted_image (GstFramebufferSink *framebuffersink,
+    GstBuffer *buffer, GstMemory *vmem)
+{
+  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (framebuffersink);
+
+  /* The scaler has no output window, it writes whole scanlines of the
+     output framebuffer. */
+  if (sunxifbsink->scaler_handle >= 0 &&
+      framebuffersink->video_rectangle_width_in_bytes !=
+      GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0) &&
+      !sunxifbsink->scaler_width_reported) {
+    GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink,
+        "The video does not span the width of the screen, which the display "
+        "engine scaler requires; converting with the CPU");
+    sunxifbsink->scaler_width_reported = TRUE;
+  }
+  if (sunxifbsink->scaler_handle >= 0 &&
+      framebuffersink->video_rectangle_width_in_bytes ==
+      GST_VIDEO_INFO_COMP_STRIDE (&framebuffersink->screen_info, 0)) {
+    if (gst_sunxifbsink_scaler_convert (sunxifbsink, buffer, vmem)) {
+      sunxifbsink->stats_scaler_frames++;
+      return GST_FLOW_OK;
+    }
+    GST_SUNXIFBSINK_MESSAGE_OBJECT (sunxifbsink,
+        "Display engine scaler failed, falling back to the CPU");
+    gst_sunxifbsink_release_scaler (sunxifbsink);
+    framebuffersink->converted_formats_in_video_memory = FALSE;
+  }
+
+#if GST_CHECK_VERSION(1, 6, 0)
+  if (gst_sunxifbsink_cpu_convert (sunxifbsink, buffer, vmem)) {
+    sunxifbsink->stats_cpu_converted_frames++;
+    return GST_FLOW_OK;
+  }
+#endif
+
+  GST_ERROR_OBJECT (sunxifbsink, "Could not convert video frame");
+  return GST_FLOW_ERROR;
+}
+
+static void
+gst_sunxifbsink_release_scaler (GstSunxifbsink *sunxifbsink) {
+  uint32_t tmp[4];
+
+  if (sunxifbsink->scaler_handle < 0)
+    return;
+
+  tmp[0] = sunxifbsink->framebuffer_id;
+  tmp[1] = sunxifbsink->scaler_handle;
+  ioctl (sunxifbsink->fd_disp, DISP_CMD_SCALER_RELEASE, tmp);
+
+  sunxifbsink->scaler_handle = -1;
+}
+
 static gboolean
 gst_sunxifbsink_reserve_layer(GstSunxifbsink *sunxifbsink) {
     __disp_layer_info_t layer_info;
@@ -751,6 +1285,51 @@ static void gst_sunxifbsink_hide_layer(GstSunxifbsink *sunxifbsink) {
   sunxifbsink->layer_is_visible = FALSE;
 }
 
+/* Color balance through the layer enhancement of the display engine, which
+   is only available for the scaler layer used for the hardware overlay. The
+   enhancement values range from 0 to 100 with 50 meaning no change. */
+
+static gboolean
+gst_sunxifbsink_set_color_balance (GstFramebufferSink *framebuffersink,
+    const gint *value)
+{
+  static const int command[GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS] = {
+    DISP_CMD_LAYER_SET_BRIGHT, DISP_CMD_LAYER_SET_CONTRAST,
+    DISP_CMD_LAYER_SET_SATURATION, DISP_CMD_LAYER_SET_HUE
+  };
+  GstSunxifbsink *sunxifbsink = GST_SUNXIFBSINK (framebuffersink);
+  gboolean is_default = TRUE;
+  uint32_t tmp[4];
+  int i;
+
+  if (!framebuffersink->use_hardware_overlay || sunxifbsink->layer_id < 0 ||
+      !sunxifbsink->layer_has_scaler)
+    return FALSE;
+
+  for (i = 0; i < GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS; i++)
+    if (value[i] != 0)
+      is_default = FALSE;
+
+  tmp[0] = sunxifbsink->framebuffer_id;
+  tmp[1] = sunxifbsink->layer_id;
+  if (is_default) {
+    ioctl (sunxifbsink->fd_disp, DISP_CMD_LAYER_ENHANCE_OFF, tmp);
+    return TRUE;
+  }
+  if (ioctl (sunxifbsink->fd_disp, DISP_CMD_LAYER_ENHANCE_ON, tmp) < 0)
+    return FALSE;
+  for (i = 0; i < GST_FRAMEBUFFERSINK_COLOR_BALANCE_CHANNELS; i++) {
+    tmp[0] = sunxifbsink->framebuffer_id;
+    tmp[1] = sunxifbsink->layer_id;
+    tmp[2] = (value[i] - GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN) * 100 /
+        (GST_FRAMEBUFFERSINK_COLOR_BALANCE_MAX -
+        GST_FRAMEBUFFERSINK_COLOR_BALANCE_MIN);
+    if (ioctl (sunxifbsink->fd_disp, command[i], tmp) < 0)
+      return FALSE;
+  }
+  return TRUE;
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
@@ -50,6 +50,10 @@ typedef struct _GstSunxifbsinkClass GstSunxifbsinkClass;
 struct _GstSunxifbsink
 {
   GstFbdevFramebufferSink fbdevframebuffersink;
+
+  /* Properties. */
+  gint scaler_convert_property;
+
   gboolean hardware_overlay_available;
   int fd_disp;
   int framebuffer_id;
@@ -58,6 +62,22 @@ struct _GstSunxifbsink
   gboolean layer_has_scaler;
   gboolean layer_is_visible;
   GstVideoFormat overlay_format;
+  /* Conversion of video that is not shown on the hardware layer into the
+     screen, using the memory-to-memory scaler of the display engine with a
+     CPU fallback. The scaler reads from video memory only. Frames that
+     upstream wrote into the video memory pool offered by the base class are
+     read in place; other frames are first copied to scaler_source. */
+  int scaler_handle;
+  GstMemory *scaler_source;
+  gboolean scaler_width_reported;
+#if GST_CHECK_VERSION(1, 6, 0)
+  GstVideoConverter *converter;
+  GstVideoInfo converter_in_info;
+  GstVideoInfo converter_out_info;
+#endif
+  int stats_scaler_frames;
+  int stats_scaler_in_place_frames;
+  int stats_cpu_converted_frames;
 };
 
 struct _GstSunxifbsinkClass
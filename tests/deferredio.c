@@ -0,0 +1,216 @@
+/* Test of the deferred I/O tile writer
+ * Copyright (C) 2013 Harm Hanemaaijer <fgenfb@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Simulates a deferred I/O framebuffer in userspace. Like the kernel's
+   fb_deferred_io, the mapping starts out write-protected and the first write
+   to a page faults, which records the page as dirty and makes it writable.
+   The pages that a frame dirties are what would be pushed to the panel. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gstfbdevdeferredio.h"
+
+#define WIDTH 320
+#define HEIGHT 240
+#define BYTES_PER_PIXEL 2
+#define LINE_LENGTH (WIDTH * BYTES_PER_PIXEL)
+#define TILE_WIDTH 32
+#define TILE_HEIGHT 8
+#define TILES ((WIDTH / TILE_WIDTH) * (HEIGHT / TILE_HEIGHT))
+
+static uint8_t *screen;
+static size_t screen_size;
+static long page_size;
+static int nu_pages;
+static volatile sig_atomic_t *dirty_pages;
+
+static void
+segv_handler (int sig, siginfo_t *info, void *context)
+{
+  uint8_t *addr = info->si_addr;
+  int page;
+
+  if (addr < screen || addr >= screen + screen_size)
+    abort ();
+  page = (addr - screen) / page_size;
+  dirty_pages[page] = 1;
+  mprotect (screen + page * page_size, page_size, PROT_READ | PROT_WRITE);
+}
+
+/* Write-protect the screen again and return the number of pages dirtied
+   since the previous call. */
+
+static int
+flush_dirty_pages (void)
+{
+  int n = 0;
+  int i;
+
+  for (i = 0; i < nu_pages; i++) {
+    n += dirty_pages[i];
+    dirty_pages[i] = 0;
+  }
+  mprotect (screen, screen_size, PROT_READ);
+  return n;
+}
+
+static int failures = 0;
+
+static void
+check (gboolean condition, const char *description)
+{
+  if (!condition) {
+    fprintf (stderr, "FAIL: %s\n", description);
+    failures++;
+  }
+}
+
+static void
+test_detection (void)
+{
+  struct fb_fix_screeninfo fixinfo;
+  struct fb_var_screeninfo varinfo;
+
+  memset (&fixinfo, 0, sizeof (fixinfo));
+  memset (&varinfo, 0, sizeof (varinfo));
+  strcpy (fixinfo.id, "fb_ili9341");
+  fixinfo.line_length = LINE_LENGTH;
+  varinfo.yres = HEIGHT;
+  fixinfo.smem_len = LINE_LENGTH * HEIGHT;
+  check (gst_fbdev_deferred_io_is_device (&fixinfo, &varinfo),
+      "fbtft device with a single screen is detected");
+  fixinfo.smem_len = LINE_LENGTH * HEIGHT * 2 - 1;
+  check (gst_fbdev_deferred_io_is_device (&fixinfo, &varinfo),
+      "fbtft device with less than two screens is detected");
+  fixinfo.smem_len = LINE_LENGTH * HEIGHT * 2;
+  check (!gst_fbdev_deferred_io_is_device (&fixinfo, &varinfo),
+      "fbtft device with two screens is not detected");
+  strcpy (fixinfo.id, "mxsfb");
+  fixinfo.smem_len = LINE_LENGTH * HEIGHT;
+  check (!gst_fbdev_deferred_io_is_device (&fixinfo, &varinfo),
+      "device that is not fbtft is not detected");
+}
+
+static guint
+write_frame (uint8_t *shadow, const uint8_t *frame, gboolean force,
+    guint64 *tiles_total)
+{
+  return gst_fbdev_deferred_io_write_tiles (screen, shadow, LINE_LENGTH,
+      frame, LINE_LENGTH, LINE_LENGTH, HEIGHT, TILE_WIDTH * BYTES_PER_PIXEL,
+      TILE_HEIGHT, force, tiles_total);
+}
+
+static void
+test_tiles (void)
+{
+  uint8_t *frame = malloc (screen_size);
+  uint8_t *shadow = malloc (screen_size);
+  guint64 tiles_total = 0;
+  int first_page;
+  int last_page;
+  int i;
+  int n;
+
+  for (i = 0; i < LINE_LENGTH * HEIGHT; i++)
+    frame[i] = i * 7;
+
+  flush_dirty_pages ();
+  check (write_frame (shadow, frame, TRUE, &tiles_total) == TILES,
+      "first frame writes every tile");
+  check (tiles_total == TILES, "every tile is counted");
+  check (memcmp (screen, frame, LINE_LENGTH * HEIGHT) == 0,
+      "first frame is on the screen");
+  check (flush_dirty_pages () == nu_pages, "first frame dirties every page");
+
+  check (write_frame (shadow, frame, FALSE, &tiles_total) == 0,
+      "unchanged frame writes no tiles");
+  check (tiles_total == 2 * TILES, "unchanged tiles are counted");
+  check (flush_dirty_pages () == 0, "unchanged frame dirties no pages");
+
+  /* Change one pixel in the tile at column 3, row 18. */
+  frame[(18 * TILE_HEIGHT + 5) * LINE_LENGTH + (3 * TILE_WIDTH + 1)
+      * BYTES_PER_PIXEL] ^= 0xFF;
+  check (write_frame (shadow, frame, FALSE, &tiles_total) == 1,
+      "changed pixel writes one tile");
+  check (memcmp (screen, frame, LINE_LENGTH * HEIGHT) == 0,
+      "changed pixel is on the screen");
+  first_page = 18 * TILE_HEIGHT * LINE_LENGTH / page_size;
+  last_page = ((18 * TILE_HEIGHT + TILE_HEIGHT - 1) * LINE_LENGTH
+      + LINE_LENGTH - 1) / page_size;
+  n = 0;
+  for (i = 0; i < nu_pages; i++)
+    if (dirty_pages[i]) {
+      check (i >= first_page && i <= last_page,
+          "changed pixel only dirties the pages of its tile");
+      n++;
+    }
+  check (n > 0, "changed pixel dirties a page");
+  flush_dirty_pages ();
+
+  check (write_frame (NULL, frame, FALSE, &tiles_total) == TILES,
+      "without a shadow every tile is written");
+  flush_dirty_pages ();
+
+  /* A video rectangle that is not a multiple of the tile size. */
+  tiles_total = 0;
+  check (gst_fbdev_deferred_io_write_tiles (screen, shadow, LINE_LENGTH,
+      frame, LINE_LENGTH, 100 * BYTES_PER_PIXEL, 20,
+      TILE_WIDTH * BYTES_PER_PIXEL, TILE_HEIGHT, TRUE, &tiles_total) == 12,
+      "partial tiles are written");
+  check (tiles_total == 12, "partial tiles are counted");
+  flush_dirty_pages ();
+
+  free (frame);
+  free (shadow);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct sigaction action;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  screen_size = LINE_LENGTH * HEIGHT;
+  nu_pages = (screen_size + page_size - 1) / page_size;
+  screen_size = nu_pages * page_size;
+  screen = mmap (NULL, screen_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+      -1, 0);
+  if (screen == MAP_FAILED) {
+    perror ("mmap");
+    return 1;
+  }
+  dirty_pages = calloc (nu_pages, sizeof (*dirty_pages));
+
+  memset (&action, 0, sizeof (action));
+  action.sa_sigaction = segv_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigaction (SIGSEGV, &action, NULL);
+
+  test_detection ();
+  test_tiles ();
+
+  if (failures > 0)
+    return 1;
+  printf ("All deferred I/O tests passed.\n");
+  return 0;
+}